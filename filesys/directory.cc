@@ -1,88 +1,214 @@
-// directory.cc 
+// directory.cc
 //	Routines to manage a directory of file names.
 //
-//	The directory is a table of fixed length entries; each
-//	entry represents a single file, and contains the file name,
-//	and the location of the file header on disk.  The fixed size
-//	of each directory entry means that we have the restriction
-//	of a fixed maximum size for file names.
+//	The directory is a hash table, kept in a Nachos file as a series
+//	of fixed size buckets.  Each bucket holds the entries whose names
+//	hash to it; each entry represents a single file, and contains
+//	the file name, and the location of the file header on disk.
+//	Entries take only as much room as their names need.
 //
-//	The constructor initializes an empty directory of a certain size;
-//	we use ReadFrom/WriteBack to fetch the contents of the directory
-//	from disk, and to write back any modifications back to disk.
+//	The table grows by linear hashing.  With n buckets, and L the
+//	largest power of two not above n, a name with hash h goes in
+//	bucket h mod 2L, or h mod L if there is no such bucket.  When a
+//	bucket fills up, bucket n - L is split: bucket n is added at the
+//	end of the file, and the entries with h mod 2L = n move to it.
+//	Splits go round the table in order, so the buckets stay about
+//	equally full and no bucket is ever more than one split away from
+//	having room.  A name that still does not fit causes more splits;
+//	when the disk is full, it cannot be added.
 //
-//	Also, this implementation has the restriction that the size
-//	of the directory cannot expand.  In other words, once all the
-//	entries in the directory are used, no more files can be created.
-//	Fixing this is one of the parts to the assignment.
+//	The directory never shrinks: removing a file just frees the room
+//	its entry took in its bucket.
+//
+//	The file system keeps directories open, with their buckets in
+//	memory, so that lookups need not go to the disk.  Changes reach
+//	the disk when the file system is synced (cf. FileSystem::Sync),
+//	except for new buckets, which are written at once to claim the
+//	disk space they need.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
-// All rights reserved.  See copyright.h for copyright notice and limitation 
+// All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
 #include "utility.h"
 #include "filehdr.h"
 #include "directory.h"
+#include "system.h"
+
+//----------------------------------------------------------------------
+// HashName
+// 	Hash the first "length" characters of a file name (FNV-1a).
+//----------------------------------------------------------------------
+
+static unsigned
+HashName(const char *name, int length)
+{
+    unsigned hash = 2166136261u;
+
+    for (int i = 0; i < length; i++) {
+	hash ^= (unsigned char) name[i];
+	hash *= 16777619;
+    }
+    return hash;
+}
+
+//----------------------------------------------------------------------
+// IsDots
+// 	Is this the entry for "." or ".."?
+//----------------------------------------------------------------------
+
+static bool
+IsDots(DirectoryEntry *entry)
+{
+    return (entry->nameLength == 1 && entry->name[0] == '.')
+	|| (entry->nameLength == 2 && !strncmp(entry->name, "..", 2));
+}
+
+//----------------------------------------------------------------------
+// PathName
+// 	Return the path name of a directory entry: "path" followed by the
+//	entry's name, and by a '/' if it is a directory.  The caller
+//	deletes the string.
+//----------------------------------------------------------------------
+
+static char *
+PathName(const char *path, DirectoryEntry *entry)
+{
+    char *name = new char[strlen(path) + entry->nameLength + 2];
+
+    sprintf(name, "%s%.*s%s", path, entry->nameLength, entry->name,
+	    entry->isDirectory ? "/" : "");
+    return name;
+}
 
 //----------------------------------------------------------------------
 // Directory::Directory
-// 	Initialize a directory; initially, the directory is completely
-//	empty.  If the disk is being formatted, an empty directory
-//	is all we need, but otherwise, we need to call FetchFrom in order
-//	to initialize it from disk.
+// 	Use a directory on disk.  If the directory is being created,
+//	we need to call Initialize to store an empty directory in the file.
 //
-//	"size" is the number of entries in the directory
+//	"sector" is the location on disk of the directory's file header
+//	"dirFile" is the directory's file, already open; it is closed
+//		along with the directory
 //----------------------------------------------------------------------
 
-Directory::Directory(int size)
+Directory::Directory(int sector, OpenFile *dirFile)
 {
-    table = new DirectoryEntry[size];
-    tableSize = size;
-    for (int i = 0; i < tableSize; i++)
-	table[i].inUse = false;
+    hdrSector = sector;
+    file = dirFile;
+    numBuckets = file->Length() / BucketSize;
+    tableSize = numBuckets;
+    buckets = new DirectoryBucket *[tableSize];
+    dirty = new bool[tableSize];
+    for (int i = 0; i < tableSize; i++) {
+	buckets[i] = NULL;
+	dirty[i] = false;
+    }
+    bucket = NULL;
+    current = -1;
 }
 
 //----------------------------------------------------------------------
 // Directory::~Directory
-// 	De-allocate directory data structure.
+// 	De-allocate directory data structure, and close the file.
 //----------------------------------------------------------------------
 
 Directory::~Directory()
-{ 
-    delete [] table;
-} 
+{
+    for (int i = 0; i < numBuckets; i++)
+	delete buckets[i];
+    delete [] buckets;
+    delete [] dirty;
+    delete file;
+}
 
 //----------------------------------------------------------------------
-// Directory::FetchFrom
-// 	Read the contents of the directory from disk.
+// Directory::Initialize
+// 	Make an empty directory -- a single bucket, with the entries
+//	for "." and ".." -- in a file just created one bucket long.
 //
-//	"file" -- file containing the directory contents
+//	"parentSector" -- where the header of the parent directory is
+//			(the directory itself, for the root)
 //----------------------------------------------------------------------
 
 void
-Directory::FetchFrom(OpenFile *file)
+Directory::Initialize(int parentSector)
 {
-    file->ReadAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    ASSERT(numBuckets == 1 && buckets[0] == NULL);
+    buckets[0] = bucket = new DirectoryBucket;
+    bucket->used = 0;
+    current = 0;
+    WriteBucket();
+    Add(".", hdrSector, true);
+    Add("..", parentSector, true);
+}
+
+//----------------------------------------------------------------------
+// Directory::ReadBucket/WriteBucket
+// 	Make bucket number "which" the one to work on, reading it in if
+//	this is the first time it is needed; or note that it changed.
+//----------------------------------------------------------------------
+
+void
+Directory::ReadBucket(int which)
+{
+    if (buckets[which] == NULL) {
+	buckets[which] = new DirectoryBucket;
+	file->ReadAt((char *)buckets[which], BucketSize, which * BucketSize);
+    }
+    bucket = buckets[which];
+    current = which;
+}
+
+void
+Directory::WriteBucket()
+{
+    dirty[current] = true;
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-// 	Write any modifications to the directory back to disk
-//
-//	"file" -- file to contain the new directory contents
+// 	Write the buckets that changed since the last WriteBack to disk.
+//	Only the sectors of a bucket that hold entries are written, since
+//	each one written is logged by the journal.
 //----------------------------------------------------------------------
 
 void
-Directory::WriteBack(OpenFile *file)
+Directory::WriteBack()
+{
+    for (int i = 0; i < numBuckets; i++)
+	if (dirty[i]) {
+	    int length = divRoundUp(sizeof(int) + buckets[i]->used,
+				    SectorSize) * SectorSize;
+
+	    file->WriteAt((char *)buckets[i], length, i * BucketSize);
+	    dirty[i] = false;
+	}
+}
+
+//----------------------------------------------------------------------
+// Directory::BucketOf
+// 	Return the bucket where the names with hash "hash" go.
+//----------------------------------------------------------------------
+
+int
+Directory::BucketOf(unsigned hash)
 {
-    file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
+    int level, which;
+
+    for (level = 1; 2 * level <= numBuckets; level *= 2)
+	;
+    which = hash % (2 * level);
+    if (which >= numBuckets)
+	which -= level;			// not split yet: use hash mod level
+    return which;
 }
 
 //----------------------------------------------------------------------
 // Directory::FindIndex
-// 	Look up file name in directory, and return its location in the table of
-//	directory entries.  Return -1 if the name isn't in the directory.
+// 	Look up file name in directory: read in the bucket the name hashes
+//	to, and return the entry's offset in it.  Return -1 if the name
+//	isn't in the directory.
 //
 //	"name" -- the file name to look up
 //----------------------------------------------------------------------
@@ -90,108 +216,293 @@ Directory::WriteBack(OpenFile *file)
 int
 Directory::FindIndex(const char *name)
 {
-    for (int i = 0; i < tableSize; i++)
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen))
-	    return i;
+    int length = strlen(name);
+    DirectoryEntry *entry;
+
+    if (length > FileNameMaxLen)
+	return -1;
+    ReadBucket(BucketOf(HashName(name, length)));
+    for (int offset = 0; offset < bucket->used;
+	 offset += EntrySize(entry->nameLength)) {
+	entry = (DirectoryEntry *) &bucket->entries[offset];
+	if (entry->nameLength == length && !strncmp(entry->name, name, length))
+	    return offset;
+    }
     return -1;		// name not in directory
 }
 
 //----------------------------------------------------------------------
 // Directory::Find
 // 	Look up file name in directory, and return the disk sector number
-//	where the file's header is stored. Return -1 if the name isn't 
+//	where the file's header is stored. Return -1 if the name isn't
 //	in the directory.
 //
 //	"name" -- the file name to look up
+//	"isDirectory" -- if not NULL, set to whether the file is a directory
 //----------------------------------------------------------------------
 
 int
-Directory::Find(const char *name)
+Directory::Find(const char *name, bool *isDirectory)
 {
-    int i = FindIndex(name);
+    int offset = FindIndex(name);
+    DirectoryEntry *entry;
 
-    if (i != -1)
-	return table[i].sector;
-    return -1;
+    if (offset == -1)
+	return -1;
+    entry = (DirectoryEntry *) &bucket->entries[offset];
+    if (isDirectory != NULL)
+	*isDirectory = entry->isDirectory;
+    return entry->sector;
 }
 
 //----------------------------------------------------------------------
 // Directory::Add
 // 	Add a file into the directory.  Return true if successful;
-//	return false if the file name is already in the directory, or if
-//	the directory is completely full, and has no more space for
-//	additional file names.
+//	return false if the file name is already in the directory, if it
+//	is empty or too long, or if there is no room on the disk for the
+//	directory to grow.
 //
 //	"name" -- the name of the file being added
 //	"newSector" -- the disk sector containing the added file's header
+//	"isDirectory" -- is the added file a directory?
+//----------------------------------------------------------------------
+
+bool
+Directory::Add(const char *name, int newSector, bool isDirectory)
+{
+    int length = strlen(name);
+    DirectoryEntry *entry;
+
+    if (length == 0 || length > FileNameMaxLen || FindIndex(name) != -1)
+	return false;
+
+    for (;;) {
+	ReadBucket(BucketOf(HashName(name, length)));
+	if (bucket->used + (int) EntrySize(length)
+		<= (int) sizeof(bucket->entries))
+	    break;
+	if (!Split())
+	    return false;	// no room for the directory to grow
+    }
+    entry = (DirectoryEntry *) &bucket->entries[bucket->used];
+    entry->sector = newSector;
+    entry->isDirectory = isDirectory;
+    entry->nameLength = length;
+    strncpy(entry->name, name, length);
+    bucket->used += EntrySize(length);
+    WriteBucket();
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Directory::Split
+// 	Grow the directory by one bucket, moving into it the entries of
+//	the next bucket to split that now hash to it.  The new bucket is
+//	written (and given disk space) at once, and the old one loses the
+//	entries only in memory, so that every name is always in the
+//	directory on disk.
+//
+//	Return false if the disk is full.
 //----------------------------------------------------------------------
 
 bool
-Directory::Add(const char *name, int newSector)
-{ 
-    if (FindIndex(name) != -1)
+Directory::Split()
+{
+    DirectoryBucket *newBucket = new DirectoryBucket;
+    DirectoryBucket *keptBucket = new DirectoryBucket;
+    DirectoryEntry *entry;
+    int level, victim, offset, size, i;
+
+    for (level = 1; 2 * level <= numBuckets; level *= 2)
+	;
+    victim = numBuckets - level;
+    DEBUG('f', "Splitting directory bucket %d into %d\n", victim, numBuckets);
+
+    ReadBucket(victim);
+    newBucket->used = keptBucket->used = 0;
+    for (offset = 0; offset < bucket->used; offset += size) {
+	entry = (DirectoryEntry *) &bucket->entries[offset];
+	size = EntrySize(entry->nameLength);
+	if (HashName(entry->name, entry->nameLength) % (2 * level)
+		== (unsigned) victim) {
+	    bcopy((char *)entry, &keptBucket->entries[keptBucket->used], size);
+	    keptBucket->used += size;
+	} else {
+	    bcopy((char *)entry, &newBucket->entries[newBucket->used], size);
+	    newBucket->used += size;
+	}
+    }
+
+    if (file->WriteAt((char *)newBucket, BucketSize, numBuckets * BucketSize)
+	    < BucketSize || !file->Flush()) {
+	file->Discard();
+	delete newBucket;
+	delete keptBucket;
 	return false;
+    }
+
+    if (numBuckets == tableSize) {		// make room for the new bucket
+	DirectoryBucket **moreBuckets = new DirectoryBucket *[2 * tableSize];
+	bool *moreDirty = new bool[2 * tableSize];
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse) {
-            table[i].inUse = true;
-            strncpy(table[i].name, name, FileNameMaxLen); 
-            table[i].sector = newSector;
-        return true;
+	for (i = 0; i < numBuckets; i++) {
+	    moreBuckets[i] = buckets[i];
+	    moreDirty[i] = dirty[i];
 	}
-    return false;	// no space.  Fix when we have extensible files.
+	delete [] buckets;
+	delete [] dirty;
+	buckets = moreBuckets;
+	dirty = moreDirty;
+	tableSize *= 2;
+    }
+    buckets[numBuckets] = newBucket;
+    dirty[numBuckets] = false;
+    numBuckets++;
+
+    delete buckets[victim];
+    buckets[victim] = bucket = keptBucket;
+    WriteBucket();
+    return true;
 }
 
 //----------------------------------------------------------------------
 // Directory::Remove
 // 	Remove a file name from the directory.  Return true if successful;
-//	return false if the file isn't in the directory. 
+//	return false if the file isn't in the directory.
 //
 //	"name" -- the file name to be removed
 //----------------------------------------------------------------------
 
 bool
 Directory::Remove(const char *name)
-{ 
-    int i = FindIndex(name);
+{
+    int offset = FindIndex(name);
+    int size;
 
-    if (i == -1)
+    if (offset == -1)
 	return false; 		// name not in directory
-    table[i].inUse = false;
-    return true;	
+    size = EntrySize(((DirectoryEntry *) &bucket->entries[offset])->nameLength);
+    bcopy(&bucket->entries[offset + size], &bucket->entries[offset],
+	  bucket->used - offset - size);
+    bucket->used -= size;
+    WriteBucket();
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Directory::IsEmpty
+// 	Return true if the directory holds no files, just "." and "..".
+//----------------------------------------------------------------------
+
+bool
+Directory::IsEmpty()
+{
+    DirectoryEntry *entry;
+
+    for (int which = 0; which < numBuckets; which++) {
+	ReadBucket(which);
+	for (int offset = 0; offset < bucket->used;
+	     offset += EntrySize(entry->nameLength)) {
+	    entry = (DirectoryEntry *) &bucket->entries[offset];
+	    if (!IsDots(entry))
+		return false;
+	}
+    }
+    return true;
 }
 
 //----------------------------------------------------------------------
 // Directory::List
-// 	List all the file names in the directory. 
+// 	List all the file names in the directory, and in the directories
+//	below it, as path names starting with "path".
 //----------------------------------------------------------------------
 
 void
-Directory::List()
+Directory::List(const char *path)
 {
-   for (int i = 0; i < tableSize; i++)
-	if (table[i].inUse)
-	    printf("%s\n", table[i].name);
+    DirectoryEntry *entry;
+    char *name;
+
+    for (int which = 0; which < numBuckets; which++) {
+	ReadBucket(which);
+	for (int offset = 0; offset < bucket->used;
+	     offset += EntrySize(entry->nameLength)) {
+	    entry = (DirectoryEntry *) &bucket->entries[offset];
+	    if (IsDots(entry))
+		continue;
+	    name = PathName(path, entry);
+	    printf("%s\n", name);
+	    if (entry->isDirectory)
+		fileSystem->GetDirectory(entry->sector)->List(name);
+	    delete [] name;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// Directory::Walk
+// 	Call "visit" on each file in the directory, and in the directories
+//	below it (but not on the directories themselves), with its path
+//	name starting with "path", and the sector of its header.  "visit"
+//	must not change the directories.
+//----------------------------------------------------------------------
+
+void
+Directory::Walk(const char *path, FileVisitor visit, void *arg)
+{
+    DirectoryEntry *entry;
+    char *name;
+
+    for (int which = 0; which < numBuckets; which++) {
+	ReadBucket(which);
+	for (int offset = 0; offset < bucket->used;
+	     offset += EntrySize(entry->nameLength)) {
+	    entry = (DirectoryEntry *) &bucket->entries[offset];
+	    if (IsDots(entry))
+		continue;
+	    name = PathName(path, entry);
+	    if (entry->isDirectory)
+		fileSystem->GetDirectory(entry->sector)->Walk(name, visit, arg);
+	    else
+		(*visit)(name, entry->sector, arg);
+	    delete [] name;
+	}
+    }
 }
 
 //----------------------------------------------------------------------
 // Directory::Print
-// 	List all the file names in the directory, their FileHeader locations,
-//	and the contents of each file.  For debugging.
+// 	List all the file names in the directory and below it, their
+//	FileHeader locations, and the contents of each file.  For
+//	debugging.
 //----------------------------------------------------------------------
 
 void
-Directory::Print()
-{ 
+Directory::Print(const char *path)
+{
     FileHeader *hdr = new FileHeader;
+    DirectoryEntry *entry;
+    char *name;
 
-    printf("Directory contents:\n");
-    for (int i = 0; i < tableSize; i++)
-	if (table[i].inUse) {
-	    printf("Name: %s, Sector: %d\n", table[i].name, table[i].sector);
-	    hdr->FetchFrom(table[i].sector);
+    if (*path == '\0')
+	printf("Directory contents:\n");
+    for (int which = 0; which < numBuckets; which++) {
+	ReadBucket(which);
+	for (int offset = 0; offset < bucket->used;
+	     offset += EntrySize(entry->nameLength)) {
+	    entry = (DirectoryEntry *) &bucket->entries[offset];
+	    if (IsDots(entry))
+		continue;
+	    name = PathName(path, entry);
+	    printf("Name: %s, Sector: %d\n", name, entry->sector);
+	    hdr->FetchFrom(entry->sector);
 	    hdr->Print();
+	    if (entry->isDirectory)
+		fileSystem->GetDirectory(entry->sector)->Print(name);
+	    delete [] name;
 	}
-    printf("\n");
+    }
+    if (*path == '\0')
+	printf("\n");
     delete hdr;
 }
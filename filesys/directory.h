@@ -1,15 +1,18 @@
-// directory.h 
+// directory.h
 //	Data structures to manage a UNIX-like directory of file names.
-// 
+//
 //      A directory is a table of pairs: <file name, sector #>,
-//	giving the name of each file in the directory, and 
+//	giving the name of each file in the directory, and
 //	where to find its file header (the data structure describing
 //	where to find the file's data blocks) on disk.
 //
+//	Directories can hold other directories.  Every directory has
+//	entries for "." (itself) and ".." (its parent), as in UNIX.
+//
 //      We assume mutual exclusion is provided by the caller.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
-// All rights reserved.  See copyright.h for copyright notice and limitation 
+// All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
@@ -18,67 +21,116 @@
 #define DIRECTORY_H
 
 #include "openfile.h"
+#include "disk.h"
 
-const int FileNameMaxLen = 9;		// for simplicity, we assume 
-					// file names are <= 9 characters long
+const int FileNameMaxLen = 255;		// file names are <= 255 characters
+					// long
+
+#define BucketSize	(4 * SectorSize)	// bytes per directory bucket
 
 // The following class defines a "directory entry", representing a file
 // in the directory.  Each entry gives the name of the file, and where
 // the file's header is to be found on disk.
 //
+// On disk, an entry takes only EntrySize(nameLength) bytes: the name
+// is not null-terminated, and only its own characters are stored.
+//
 // Internal data structures kept public so that Directory operations can
 // access them directly.
 
 class DirectoryEntry {
   public:
-    bool inUse;				// Is this directory entry in use?
-    int sector;				// Location on disk to find the 
-					//   FileHeader for this file 
-    char name[FileNameMaxLen + 1];	// Text name for file, with +1 for 
-					// the trailing '\0'
+    int sector;				// Location on disk to find the
+					//   FileHeader for this file
+    bool isDirectory;			// Is this file a directory?
+    unsigned char nameLength;		// Number of characters in the name
+    char name[FileNameMaxLen];		// Text name for file
 };
 
+#define EntrySize(nameLength) \
+	(divRoundUp(sizeof(int) + 2 + (nameLength), sizeof(int)) * sizeof(int))
+
+// The following class defines a bucket of a directory: the entries
+// whose names hash to it, packed one after the other.
+
+class DirectoryBucket {
+  public:
+    int used;				// Bytes of "entries" in use
+    char entries[BucketSize - sizeof(int)];
+};
+
+// Called by Directory::Walk for each file, with its path name and the
+// sector of its header.
+
+typedef void (*FileVisitor)(const char *path, int sector, void *arg);
+
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
-// The directory data structure can be stored in memory, or on disk.
-// When it is on disk, it is stored as a regular Nachos file.
+// The directory is stored as a regular Nachos file, made of buckets
+// of BucketSize bytes.  Names are hashed to a bucket by linear hashing:
+// when a bucket overflows, the directory grows by one bucket, taking
+// over half the entries of the next bucket in line.  A lookup reads a
+// single bucket, however many files the directory holds.
 //
-// The constructor initializes a directory structure in memory; the
-// FetchFrom/WriteBack operations shuffle the directory information
-// from/to disk. 
+// The constructor takes the directory's file, already open.  Buckets
+// are read in the first time they are needed, and then kept in memory;
+// the ones that change are written back to disk only by WriteBack.
 
 class Directory {
   public:
-    Directory(int size); 		// Initialize an empty directory
-					// with space for "size" files
-    ~Directory();			// De-allocate the directory
-
-    void FetchFrom(OpenFile *file);  	// Init directory contents from disk
-    void WriteBack(OpenFile *file);	// Write modifications to 
-					// directory contents back to disk
-
-    int Find(const char *name);		// Find the sector number of the 
+    Directory(int sector, OpenFile *dirFile);
+					// Use the directory whose file
+					// header is at "sector", open in
+					// "dirFile"
+    ~Directory();			// Close the directory, forgetting
+					// any changes not written back
+
+    int HeaderSector() { return hdrSector; }
+
+    void Initialize(int parentSector);	// Make an empty directory, holding
+					// just "." and ".."
+    void WriteBack();			// Write modified buckets back to
+					// disk
+
+    int Find(const char *name, bool *isDirectory = NULL);
+					// Find the sector number of the
 					// FileHeader for file: "name"
 
-    bool Add(const char *name, int newSector);
+    bool Add(const char *name, int newSector, bool isDirectory);
     					// Add a file name into the directory
 
     bool Remove(const char *name);	// Remove a file from the directory
 
-    void List();			// Print the names of all the files
-					//  in the directory
-    void Print();			// Verbose print of the contents
+    bool IsEmpty();			// Nothing but "." and ".."?
+
+    void List(const char *path);	// Print the names of all the files
+					//  in the directory, and below it
+    void Walk(const char *path, FileVisitor visit, void *arg);
+					// Call "visit" on all the files in
+					//  the directory, and below it
+    void Print(const char *path);	// Verbose print of the contents
 					//  of the directory -- all the file
 					//  names and their contents.
 
   private:
-    int tableSize;			// Number of directory entries
-    DirectoryEntry *table;		// Table of pairs: 
-					// <file name, file header location> 
-
-    int FindIndex(const char *name);	// Find the index into the directory 
-					//  table corresponding to "name"
+    int hdrSector;			// Where the directory's header is
+    OpenFile *file;			// File holding the directory
+    int numBuckets;			// Number of buckets in "file"
+    DirectoryBucket **buckets;		// Buckets read in, NULL for the rest
+    bool *dirty;			// Which ones changed in memory
+    int tableSize;			// Room in "buckets" and "dirty"
+    DirectoryBucket *bucket;		// Bucket being worked on
+    int current;			// ... and its number
+
+    int BucketOf(unsigned hash);	// Bucket where names with this hash
+					//  go
+    void ReadBucket(int which);		// Make "which" the current bucket
+    void WriteBucket();			// Mark the current bucket modified
+    int FindIndex(const char *name);	// Find the offset in its bucket
+					//  of the entry for "name", after
+					//  reading the bucket in
+    bool Split();			// Grow the directory by one bucket
 };
 
 #endif // DIRECTORY_H
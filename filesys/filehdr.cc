@@ -3,12 +3,18 @@
 //	would be called the i-node).
 //
 //	The file header is used to locate where on disk the 
-//	file's data is stored.  We implement this as a fixed size
-//	table of pointers -- each entry in the table points to the 
-//	disk sector containing that portion of the file data
-//	(in other words, there are no indirect or doubly indirect 
-//	blocks). The table size is chosen so that the file header
-//	will be just big enough to fit in one disk sector, 
+//	file's data is stored.  We implement this as a list of extents
+//	-- each entry gives a run of consecutive disk sectors holding
+//	the next portion of the file data.  The first few extents live
+//	in the header, which is just big enough to fit in one disk
+//	sector; any others go in a chain of extent blocks.  Small files
+//	keep their data in the header instead.
+//
+//	Data sectors are allocated in runs as long as possible, starting
+//	next to the file header, so that reading a file sequentially
+//	seldom moves the disk head.  On a log-structured disk, they start
+//	instead at the log head, wherever the last sectors allocated on
+//	the disk ended (cf. FileSystem::LogGoal).
 //
 //      Unlike in a real system, we do not keep track of file permissions, 
 //	ownership, last modification date, etc., in the file header. 
@@ -27,49 +33,272 @@
 #include "system.h"
 #include "filehdr.h"
 
+//----------------------------------------------------------------------
+// FreeSector
+// 	Return a sector of this file to the free map.  The journal must
+//	not replay old images of it (it may have been an extent block).
+//----------------------------------------------------------------------
+
+static void
+FreeSector(FreeMap *freeMap, int sector)
+{
+    ASSERT(freeMap->Test(sector));	// ought to be marked!
+    freeMap->Clear(sector);
+    journal->Forget(sector);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FileHeader
+// 	Initialize an empty file header.
+//----------------------------------------------------------------------
+
+FileHeader::FileHeader()
+{
+    numBytes = numSectors = numExtents = 0;
+    extentBlock = -1;
+    table = NULL;
+    firstSector = NULL;
+    tableSize = 0;
+    blocks = NULL;
+    numBlocks = 0;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::~FileHeader
+// 	De-allocate the in-memory extent list.
+//----------------------------------------------------------------------
+
+FileHeader::~FileHeader()
+{
+    delete [] table;
+    delete [] firstSector;
+    delete [] blocks;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Allocate
 // 	Initialize a fresh file header for a newly created file.
-//	Allocate data blocks for the file out of the map of free disk blocks.
+//	Allocate data blocks for the file out of the map of free disk blocks,
+//	in as few extents as possible, starting next to the file header;
+//	and the extent blocks needed to list them, if any.
 //	Return false if there are not enough free blocks to accomodate
 //	the new file.
 //
-//	"freeMap" is the bit map of free disk sectors
-//	"fileSize" is the bit map of free disk sectors
+//	"freeMap" is the map of free disk sectors
+//	"fileSize" is the size of the new file, in bytes
+//	"headerSector" is the sector holding the file header
+//	"logHead" is the log head, on a log-structured disk (else NULL)
 //----------------------------------------------------------------------
 
 bool
-FileHeader::Allocate(BitMap *freeMap, int fileSize)
+FileHeader::Allocate(FreeMap *freeMap, int fileSize, int headerSector,
+		     int *logHead)
 { 
-    numBytes = fileSize;
-    numSectors  = divRoundUp(fileSize, SectorSize);
+    numBytes = numSectors = numExtents = numBlocks = 0;
+    bzero(InlineData(), InlineSize);
+    return Extend(freeMap, fileSize, headerSector, logHead);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Grow the file to "newSize" bytes, allocating the data blocks it
+//	needs beyond those it has: as a continuation of its last extent
+//	if possible (next to the header, for an empty file), and in as
+//	few extents as possible.  Also allocate any extent blocks needed
+//	to list them.  Return false, leaving the file as it was, if there
+//	are not enough free blocks.
+//
+//	On a log-structured disk, the blocks go at the log head instead,
+//	which is moved past them.
+//
+//	A file whose data is in the header stays so while it fits; past
+//	InlineSize bytes, it is given sectors for all of it, and the
+//	caller must copy the InlineData there before writing the header
+//	back (it is left in memory until then).
+//
+//	Only the in-memory header changes; the caller writes it back.
+//
+//	"freeMap" is the map of free disk sectors
+//	"newSize" is the new size of the file, in bytes
+//	"headerSector" is the sector holding the file header
+//	"logHead" is the log head, on a log-structured disk (else NULL)
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Extend(FreeMap *freeMap, int newSize, int headerSector,
+		   int *logHead)
+{
+    int wanted = divRoundUp(newSize, SectorSize) - numSectors;
+    int oldExtents = numExtents, oldLength = 0;
+    int goal = (logHead != NULL) ? *logHead : headerSector + 1;
+    int left, start, length, needBlocks, i, j;
+
+    ASSERT(newSize >= numBytes);
+    if (IsInline() && newSize <= InlineSize) {
+	numBytes = newSize;
+	return true;
+    }
+    if (freeMap->NumClear() < wanted)
+	return false;		// not enough space
+
+    if (numExtents > 0) {
+	oldLength = table[numExtents - 1].length;
+	if (logHead == NULL)
+	    goal = table[numExtents - 1].start + oldLength;
+    }
+    for (left = wanted; left > 0; left -= length) {
+	start = freeMap->FindRun(goal, left, &length);
+	ASSERT(start != -1);
+	for (i = 0; i < length; i++)
+	    freeMap->Mark(start + i);
+	AddExtent(start, length);
+	goal = start + length;
+    }
+
+    needBlocks = 0;
+    if (numExtents > NumExtents)
+	needBlocks = divRoundUp(numExtents - NumExtents, ExtentsPerBlock);
+    if (freeMap->NumClear() < needBlocks - numBlocks) {
+	// No room to list the extents: give back what we took.
+	for (i = (oldExtents > 0) ? oldExtents - 1 : 0; i < numExtents; i++)
+	    for (j = (i == oldExtents - 1) ? oldLength : 0;
+		 j < table[i].length; j++)
+		FreeSector(freeMap, table[i].start + j);
+	numExtents = oldExtents;
+	if (oldExtents > 0)
+	    table[oldExtents - 1].length = oldLength;
+	return false;
+    }
+    if (needBlocks > numBlocks) {
+	int *moreBlocks = new int[needBlocks];
+
+	for (i = 0; i < numBlocks; i++)
+	    moreBlocks[i] = blocks[i];
+	for (; i < needBlocks; i++)
+	    moreBlocks[i] = freeMap->Find(headerSector);
+	delete [] blocks;
+	blocks = moreBlocks;
+	numBlocks = needBlocks;
+    }
+
+    numBytes = newSize;
+    numSectors += wanted;
+    IndexExtents();
+    if (logHead != NULL)
+	*logHead = goal;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Relocate
+// 	Move the file data to newly allocated blocks, from the log head
+//	on, and copy it there.  The copy goes straight to the disk, so
+//	that it is there before the new header is committed.
+//
+//	The old blocks are not freed: they are handed over to "old",
+//	with any extent blocks no longer needed, for the caller to
+//	Deallocate once the new header is committed.  Until then, a
+//	crash leaves the file where it was.
+//
+//	Return false, leaving the file as it was, if there are not enough
+//	free blocks, or if they are too scattered to fit in the extent
+//	blocks the file already has.
+//
+//	"freeMap" is the map of free disk sectors
+//	"logHead" is where the blocks are to start; it is moved past them
+//	"old" is an empty header, to be given the old blocks
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Relocate(FreeMap *freeMap, int *logHead, FileHeader *old)
+{
+    int goal = *logHead;
+    int left, start, length, needBlocks, i, j;
+    int *sectors;
+    char *data;
+    DiskHandle *handle;
+
     if (freeMap->NumClear() < numSectors)
 	return false;		// not enough space
 
-    for (int i = 0; i < numSectors; i++)
-	dataSectors[i] = freeMap->Find();
+    old->numBytes = numBytes;
+    old->numSectors = numSectors;
+    for (i = 0; i < numExtents; i++)
+	old->AddExtent(table[i].start, table[i].length);
+    old->IndexExtents();
+
+    numExtents = 0;
+    for (left = numSectors; left > 0; left -= length) {
+	start = freeMap->FindRun(goal, left, &length);
+	ASSERT(start != -1);
+	for (i = 0; i < length; i++)
+	    freeMap->Mark(start + i);
+	AddExtent(start, length);
+	goal = start + length;
+    }
+
+    needBlocks = 0;
+    if (numExtents > NumExtents)
+	needBlocks = divRoundUp(numExtents - NumExtents, ExtentsPerBlock);
+    if (needBlocks > numBlocks) {	// give back what we took
+	for (i = 0; i < numExtents; i++)
+	    for (j = 0; j < table[i].length; j++)
+		FreeSector(freeMap, table[i].start + j);
+	numExtents = 0;
+	for (i = 0; i < old->numExtents; i++)
+	    AddExtent(old->table[i].start, old->table[i].length);
+	old->numExtents = old->numSectors = old->numBytes = 0;
+	IndexExtents();
+	return false;
+    }
+    delete [] old->blocks;
+    old->blocks = new int[numBlocks - needBlocks + 1];
+    while (numBlocks > needBlocks)
+	old->blocks[old->numBlocks++] = blocks[--numBlocks];
+    IndexExtents();
+
+    sectors = new int[numSectors];
+    data = new char[numSectors * SectorSize];
+    for (i = 0; i < numSectors; i++)
+	sectors[i] = old->ByteToSector(i * SectorSize);
+    handle = synchDisk->Submit(numSectors, sectors, data, false);
+    handle->Wait();
+    delete handle;
+    for (i = 0; i < numSectors; i++)
+	sectors[i] = ByteToSector(i * SectorSize);
+    synchDisk->WriteThrough(numSectors, sectors, data);
+    delete [] sectors;
+    delete [] data;
+
+    *logHead = goal;
     return true;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
-// 	De-allocate all the space allocated for data blocks for this file.
+// 	De-allocate all the space allocated for data blocks for this file,
+//	and for the extent blocks listing them.
 //
-//	"freeMap" is the bit map of free disk sectors
+//	"freeMap" is the map of free disk sectors
 //----------------------------------------------------------------------
 
 void 
-FileHeader::Deallocate(BitMap *freeMap)
+FileHeader::Deallocate(FreeMap *freeMap)
 {
-    for (int i = 0; i < numSectors; i++) {
-	ASSERT(freeMap->Test((int) dataSectors[i]));  // ought to be marked!
-	freeMap->Clear((int) dataSectors[i]);
-    }
+    int i, j;
+
+    for (i = 0; i < numExtents; i++)
+	for (j = 0; j < table[i].length; j++)
+	    FreeSector(freeMap, table[i].start + j);
+    for (i = 0; i < numBlocks; i++)
+	FreeSector(freeMap, blocks[i]);
 }
 
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
-// 	Fetch contents of file header from disk. 
+// 	Fetch contents of file header from disk, along with the extent
+//	blocks, if any.  Their latest contents may still be in the
+//	journal's running transaction.
 //
 //	"sector" is the disk sector containing the file header
 //----------------------------------------------------------------------
@@ -77,12 +306,37 @@ FileHeader::Deallocate(BitMap *freeMap)
 void
 FileHeader::FetchFrom(int sector)
 {
-    synchDisk->ReadSector(sector, (char *)this);
+    int block[SectorSize / sizeof(int)];
+    Extent *blockExtents = (Extent *) &block[1];
+    int total, next, i;
+
+    if (!journal->Read(sector, (char *)this))
+	synchDisk->ReadSector(sector, (char *)this);
+
+    total = numExtents;
+    numExtents = 0;
+    for (i = 0; i < total && i < NumExtents; i++)
+	AddExtent(extents[i].start, extents[i].length);
+
+    delete [] blocks;
+    blocks = new int[divRoundUp(total, ExtentsPerBlock) + 1];
+    numBlocks = 0;
+    for (next = extentBlock; numExtents < total; next = block[0]) {
+	ASSERT(next != -1);
+	if (!journal->Read(next, (char *) block))
+	    synchDisk->ReadSector(next, (char *) block);
+	blocks[numBlocks++] = next;
+	for (i = 0; i < ExtentsPerBlock && numExtents < total; i++)
+	    AddExtent(blockExtents[i].start, blockExtents[i].length);
+    }
+    IndexExtents();
 }
 
 //----------------------------------------------------------------------
 // FileHeader::WriteBack
-// 	Write the modified contents of the file header back to disk. 
+// 	Write the modified contents of the file header back to disk,
+//	along with the extent blocks, if any.  They go through the
+//	journal, and reach their home sectors once it commits.
 //
 //	"sector" is the disk sector to contain the file header
 //----------------------------------------------------------------------
@@ -90,7 +344,24 @@ FileHeader::FetchFrom(int sector)
 void
 FileHeader::WriteBack(int sector)
 {
-    synchDisk->WriteSector(sector, (char *)this); 
+    int block[SectorSize / sizeof(int)];
+    Extent *blockExtents = (Extent *) &block[1];
+    int i, b, next = NumExtents;
+
+    for (i = 0; i < numExtents && i < NumExtents; i++)
+	extents[i] = table[i];
+    extentBlock = (numBlocks > 0) ? blocks[0] : -1;
+    journal->Write(sector, (char *)this); 
+
+    for (b = 0; b < numBlocks; b++) {
+	block[0] = (b + 1 < numBlocks) ? blocks[b + 1] : -1;
+	for (i = 0; i < ExtentsPerBlock; i++, next++)
+	    if (next < numExtents)
+		blockExtents[i] = table[next];
+	    else
+		blockExtents[i].start = blockExtents[i].length = -1;
+	journal->Write(blocks[b], (char *) block);
+    }
 }
 
 //----------------------------------------------------------------------
@@ -98,7 +369,8 @@ FileHeader::WriteBack(int sector)
 // 	Return which disk sector is storing a particular byte within the file.
 //      This is essentially a translation from a virtual address (the
 //	offset in the file) to a physical address (the sector where the
-//	data at the offset is stored).
+//	data at the offset is stored).  We binary search for the extent
+//	holding it.
 //
 //	"offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
@@ -106,7 +378,65 @@ FileHeader::WriteBack(int sector)
 int
 FileHeader::ByteToSector(int offset)
 {
-    return(dataSectors[offset / SectorSize]);
+    int sector = offset / SectorSize;
+    int low = 0, high = numExtents - 1;
+
+    ASSERT(sector >= 0 && sector < numSectors);
+    while (low < high) {		// last extent starting at or before
+	int middle = (low + high + 1) / 2;
+
+	if (firstSector[middle] <= sector)
+	    low = middle;
+	else
+	    high = middle - 1;
+    }
+    return table[low].start + (sector - firstSector[low]);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AddExtent
+// 	Append an extent to the in-memory extent list, merging it with the
+//	last one when they are contiguous on disk.  The caller must call
+//	IndexExtents once the list is complete.
+//----------------------------------------------------------------------
+
+void
+FileHeader::AddExtent(int start, int length)
+{
+    if (numExtents > 0
+	&& table[numExtents - 1].start + table[numExtents - 1].length == start) {
+	table[numExtents - 1].length += length;
+	return;
+    }
+    if (numExtents == tableSize) {	// make room
+	Extent *bigger = new Extent[2 * tableSize + NumExtents];
+
+	for (int i = 0; i < numExtents; i++)
+	    bigger[i] = table[i];
+	delete [] table;
+	table = bigger;
+	tableSize = 2 * tableSize + NumExtents;
+    }
+    table[numExtents].start = start;
+    table[numExtents].length = length;
+    numExtents++;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::IndexExtents
+// 	Compute the file sector at which each extent starts, for
+//	ByteToSector.
+//----------------------------------------------------------------------
+
+void
+FileHeader::IndexExtents()
+{
+    delete [] firstSector;
+    firstSector = new int[numExtents + 1];
+    firstSector[0] = 0;
+    for (int i = 0; i < numExtents; i++)
+	firstSector[i + 1] = firstSector[i] + table[i].length;
+    ASSERT(firstSector[numExtents] == numSectors);
 }
 
 //----------------------------------------------------------------------
@@ -120,31 +450,74 @@ FileHeader::FileLength()
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::Overlaps
+// 	Return true if any of the file data is in the "count" sectors
+//	starting at "first".
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Overlaps(int first, int count)
+{
+    for (int i = 0; i < numExtents; i++)
+	if (table[i].start < first + count
+		&& table[i].start + table[i].length > first)
+	    return true;
+    return false;
+}
+
+//----------------------------------------------------------------------
+// PrintBytes
+// 	Print "count" bytes of file data, escaping those that are not
+//	printable.
+//----------------------------------------------------------------------
+
+static void
+PrintBytes(const char *data, int count)
+{
+    for (int j = 0; j < count; j++) {
+	if ('\040' <= data[j] && data[j] <= '\176')   // isprint(data[j])
+	    printf("%c", data[j]);
+	else
+	    printf("\\%x", (unsigned char)data[j]);
+    }
+    printf("\n"); 
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Print
 // 	Print the contents of the file header, and the contents of all
-//	the data blocks pointed to by the file header.
+//	the data blocks pointed to by the file header (or of the data
+//	kept in it).
 //----------------------------------------------------------------------
 
 void
 FileHeader::Print()
 {
-    int i, j, k;
-    char *data = new char[SectorSize];
+    int i, count;
+    char *data;
 
-    printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
-    for (i = 0; i < numSectors; i++)
-	printf("%d ", dataSectors[i]);
+    if (IsInline()) {
+	printf("FileHeader contents.  File size: %d, in the header.\n",
+	       numBytes);
+	printf("File contents:\n");
+	PrintBytes(InlineData(), numBytes);
+	return;
+    }
+    data = new char[SectorSize];
+    printf("FileHeader contents.  File size: %d.  File extents:\n", numBytes);
+    for (i = 0; i < numExtents; i++)
+	printf("%d-%d ", table[i].start, table[i].start + table[i].length - 1);
+    if (numBlocks > 0) {
+	printf("\nExtent blocks: ");
+	for (i = 0; i < numBlocks; i++)
+	    printf("%d ", blocks[i]);
+    }
     printf("\nFile contents:\n");
-    for (i = k = 0; i < numSectors; i++) {
-	synchDisk->ReadSector(dataSectors[i], data);
-        for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
-	    if ('\040' <= data[j] && data[j] <= '\176')   // isprint(data[j])
-		printf("%c", data[j]);
-            else
-		printf("\\%x", (unsigned char)data[j]);
-	}
-        printf("\n"); 
+    for (i = 0; i < numSectors; i++) {
+	synchDisk->ReadSector(ByteToSector(i * SectorSize), data);
+	count = numBytes - i * SectorSize;
+	PrintBytes(data, (count < SectorSize) ? count : SectorSize);
     }
     delete [] data;
 }
@@ -15,32 +15,70 @@
 #define FILEHDR_H
 
 #include "disk.h"
-#include "bitmap.h"
+#include "freemap.h"
 
-#define NumDirect	((SectorSize - 2 * sizeof(int)) / sizeof(int))
-#define MaxFileSize	(NumDirect * SectorSize)
+// The following class defines an extent: a run of consecutive disk
+// sectors holding consecutive sectors of a file.
+
+class Extent {
+  public:
+    int start;				// First disk sector of the run
+    int length;				// Number of sectors in the run
+};
+
+#define NumExtents	((int)((SectorSize - 4 * sizeof(int)) / sizeof(Extent)))
+					// extents kept in the header itself
+#define ExtentsPerBlock	((int)((SectorSize - sizeof(int)) / sizeof(Extent)))
+					// extents kept in each extent block
+#define MaxFileSize	(NumSectors * SectorSize)
+#define InlineSize	((int)(NumExtents * sizeof(Extent)))
+					// bytes of data a header can hold
+					// in place of its extents
 
 // The following class defines the Nachos "file header" (in UNIX terms,  
 // the "i-node"), describing where on disk to find all of the data in the file.
-// The file header is organized as a simple table of pointers to
-// data blocks. 
+// The file header is organized as a list of extents, in file order.
+// The first NumExtents are kept in the header; if the file needs more,
+// the rest go in a chain of extent blocks, ExtentsPerBlock to a block.
+// Since extents are allocated as long as the free map allows, most files
+// fit in a handful of them.
+//
+// A file of no more than InlineSize bytes has no data sectors at all:
+// its data is kept in the header, where the extents would be, so that
+// reading it takes a single disk access.  Once it grows larger, it is
+// given data sectors like any other file (cf. OpenFile::Append), and
+// never goes back.
 //
 // The file header data structure can be stored in memory or on disk.
-// When it is on disk, it is stored in a single sector -- this means
-// that we assume the size of this data structure to be the same
-// as one disk sector.  Without indirect addressing, this
-// limits the maximum file length to just under 4K bytes.
+// When it is on disk, it is stored in a single sector: the fields up
+// to and including "extents" are laid out to fill exactly one sector,
+// and FetchFrom/WriteBack transfer just those (plus the extent blocks).
+// The fields after them only exist in memory: the whole extent list,
+// read in once by FetchFrom, and the file sector at which each extent
+// starts, so that ByteToSector can binary search it without any disk
+// access.
 //
-// There is no constructor; rather the file header can be initialized
-// by allocating blocks for the file (if it is a new file), or by
-// reading it from disk.
+// The file header can be initialized by allocating blocks for the
+// file (if it is a new file), or by reading it from disk.
 
 class FileHeader {
   public:
-    bool Allocate(BitMap *bitMap, int fileSize);// Initialize a file header, 
+    FileHeader();			// An empty header
+    ~FileHeader();
+
+    bool Allocate(FreeMap *freeMap, int fileSize, int headerSector,
+		  int *logHead = NULL);		// Initialize a file header, 
 						//  including allocating space 
-						//  on disk for the file data
-    void Deallocate(BitMap *bitMap);  		// De-allocate this file's 
+						//  on disk for the file data,
+						//  near the header if possible
+    bool Extend(FreeMap *freeMap, int newSize, int headerSector,
+		int *logHead = NULL);		// Grow the file, allocating
+						//  the data blocks it needs
+    bool Relocate(FreeMap *freeMap, int *logHead, FileHeader *old);
+						// Move the file data to new
+						//  blocks, handing the old
+						//  ones over to "old"
+    void Deallocate(FreeMap *freeMap);  		// De-allocate this file's 
 						//  data blocks
 
     void FetchFrom(int sectorNumber); 	// Initialize file header from disk
@@ -54,13 +92,35 @@ class FileHeader {
     int FileLength();			// Return the length of the file 
 					// in bytes
 
+    bool IsInline() { return numSectors == 0; }
+					// Is the data kept in the header?
+    int NumFragments() { return numExtents; }
+					// How many runs of sectors hold it?
+    char *InlineData() { return (char *) extents; }
+					// ... then here it is
+
+    bool Overlaps(int first, int count);	// Does the file have data in
+					// these sectors?
+
     void Print();			// Print the contents of the file.
 
   private:
     int numBytes;			// Number of bytes in the file
     int numSectors;			// Number of data sectors in the file
-    int dataSectors[NumDirect];		// Disk sector numbers for each data 
-					// block in the file
+    int numExtents;			// Number of extents in the file
+    int extentBlock;			// First extent block, or -1
+    Extent extents[NumExtents];		// The first extents of the file
+
+    Extent *table;			// Every extent of the file
+    int *firstSector;			// File sector where each extent
+					// starts, plus numSectors at the end
+    int tableSize;			// Room in "table"
+    int *blocks;			// Sectors of the extent blocks
+    int numBlocks;
+
+    void AddExtent(int start, int length);
+					// Append an extent to the table
+    void IndexExtents();		// Recompute "firstSector"
 };
 
 #endif // FILEHDR_H
@@ -7,37 +7,59 @@
 //		(the size of the file header data structure is arranged
 //		to be precisely the size of 1 disk sector)
 //	   A number of data blocks
-//	   An entry in the file system directory
+//	   An entry in the directory that holds it
 //
 // 	The file system consists of several data structures:
-//	   A bitmap of free disk sectors (cf. bitmap.h)
-//	   A directory of file names and file headers
+//	   A bitmap of free disk sectors, by cylinder group (cf. freemap.h)
+//	   A tree of directories of file names and file headers,
+//	     starting at the root directory
 //
-//      Both the bitmap and the directory are represented as normal
-//	files.  Their file headers are located in specific sectors
-//	(sector 0 and sector 1), so that the file system can find them 
-//	on bootup.
+//      Both the bitmap and the directories are represented as normal
+//	files.  The file headers of the bitmap and of the root directory
+//	are located in specific sectors (sector 0 and sector 1), so that
+//	the file system can find them on bootup.  A path name such as
+//	"/usr/bin/ls" is followed down from the root, one directory at
+//	a time.
 //
-//	The file system assumes that the bitmap and directory files are
-//	kept "open" continuously while Nachos is running.
+//	The file system keeps the bitmap in memory while Nachos is
+//	running, and so the directories it has used (with the parts of
+//	them it has looked at), so that operations such as Create and
+//	Remove seldom need the disk.  If an operation fails part way, it
+//	undoes whatever it changed.
 //
-//	For those operations (such as Create, Remove) that modify the
-//	directory and/or bitmap, if the operation succeeds, the changes
-//	are written immediately back to disk (the two files are kept
-//	open during all this time).  If the operation fails, and we have
-//	modified part of the directory and/or bitmap, we simply discard
-//	the changed version, without writing it back to disk.
+//	Changes to the bitmap, the directories and the file headers go
+//	through the journal (cf. journal.h).  Each operation logs its
+//	changes when it is done, and they are committed as a group:
+//	when the journal fills up, when the disk's flush thread wakes up
+//	every FlushInterval ticks (cf. SynchDisk::SetFlushHook), and
+//	when Nachos halts.
+//
+//	A disk can be formatted to be log-structured instead.  Then, rather
+//	than near its header (or its last extent), new file data goes at
+//	the log head: the disk is divided into segments of one track, and
+//	the log head moves through a clean segment, and on to the next
+//	clean one once it is used up, so that writes of new data are
+//	sequential.  When few clean segments are left, a cleaner thread
+//	moves the closed files with data in the least used segments to
+//	the log head, freeing those segments.  Only file data goes to the
+//	log: the changes to file headers and other metadata are logged
+//	by the journal already, and headers stay where they are, so no
+//	inode map is needed.  Data rewritten in place is not moved.
+//
+//	A lock makes the operations on the bitmap and directories atomic,
+//	so a commit never holds half an operation.  The flush thread never
+//	waits for it: if an operation is under way, that operation does
+//	the commit when it is done.
 //
 // 	Our implementation at this point has the following restrictions:
 //
-//	   there is no synchronization for concurrent accesses
-//	   files have a fixed size, set when the file is created
-//	   files cannot be bigger than about 3KB in size
-//	   there is no hierarchical directory structure, and only a limited
-//	     number of files can be added to the system
-//	   there is no attempt to make the system robust to failures
-//	    (if Nachos exits in the middle of an operation that modifies
-//	    the file system, it may corrupt the disk)
+//	   there is no synchronization for concurrent accesses to the
+//	     data of a file
+//	   files grow only by appending to them (no holes)
+//	   there is no current directory: all paths start at the root
+//	   file data is not journaled: after a crash, a file may hold
+//	    garbage where it was written last (but the metadata is
+//	    consistent, apart perhaps from lost free sectors)
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -46,10 +68,11 @@
 #include "copyright.h"
 
 #include "disk.h"
-#include "bitmap.h"
+#include "freemap.h"
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "system.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known 
@@ -57,12 +80,106 @@
 #define FreeMapSector 		0
 #define DirectorySector 	1
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number 
-// of files that can be loaded onto the disk.
-#define FreeMapFileSize 	(NumSectors / BitsInByte)
-#define NumDirEntries 		10
-#define DirectoryFileSize 	(sizeof(DirectoryEntry) * NumDirEntries)
+// The journal's log area (cf. journal.h) follows them.
+
+// Initial file sizes for the bitmap and directories; a directory starts
+// as a single bucket, and grows as files are added to it.  The bitmap
+// file ends with the layout of the disk: whether it is log-structured.
+#define LayoutOffset		(divRoundUp(NumSectors, BitsInWord) \
+				 * (int) sizeof(unsigned))
+#define FreeMapFileSize 	(LayoutOffset + sizeof(int))
+#define DirectoryFileSize 	BucketSize
+
+// Segments of a log-structured disk.  The cleaner is woken up when
+// fewer than LowCleanSegments are clean, and cleans up to
+// HighCleanSegments; only segments no more than half in use are worth
+// cleaning.
+#define SegmentSectors		SectorsPerTrack
+#define NumSegments		(NumSectors / SegmentSectors)
+#define LowCleanSegments	4
+#define HighCleanSegments	8
+
+//----------------------------------------------------------------------
+// SyncFileSystem
+// 	Called by the disk's flush thread, to write back the bitmap and
+//	directories before the disk cache.  Dummy function because C++
+//	can't handle pointers to member functions.
+//----------------------------------------------------------------------
+
+static void
+SyncFileSystem(void *arg)
+{
+    ((FileSystem *) arg)->Flush();
+}
+
+//----------------------------------------------------------------------
+// AtSector, WriteBackDirectory
+// 	Helpers to look for, and to write back, the directories kept in
+//	memory (with List::Find and List::Apply).
+//----------------------------------------------------------------------
+
+static bool
+AtSector(Directory *directory, void *sector)
+{
+    return directory->HeaderSector() == *(int *) sector;
+}
+
+static void
+WriteBackDirectory(Directory *directory)
+{
+    directory->WriteBack();
+}
+
+//----------------------------------------------------------------------
+// SegmentCleaner, CollectFile
+// 	Body of the cleaner thread, and helper to list the files it
+//	might move (with Directory::Walk).
+//----------------------------------------------------------------------
+
+static void
+SegmentCleaner(void *arg)
+{
+    ((FileSystem *) arg)->CleanSegments();
+}
+
+static void
+CollectFile(const char *path, int sector, void *files)
+{
+    ((List<int> *) files)->Append(sector);
+}
+
+//----------------------------------------------------------------------
+// Defragmenter, CollectPath
+// 	Body of the defragmenter thread, and helper to list the files it
+//	might move, by path name (with Directory::Walk).
+//----------------------------------------------------------------------
+
+static void
+Defragmenter(void *arg)
+{
+    ((FileSystem *) arg)->DefragmentFiles();
+}
+
+static void
+CollectPath(const char *path, int sector, void *paths)
+{
+    char *copy = new char[strlen(path) + 1];
+
+    strcpy(copy, path);
+    ((List<char *> *) paths)->Append(copy);
+}
+
+//----------------------------------------------------------------------
+// InodeAt
+// 	Helper to look for the i-node of a file in the table of open
+//	files (with List::Find).
+//----------------------------------------------------------------------
+
+static bool
+InodeAt(Inode *inode, void *sector)
+{
+    return inode->sector == *(int *) sector;
+}
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
@@ -72,32 +189,51 @@
 //	not all of the sectors marked as free).  
 //
 //	If format == false, we just have to open the files
-//	representing the bitmap and the directory.
+//	representing the bitmap and the directory, and read in the bitmap
+//	and the layout.
+//
+//	On a log-structured disk, also start the cleaner thread.
 //
 //	"format" -- should we initialize the disk?
+//	"logLayout" -- if so, should it be laid out as a log?
 //----------------------------------------------------------------------
 
-FileSystem::FileSystem(bool format)
+FileSystem::FileSystem(bool format, bool logLayout)
 { 
     DEBUG('f', "Initializing the file system.\n");
+    lock = new Lock("file system");
+    users = 0;
+    syncNeeded = false;
+    nested = 0;
+    directories = new ::List<Directory *>;
+    inodes = new ::List<Inode *>;
+    freeMap = new FreeMap(NumSectors);
+    freeMapDirty = false;
+    logStructured = logLayout;
+    logHead = 0;
+    cleanNeeded = NULL;
+    cleanerAwake = false;
+    segmentsCleaned = filesMoved = 0;
     if (format) {
-        BitMap *freeMap = new BitMap(NumSectors);
-        Directory *directory = new Directory(NumDirEntries);
+        Directory *directory;
+	int layout = logStructured;
 	FileHeader *mapHdr = new FileHeader;
 	FileHeader *dirHdr = new FileHeader;
 
         DEBUG('f', "Formatting the file system.\n");
 
     // First, allocate space for FileHeaders for the directory and bitmap
-    // (make sure no one else grabs these!)
+    // (make sure no one else grabs these!), and for the log
 	freeMap->Mark(FreeMapSector);	    
 	freeMap->Mark(DirectorySector);
+	for (int i = 0; i < LogSectors; i++)
+	    freeMap->Mark(LogSector + i);
 
     // Second, allocate space for the data blocks containing the contents
     // of the directory and bitmap files.  There better be enough space!
 
-	ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
-	ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+	ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize, FreeMapSector));
+	ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize, DirectorySector));
 
     // Flush the bitmap and directory FileHeaders back to disk
     // We need to do this before we can "Open" the file, since open
@@ -112,8 +248,10 @@ FileSystem::FileSystem(bool format)
     // The file system operations assume these two files are left open
     // while Nachos is running.
 
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        freeMapFile = OpenMetadata(FreeMapSector);
+        directory = new Directory(DirectorySector,
+				  OpenMetadata(DirectorySector));
+	directories->Append(directory);
      
     // Once we have the files "open", we can write the initial version
     // of each file back to disk.  The directory at this point is completely
@@ -122,192 +260,1041 @@ FileSystem::FileSystem(bool format)
     // to hold the file data for the directory and bitmap.
 
         DEBUG('f', "Writing bitmap and directory back to disk.\n");
+	directory->Initialize(DirectorySector);
 	freeMap->WriteBack(freeMapFile);	 // flush changes to disk
-	directory->WriteBack(directoryFile);
+	freeMapFile->WriteAt((char *) &layout, sizeof(int), LayoutOffset);
+	directory->WriteBack();
+	Sync();
 
 	if (DebugIsEnabled('f')) {
 	    freeMap->Print();
-	    directory->Print();
-
-        delete freeMap; 
-	delete directory; 
+	    directory->Print("");
+	}
 	delete mapHdr; 
 	delete dirHdr;
-	}
     } else {
     // if we are not formatting the disk, just open the files representing
     // the bitmap and directory; these are left open while Nachos is running
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        int layout = 0;
+
+        freeMapFile = OpenMetadata(FreeMapSector);
+	freeMap->FetchFrom(freeMapFile);
+	freeMapFile->ReadAt((char *) &layout, sizeof(int), LayoutOffset);
+	logStructured = layout;
+	directories->Append(new Directory(DirectorySector,
+					  OpenMetadata(DirectorySector)));
+    }
+    if (logStructured) {
+	cleanNeeded = new Semaphore("segments to clean", 0);
+	Thread *cleaner = new Thread("segment cleaner");
+	cleaner->Fork(SegmentCleaner, this);
+    }
+    synchDisk->SetFlushHook(SyncFileSystem, this);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::~FileSystem
+// 	Write back the bitmap and directories, and close their files.
+//----------------------------------------------------------------------
+
+FileSystem::~FileSystem()
+{
+    synchDisk->SetFlushHook(NULL, NULL);
+    Sync();
+    while (!directories->IsEmpty())
+	delete directories->Remove();
+    delete freeMapFile;			// (closing it logs any changes)
+    delete directories;
+    delete inodes;
+    delete freeMap;
+    delete lock;
+    delete cleanNeeded;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Sync
+// 	Write the changes to the bitmap and to the directories back to
+//	disk, returning once the journal has committed them (their home
+//	sectors are written to the disk cache; cf. SynchDisk::Sync).
+//----------------------------------------------------------------------
+
+void
+FileSystem::Sync()
+{
+    Enter();
+    LogChanges();
+    journal->Close(true);
+    syncNeeded = false;
+    Leave();
+    journal->Sync();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Flush
+// 	Called by the disk's flush thread.  Commit the changes now if
+//	no operation is under way, or else leave it to the operations
+//	under way (cf. Leave).  Waiting for them instead could hold up
+//	the write back of the disk cache for as long as other threads
+//	keep the file system busy.
+//----------------------------------------------------------------------
+
+void
+FileSystem::Flush()
+{
+    if (users > 0)
+	syncNeeded = true;
+    else
+	Sync();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Enter/Leave
+// 	Start and finish an operation on the bitmap and directories:
+//	acquire the lock, and release it, logging first the changes the
+//	operation made.  They are committed along with those of the
+//	operations before it, if the journal is getting full, or if the
+//	flush thread asked for it (and the disk is not still busy with
+//	the last commit).  The transaction is closed while the lock is
+//	held, and written to disk by the journal's committer thread,
+//	while the next operations go on.
+//
+//	Operations nest: one may end up calling another (a directory
+//	that grows during Create calls Extend, a directory that is
+//	removed closes its file), so the thread that holds the lock
+//	just counts how deep it is.
+//----------------------------------------------------------------------
+
+void
+FileSystem::Enter()
+{
+    if (lock->isHeldByCurrentThread()) {
+	nested++;
+	return;
+    }
+    users++;
+    lock->Acquire();
+}
+
+void
+FileSystem::Leave()
+{
+    if (nested > 0) {
+	nested--;
+	return;
     }
+    LogChanges();
+    if (journal->IsFull())
+	journal->Close(true);		// before it overflows
+    else if (syncNeeded && journal->Close(false))
+	syncNeeded = false;		// else, try again next time
+    lock->Release();
+    users--;
 }
 
 //----------------------------------------------------------------------
-// FileSystem::Create
-// 	Create a file in the Nachos file system (similar to UNIX create).
-//	Since we can't increase the size of files dynamically, we have
-//	to give Create the initial size of the file.
+// FileSystem::LogChanges
+// 	Write back the bitmap, if it changed, and the buckets of the
+//	directories that changed, to the journal's running transaction.
+//	The caller must hold the lock.
+//----------------------------------------------------------------------
+
+void
+FileSystem::LogChanges()
+{
+    if (freeMapDirty) {
+	freeMap->WriteBack(freeMapFile);
+	freeMapDirty = false;
+    }
+    directories->Apply(WriteBackDirectory);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::OpenMetadata
+// 	Open the bitmap file, or a directory's file, whose header is at
+//	"sector".  Their contents are written through the journal.
+//----------------------------------------------------------------------
+
+OpenFile *
+FileSystem::OpenMetadata(int sector)
+{
+    Inode *inode = OpenInode(sector);
+
+    inode->journaled = true;
+    return new OpenFile(inode);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::GetDirectory
+// 	Return the directory whose file header is at "sector", opening it
+//	and keeping it in memory if this is the first time it is used.
+//	The caller must hold the lock.
+//----------------------------------------------------------------------
+
+Directory *
+FileSystem::GetDirectory(int sector)
+{
+    Directory *directory = directories->Find(AtSector, &sector);
+
+    if (directory == NULL) {
+	directory = new Directory(sector, OpenMetadata(sector));
+	directories->Append(directory);
+    }
+    return directory;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FindDirectory
+// 	Follow a path name down from the root directory (a leading '/'
+//	is optional) to the directory that holds, or is to hold, its last
+//	component.  "." and ".." in the path work as in UNIX.
+//
+//	Return the sector of that directory's file header, and copy the
+//	last component into "name".  Return -1 if the path is empty, if
+//	some component is too long, or if one of the directories along
+//	the way does not exist.  The caller must hold the lock.
+//
+//	"path" -- the path name to follow
+//	"name" -- room for the last component, FileNameMaxLen + 1 chars
+//----------------------------------------------------------------------
+
+int
+FileSystem::FindDirectory(const char *path, char *name)
+{
+    int sector = DirectorySector;
+    const char *end;
+    int length;
+    bool isDirectory;
+
+    for (;;) {
+	while (*path == '/')
+	    path++;
+	for (end = path; *end != '\0' && *end != '/'; end++)
+	    ;
+	length = end - path;
+	if (length > FileNameMaxLen)
+	    return -1;			// name too long
+	strncpy(name, path, length);
+	name[length] = '\0';
+	while (*end == '/')
+	    end++;
+	if (*end == '\0')		// last component
+	    return (length > 0) ? sector : -1;
+
+	sector = GetDirectory(sector)->Find(name, &isDirectory);
+	if (sector == -1 || !isDirectory)
+	    return -1;			// no such directory
+	path = end;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Create/Mkdir
+// 	Create a file or a directory in the Nachos file system (similar
+//	to UNIX create and mkdir).  Files grow as they are written (cf.
+//	OpenFile::WriteAt), so "initialSize" is just how much space to
+//	set aside up front; most files can be created empty.
 //
 //	The steps to create a file are:
+//	  Find the directory that is to hold it
 //	  Make sure the file doesn't already exist
 //        Allocate a sector for the file header
 // 	  Allocate space on disk for the data blocks for the file
-//	  Add the name to the directory
 //	  Store the new file header on disk 
-//	  Flush the changes to the bitmap and the directory back to disk
+//	  For a directory, make it an empty directory
+//	  Add the name to the directory (which may have to grow)
 //
 //	Return true if everything goes ok, otherwise, return false.
 //
 // 	Create fails if:
+//		the directory along the path does not exist
 //   		file is already in directory
 //	 	no free space for file header
-//	 	no free entry for file in directory
 //	 	no free space for data blocks for the file 
+//	 	no free space for the directory to grow
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
-//
-//	"name" -- name of file to be created
+//	"name" -- path name of file to be created
 //	"initialSize" -- size of file to be created
 //----------------------------------------------------------------------
 
 bool
 FileSystem::Create(const char *name, int initialSize)
 {
-    Directory *directory;
-    BitMap *freeMap;
+    return Make(name, initialSize, false);
+}
+
+bool
+FileSystem::Mkdir(const char *name)
+{
+    return Make(name, DirectoryFileSize, true);
+}
+
+bool
+FileSystem::Make(const char *path, int initialSize, bool isDirectory)
+{
+    char name[FileNameMaxLen + 1];
+    Directory *directory, *newDirectory = NULL;
     FileHeader *hdr;
-    int sector;
+    int dirSector, sector, goal;
     bool success;
 
-    DEBUG('f', "Creating file %s, size %d\n", name, initialSize);
+    DEBUG('f', "Creating %s %s, size %d\n", isDirectory ? "directory" : "file",
+	  path, initialSize);
+
+    Enter();
+    if ((dirSector = FindDirectory(path, name)) == -1) {
+	Leave();
+	return false;			// no such directory
+    }
+    directory = GetDirectory(dirSector);
 
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
+    // A file's header goes in the cylinder group of its directory; a new
+    // directory starts off in a group with room to spare.  In the log,
+    // headers just take the first free sector.
+    if (logStructured)
+	goal = 0;
+    else if (isDirectory)
+	goal = freeMap->GroupStart(freeMap->SpareGroup(
+					freeMap->GroupOf(dirSector)));
+    else
+	goal = dirSector;
 
     if (directory->Find(name) != -1)
       success = false;			// file is already in directory
-    else {	
-        freeMap = new BitMap(NumSectors);
-        freeMap->FetchFrom(freeMapFile);
-        sector = freeMap->Find();	// find a sector to hold the file header
-    	if (sector == -1) 		
-            success = false;		// no free block for file header 
-        else if (!directory->Add(name, sector))
-            success = false;	// no space in directory
-	else {
-    	    hdr = new FileHeader;
-	    if (!hdr->Allocate(freeMap, initialSize))
-            	success = false;	// no space on disk for data
-	    else {	
-	    	success = true;
-		// everthing worked, flush all changes back to disk
-    	    	hdr->WriteBack(sector); 		
-    	    	directory->WriteBack(directoryFile);
-    	    	freeMap->WriteBack(freeMapFile);
+    else if ((sector = freeMap->Find(goal)) == -1)
+      success = false;			// no free block for file header 
+    else {
+	hdr = new FileHeader;
+	if (!hdr->Allocate(freeMap, initialSize, sector, LogGoal())) {
+	    freeMap->Clear(sector);
+	    success = false;		// no space on disk for data
+	} else {	
+	    hdr->WriteBack(sector); 		
+	    if (isDirectory) {
+		newDirectory = new Directory(sector, OpenMetadata(sector));
+		newDirectory->Initialize(dirSector);
+	    }
+	    success = directory->Add(name, sector, isDirectory);
+	    if (success) {
+		freeMapDirty = true;
+		if (isDirectory)
+		    directories->Append(newDirectory);
+	    } else {			// no space in directory: undo
+		delete newDirectory;
+		hdr->Deallocate(freeMap);
+		freeMap->Clear(sector);
+		journal->Forget(sector);
 	    }
-            delete hdr;
 	}
-        delete freeMap;
+	delete hdr;
     }
-    delete directory;
+    Leave();
+    return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Reserve/Unreserve
+// 	Set aside free sectors for the bytes an open file holds in its
+//	tail, so that giving them disk space later cannot fail; or give
+//	the sectors back, when the bytes are discarded.  No sector is
+//	taken yet: other allocations just see that many fewer free.
+//
+//	Return false, reserving nothing, if there are not enough free
+//	sectors left.
+//
+//	"sectors" -- how many sectors to set aside, or give back
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Reserve(int sectors)
+{
+    bool success;
+
+    Enter();
+    success = (freeMap->NumClear() >= sectors);
+    if (success)
+	freeMap->Reserve(sectors);
+    Leave();
+    return success;
+}
+
+void
+FileSystem::Unreserve(int sectors)
+{
+    Enter();
+    freeMap->Unreserve(sectors);
+    Leave();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Extend
+// 	Grow an open file to "newSize" bytes, allocating the data blocks
+//	it needs.  Sectors the file reserved for them are given back
+//	first, and so are available to it (the ones it does not need
+//	are simply freed).
+//
+//	Only the in-memory file header is changed.  The caller must write
+//	the new data first, and the header afterwards, so that the header
+//	on disk never points at sectors that hold garbage.
+//
+//	Return false (and leave the file, and its reservation, as they
+//	were) if the disk is full.
+//
+//	"hdr" -- the file header of the open file
+//	"hdrSector" -- where on disk the header lives
+//	"newSize" -- the size the file is to have, in bytes
+//	"reserved" -- how many sectors the file reserved (cf. Reserve)
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Extend(FileHeader *hdr, int hdrSector, int newSize, int reserved)
+{
+    bool success;
+
+    DEBUG('f', "Extending file at sector %d to %d bytes\n", hdrSector,
+	  newSize);
+    Enter();
+    freeMap->Unreserve(reserved);
+    success = hdr->Extend(freeMap, newSize, hdrSector, LogGoal());
+    if (success)
+	freeMapDirty = true;
+    else
+	freeMap->Reserve(reserved);
+    Leave();
     return success;
 }
 
+//----------------------------------------------------------------------
+// FileSystem::LogGoal
+// 	Return the log head, for FileHeader::Allocate/Extend to allocate
+//	data there, and to move it on; or NULL, if the disk is not
+//	log-structured.  The caller must hold the lock.
+//
+//	The log head is kept only in memory: after a restart, the log
+//	simply goes on in the first clean segment.
+//----------------------------------------------------------------------
+
+int *
+FileSystem::LogGoal()
+{
+    if (!logStructured)
+	return NULL;
+    MoveLogHead();
+    return &logHead;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::MoveLogHead
+// 	Get the log head ready for allocating: if the sectors of its
+//	segment are used up, move it to the start of the next clean
+//	segment.  If there is none, leave it: FindRun then falls back on
+//	the free sectors nearest the head.  Wake up the cleaner if clean
+//	segments are running out.  The caller must hold the lock.
+//----------------------------------------------------------------------
+
+void
+FileSystem::MoveLogHead()
+{
+    int segment;
+    bool ready;
+
+    logHead %= NumSectors;
+    if (logHead % SegmentSectors == 0)
+	ready = (SegmentUse(logHead / SegmentSectors) == 0);
+    else
+	ready = !freeMap->Test(logHead);
+    if (ready)
+	return;
+
+    for (int i = 1; i < NumSegments; i++) {
+	segment = (logHead / SegmentSectors + i) % NumSegments;
+	if (SegmentUse(segment) == 0) {
+	    DEBUG('f', "Log head moves to segment %d\n", segment);
+	    logHead = segment * SegmentSectors;
+	    break;
+	}
+    }
+    if (!cleanerAwake && NumCleanSegments() < LowCleanSegments) {
+	cleanerAwake = true;
+	cleanNeeded->V();
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::SegmentUse/NumCleanSegments
+// 	Count the sectors in use in a segment, and the segments that
+//	have none in use.
+//----------------------------------------------------------------------
+
+int
+FileSystem::SegmentUse(int segment)
+{
+    int used = 0;
+
+    for (int i = 0; i < SegmentSectors; i++)
+	if (freeMap->Test(segment * SegmentSectors + i))
+	    used++;
+    return used;
+}
+
+int
+FileSystem::NumCleanSegments()
+{
+    int clean = 0;
+
+    for (int segment = 0; segment < NumSegments; segment++)
+	if (SegmentUse(segment) == 0)
+	    clean++;
+    return clean;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CleanSegments
+// 	Body of the cleaner thread.  Each time it is woken up, pick the
+//	least used segments, as many as it takes to have enough clean
+//	ones, and clean them.
+//
+//	Cleaning moves the closed files with data in those segments to
+//	the log head (cf. FileHeader::Relocate).  The old copies are
+//	freed only once the new headers are committed, so that a crash
+//	leaves each file either where it was or where it went.  Segments
+//	also holding metadata, or data of open files, are not cleaned
+//	entirely.
+//----------------------------------------------------------------------
+
+void
+FileSystem::CleanSegments()
+{
+    ::List<FileHeader *> *moved = new ::List<FileHeader *>;
+    FileHeader *old;
+    bool *victims = new bool[NumSegments];
+    int segment;
+
+    for (;;) {
+	cleanNeeded->P();
+	Enter();
+	if (PickVictims(victims, HighCleanSegments - NumCleanSegments()) > 0)
+	    MoveFiles(victims, moved);
+	Leave();
+
+	if (!moved->IsEmpty()) {
+	    Sync();			// commit the new headers first
+	    Enter();
+	    while (!moved->IsEmpty()) {
+		old = moved->Remove();
+		old->Deallocate(freeMap);
+		delete old;
+	    }
+	    freeMapDirty = true;
+	    for (segment = 0; segment < NumSegments; segment++)
+		if (victims[segment] && SegmentUse(segment) == 0)
+		    segmentsCleaned++;
+	    Leave();
+	}
+	cleanerAwake = false;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::PickVictims
+// 	Choose up to "wanted" segments to clean: those with the fewest
+//	sectors in use, among the ones no more than half in use, apart
+//	from the log head's.  Set "victims[segment]" for each, and return
+//	how many there are.  The caller must hold the lock.
+//----------------------------------------------------------------------
+
+int
+FileSystem::PickVictims(bool *victims, int wanted)
+{
+    int *use = new int[NumSegments];
+    int segment, best, count;
+
+    for (segment = 0; segment < NumSegments; segment++) {
+	victims[segment] = false;
+	use[segment] = SegmentUse(segment);
+    }
+    for (count = 0; count < wanted; count++) {
+	best = -1;
+	for (segment = 0; segment < NumSegments; segment++)
+	    if (!victims[segment] && segment != logHead / SegmentSectors
+		    && use[segment] > 0 && use[segment] <= SegmentSectors / 2
+		    && (best == -1 || use[segment] < use[best]))
+		best = segment;
+	if (best == -1)
+	    break;
+	DEBUG('f', "Cleaning segment %d\n", best);
+	victims[best] = true;
+    }
+    delete [] use;
+    return count;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::MoveFiles
+// 	Relocate to the log head every closed file with data in one of
+//	the "victims" segments, logging their new headers, and add their
+//	old blocks to "moved", to be freed once the headers are
+//	committed.  The caller must hold the lock.
+//
+//	While the files are moved, the free sectors of the victims are
+//	marked in use, so that nothing is moved into them.
+//----------------------------------------------------------------------
+
+void
+FileSystem::MoveFiles(bool *victims, ::List<FileHeader *> *moved)
+{
+    ::List<int> *files = new ::List<int>;
+    BitMap *fenced = new BitMap(NumSectors);
+    FileHeader *hdr = new FileHeader, *old;
+    int sector, segment;
+
+    for (sector = 0; sector < NumSectors; sector++)
+	if (victims[sector / SegmentSectors] && !freeMap->Test(sector)) {
+	    freeMap->Mark(sector);
+	    fenced->Mark(sector);
+	}
+
+    GetDirectory(DirectorySector)->Walk("", CollectFile, files);
+    while (!files->IsEmpty()) {
+	sector = files->Remove();
+	if (inodes->Find(InodeAt, &sector) != NULL)
+	    continue;			// open: leave it be
+	hdr->FetchFrom(sector);
+	for (segment = 0; segment < NumSegments; segment++)
+	    if (victims[segment]
+		    && hdr->Overlaps(segment * SegmentSectors, SegmentSectors))
+		break;
+	if (segment == NumSegments)
+	    continue;			// not in any of them
+
+	old = new FileHeader;
+	MoveLogHead();
+	if (hdr->Relocate(freeMap, &logHead, old)) {
+	    hdr->WriteBack(sector);
+	    moved->Append(old);
+	    freeMapDirty = true;
+	    filesMoved++;
+	} else
+	    delete old;
+    }
+
+    for (sector = 0; sector < NumSectors; sector++)
+	if (fenced->Test(sector))
+	    freeMap->Clear(sector);
+    delete fenced;
+    delete files;
+    delete hdr;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Defragment
+// 	Start the defragmenter thread.  It runs at the background
+//	priority, below every other thread, so it only gets the CPU when
+//	nothing else is ready; and it yields after each file it looks at.
+//----------------------------------------------------------------------
+
+void
+FileSystem::Defragment()
+{
+    Thread *defragmenter = new Thread("defragmenter", false,
+					_BACKGROUND_PRIORITY);
+
+    defragmenter->Fork(Defragmenter, this);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DefragmentFiles
+// 	Body of the defragmenter thread.  Go once over all the files of
+//	the file system, moving each one that is in several extents into
+//	a single free run, as near its header as can be (cf. PlaceFor),
+//	and return how many were moved.
+//
+//	The files are listed by path name, and then looked up again one
+//	at a time: meanwhile, they may have been removed, and their
+//	sectors reused.
+//----------------------------------------------------------------------
+
+int
+FileSystem::DefragmentFiles()
+{
+    ::List<char *> *paths = new ::List<char *>;
+    char *path;
+    int moved = 0;
+
+    Enter();
+    GetDirectory(DirectorySector)->Walk("", CollectPath, paths);
+    Leave();
+    while (!paths->IsEmpty()) {
+	path = paths->Remove();
+	if (DefragmentFile(path)) {
+	    DEBUG('f', "Defragmented %s\n", path);
+	    moved++;
+	}
+	delete [] path;
+	currentThread->Yield();
+    }
+    delete paths;
+    return moved;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DefragmentFile
+// 	Move the file named "path" into one piece, if it is worth it.
+//	Return true if it was moved.
+//
+//	The file may be open: the whole of it is locked, as when it
+//	grows, so that no read or write of it is under way while its
+//	data is copied (cf. FileHeader::Relocate), and the OpenFiles
+//	sharing its i-node see the new header as soon as they go on.
+//	As in the cleaner, the old sectors are freed only once the new
+//	header is committed, so that a crash leaves the file either
+//	where it was or where it went.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::DefragmentFile(const char *path)
+{
+    char name[FileNameMaxLen + 1];
+    Inode *inode = NULL;
+    FileHeader *old = NULL;
+    LockedRange *range;
+    int dirSector, sector = -1, goal;
+    bool isDirectory, moved;
+
+    Enter();
+    if ((dirSector = FindDirectory(path, name)) != -1)
+	sector = GetDirectory(dirSector)->Find(name, &isDirectory);
+    if (sector >= 0 && !isDirectory)
+	inode = FindInode(sector);
+    Leave();
+    if (inode == NULL)
+	return false;			// removed meanwhile
+    inode->Fetch();
+
+    range = inode->lock->Acquire(0, EndOfFile, true);
+    Enter();
+    if (!inode->removed && (goal = PlaceFor(inode->hdr, sector)) != -1) {
+	old = new FileHeader;
+	if (inode->hdr->Relocate(freeMap, &goal, old)) {
+	    inode->hdr->WriteBack(sector);
+	    freeMapDirty = true;
+	    if (logStructured)
+		logHead = goal;
+	} else {
+	    delete old;
+	    old = NULL;
+	}
+    }
+    Leave();
+
+    moved = (old != NULL);
+    if (moved) {
+	Sync();				// commit the new header first
+	Enter();
+	old->Deallocate(freeMap);
+	freeMapDirty = true;
+	Leave();
+	delete old;
+    }
+    inode->lock->Release(range);
+    CloseInode(inode);
+    return moved;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::PlaceFor
+// 	Return the goal for moving the file whose header "hdr" is at
+//	"sector": on the classic layout, the start of the free run in
+//	the header's cylinder group nearest the header; on a log, the
+//	log head.  Return -1 if the file is better left where it is: if
+//	it has no data sectors, or if it is in one piece already (and,
+//	on the classic layout, in its header's group), or if there is
+//	no free run long enough for all of it -- on the classic layout,
+//	in the header's group, since moving it to another group would
+//	undo the locality the groups are for.  The caller must hold the
+//	lock.
+//----------------------------------------------------------------------
+
+int
+FileSystem::PlaceFor(FileHeader *hdr, int sector)
+{
+    int sectors = divRoundUp(hdr->FileLength(), SectorSize);
+    int group = freeMap->GroupOf(sector);
+    int start, length;
+
+    if (hdr->IsInline())
+	return -1;
+    if (logStructured) {
+	if (hdr->NumFragments() == 1)
+	    return -1;			// nothing to gain
+	MoveLogHead();
+	freeMap->FindRun(logHead, sectors, &length);
+	return (length < sectors) ? -1 : logHead;
+    }
+
+    if (hdr->NumFragments() == 1
+	    && freeMap->GroupOf(hdr->ByteToSector(0)) == group)
+	return -1;			// nothing to gain
+    start = freeMap->BestRun(group, sector, sectors, &length);
+    if (length < sectors)
+	return -1;			// no room for it in its group
+    return start;
+}
+
 //----------------------------------------------------------------------
 // FileSystem::Open
 // 	Open a file for reading and writing.  
 //	To open a file:
-//	  Find the location of the file's header, using the directory 
+//	  Find the location of the file's header, using the directories
+//	    along its path
 //	  Bring the header into memory
 //
-//	"name" -- the text name of the file to be opened
+//	Directories cannot be opened.
+//
+//	"name" -- the path name of the file to be opened
 //----------------------------------------------------------------------
 
 OpenFile *
-FileSystem::Open(const char *name)
+FileSystem::Open(const char *path)
 { 
-    Directory *directory = new Directory(NumDirEntries);
-    OpenFile *openFile = NULL;
-    int sector;
+    char name[FileNameMaxLen + 1];
+    Inode *inode = NULL;
+    int dirSector, sector = -1;
+    bool isDirectory;
+
+    DEBUG('f', "Opening file %s\n", path);
+    Enter();
+    if ((dirSector = FindDirectory(path, name)) != -1)
+	sector = GetDirectory(dirSector)->Find(name, &isDirectory); 
+    if (sector >= 0 && !isDirectory) 	// name was found in directory 
+	inode = FindInode(sector);
+    Leave();
+    if (inode == NULL)
+	return NULL;				// not found
+    inode->Fetch();
+    return new OpenFile(inode);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::OpenInode
+// 	Return the in-memory i-node of the file whose header is at
+//	"sector", accounting for one more OpenFile using it.  The header
+//	is read from disk only if the file is not open already, and then
+//	without holding the lock (unless the caller does).
+//----------------------------------------------------------------------
+
+Inode *
+FileSystem::OpenInode(int sector)
+{
+    Inode *inode;
 
-    DEBUG('f', "Opening file %s\n", name);
-    directory->FetchFrom(directoryFile);
-    sector = directory->Find(name); 
-    if (sector >= 0) 		
-	openFile = new OpenFile(sector);	// name was found in directory 
-    delete directory;
-    return openFile;				// return NULL if not found
+    Enter();
+    inode = FindInode(sector);
+    Leave();
+    inode->Fetch();
+    return inode;
 }
 
 //----------------------------------------------------------------------
-// FileSystem::Remove
-// 	Delete a file from the file system.  This requires:
-//	    Remove it from the directory
+// FileSystem::FindInode
+// 	Same, but without reading in the header.  Once the i-node is in
+//	the table, the file's space cannot be freed until it is closed,
+//	so the header can be read after releasing the lock.  The caller
+//	must hold the lock.
+//----------------------------------------------------------------------
+
+Inode *
+FileSystem::FindInode(int sector)
+{
+    Inode *inode = inodes->Find(InodeAt, &sector);
+
+    if (inode == NULL) {
+	inode = new Inode(sector);
+	inodes->Append(inode);
+    }
+    inode->refCount++;
+    return inode;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CloseInode
+// 	Called when an OpenFile is closed.  When the last OpenFile of the
+//	file goes away, forget its i-node; and if the file was removed
+//	while open, free its space now.
+//----------------------------------------------------------------------
+
+void
+FileSystem::CloseInode(Inode *inode)
+{
+    Enter();
+    if (--inode->refCount == 0) {
+	inodes->RemoveMatch(InodeAt, &inode->sector);
+	if (inode->removed) {
+	    DEBUG('f', "Freeing removed file at sector %d\n", inode->sector);
+	    inode->hdr->Deallocate(freeMap);
+	    freeMap->Clear(inode->sector);
+	    journal->Forget(inode->sector);
+	    freeMapDirty = true;
+	}
+	delete inode;
+    }
+    Leave();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Remove/Rmdir
+// 	Delete a file, or an empty directory, from the file system.  This
+//	requires:
+//	    Remove it from its directory
 //	    Delete the space for its header
 //	    Delete the space for its data blocks
-//	    Write changes to directory, bitmap back to disk
+//
+//	As in UNIX, a file that is open is only removed from its
+//	directory; its space is freed when the last OpenFile of it is
+//	closed (cf. CloseInode).
 //
 //	Return true if the file was deleted, false if the file wasn't
-//	in the file system.
+//	in the file system (or was not of the right kind, or the
+//	directory was not empty).
 //
-//	"name" -- the text name of the file to be removed
+//	"name" -- the path name of the file to be removed
 //----------------------------------------------------------------------
 
 bool
 FileSystem::Remove(const char *name)
 { 
+    return Delete(name, false);
+}
+
+bool
+FileSystem::Rmdir(const char *name)
+{ 
+    return Delete(name, true);
+}
+
+bool
+FileSystem::Delete(const char *path, bool isDirectory)
+{ 
+    char name[FileNameMaxLen + 1];
     Directory *directory;
-    BitMap *freeMap;
-    FileHeader *fileHdr;
-    int sector;
+    Inode *inode;
+    int dirSector, sector = -1;
+    bool wasDirectory;
     
-    directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-    sector = directory->Find(name);
-    if (sector == -1) {
-       delete directory;
-       return false;			 // file not found 
+    Enter();
+    if ((dirSector = FindDirectory(path, name)) != -1
+	    && strcmp(name, ".") && strcmp(name, "..")) {
+	directory = GetDirectory(dirSector);
+	sector = directory->Find(name, &wasDirectory);
     }
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
-
-    freeMap = new BitMap(NumSectors);
-    freeMap->FetchFrom(freeMapFile);
+    if (sector != -1 && wasDirectory && isDirectory) {
+	Directory *oldDirectory = GetDirectory(sector);
 
-    fileHdr->Deallocate(freeMap);  		// remove data blocks
-    freeMap->Clear(sector);			// remove header block
-    directory->Remove(name);
+	if (oldDirectory->IsEmpty()) {	// forget it
+	    directories->RemoveMatch(AtSector, &sector);
+	    delete oldDirectory;
+	} else
+	    sector = -1;		// directory not empty
+    }
+    if (sector == -1 || wasDirectory != isDirectory) {
+	Leave();
+	return false;			 // file not found 
+    }
+    directory->Remove(name);			// remove from directory
 
-    freeMap->WriteBack(freeMapFile);		// flush to disk
-    directory->WriteBack(directoryFile);        // flush to disk
-    delete fileHdr;
-    delete directory;
-    delete freeMap;
+    inode = OpenInode(sector);			// remove header and data
+    inode->removed = true;			// blocks, now or on the
+    CloseInode(inode);				// last close
+    Leave();
     return true;
 } 
 
 //----------------------------------------------------------------------
 // FileSystem::List
-// 	List all the files in the file system directory.
+// 	List all the files in the file system, directory by directory.
 //----------------------------------------------------------------------
 
 void
 FileSystem::List()
 {
-    Directory *directory = new Directory(NumDirEntries);
+    Enter();
+    GetDirectory(DirectorySector)->List("");
+    Leave();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::PrintStats
+// 	Print the layout of the disk, and, if it is log-structured, what
+//	the cleaner did.
+//----------------------------------------------------------------------
+
+void
+FileSystem::PrintStats()
+{
+    if (!logStructured) {
+	printf("File system: classic layout\n");
+	Enter();
+	freeMap->PrintGroups();
+	Leave();
+	return;
+    }
+    Enter();
+    printf("File system: log-structured layout, %d clean segments, "
+	   "%d segments cleaned, %d files moved\n", NumCleanSegments(),
+	   segmentsCleaned, filesMoved);
+    Leave();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::PrintFragmentation
+// 	Print how fragmented the file system is: how many of its files are
+//	in more than one extent, and, on the classic layout, how many have
+//	data away from their header's cylinder group; and how many runs
+//	the free sectors are cut into.  Return how many files are away
+//	from their group (always 0 on a log).
+//----------------------------------------------------------------------
 
-    directory->FetchFrom(directoryFile);
-    directory->List();
-    delete directory;
+int
+FileSystem::PrintFragmentation()
+{
+    ::List<int> *files = new ::List<int>;
+    FileHeader *hdr = new FileHeader;
+    int numFiles = 0, fragmented = 0, extents = 0, away = 0;
+    int sector, runs, longest;
+
+    Enter();
+    GetDirectory(DirectorySector)->Walk("", CollectFile, files);
+    while (!files->IsEmpty()) {
+	sector = files->Remove();
+	hdr->FetchFrom(sector);
+	numFiles++;
+	extents += hdr->NumFragments();
+	if (hdr->NumFragments() > 1)
+	    fragmented++;
+	if (!hdr->IsInline() && freeMap->GroupOf(hdr->ByteToSector(0))
+				!= freeMap->GroupOf(sector))
+	    away++;
+    }
+    runs = freeMap->FreeRuns(&longest);
+    printf("Fragmentation: %d files, %d in more than one extent, "
+	   "%d extents in all\n", numFiles, fragmented, extents);
+    if (logStructured)
+	away = 0;
+    else
+	printf("Files with data outside their cylinder group: %d\n", away);
+    printf("Free space: %d sectors; runs: %d, longest: %d sectors\n",
+	   freeMap->NumClear(), runs, longest);
+    Leave();
+    delete hdr;
+    delete files;
+    return away;
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Print
 // 	Print everything about the file system:
 //	  the contents of the bitmap
-//	  the contents of the directory
-//	  for each file in the directory,
+//	  the contents of the directories
+//	  for each file in the directories,
 //	      the contents of the file header
 //	      the data in the file
 //----------------------------------------------------------------------
@@ -317,9 +1304,8 @@ FileSystem::Print()
 {
     FileHeader *bitHdr = new FileHeader;
     FileHeader *dirHdr = new FileHeader;
-    BitMap *freeMap = new BitMap(NumSectors);
-    Directory *directory = new Directory(NumDirEntries);
 
+    Enter();
     printf("Bit map file header:\n");
     bitHdr->FetchFrom(FreeMapSector);
     bitHdr->Print();
@@ -328,14 +1314,10 @@ FileSystem::Print()
     dirHdr->FetchFrom(DirectorySector);
     dirHdr->Print();
 
-    freeMap->FetchFrom(freeMapFile);
     freeMap->Print();
-
-    directory->FetchFrom(directoryFile);
-    directory->Print();
+    GetDirectory(DirectorySector)->Print("");
+    Leave();
 
     delete bitHdr;
     delete dirHdr;
-    delete freeMap;
-    delete directory;
 } 
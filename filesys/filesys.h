@@ -20,9 +20,9 @@
 //	file system (in a file named "DISK"). 
 //
 //	In the "real" implementation, there are two key data structures used 
-//	in the file system.  There is a single "root" directory, listing
-//	all of the files in the file system; unlike UNIX, the baseline
-//	system does not provide a hierarchical directory structure.  
+//	in the file system.  There is a "root" directory, at the top of a
+//	tree of directories, as in UNIX: files are named by paths such
+//	as "/usr/bin/ls", followed down from the root.
 //	In addition, there is a bitmap for allocating
 //	disk sectors.  Both the root directory and the bitmap are themselves
 //	stored as files in the Nachos file system -- this causes an interesting
@@ -62,17 +62,34 @@ class FileSystem {
 
     bool Remove(const char *name) { return Unlink(name) == 0; }
 
+    bool Mkdir(const char *name) { return MakeDirectory(name); }
+
+    bool Rmdir(const char *name) { return RemoveDirectory(name); }
+
 };
 
 #else // FILESYS
+#include "list.h"
+
+class FileHeader;
+class Directory;
+class FreeMap;
+class Lock;
+class Semaphore;
+
 class FileSystem {
   public:
-    FileSystem(bool format);		// Initialize the file system.
+    FileSystem(bool format, bool logLayout = false);
+					// Initialize the file system.
 					// Must be called *after* "synchDisk" 
 					// has been initialized.
     					// If "format", there is nothing on
 					// the disk, so initialize the directory
-    					// and the bitmap of free blocks.
+    					// and the bitmap of free blocks, and
+					// lay the disk out as a log if
+					// "logLayout".
+    ~FileSystem();			// Write back, and close the bitmap
+					// and directories
 
     bool Create(const char *name, int initialSize);  	
 					// Create a file (UNIX creat)
@@ -81,15 +98,103 @@ class FileSystem {
 
     bool Remove(const char *name);  	// Delete a file (UNIX unlink)
 
+    bool Mkdir(const char *name);	// Create a directory (UNIX mkdir)
+
+    bool Rmdir(const char *name);	// Delete an empty directory
+					// (UNIX rmdir)
+
+    bool Reserve(int sectors);		// Set aside free sectors for the
+    void Unreserve(int sectors);	// bytes buffered in a file's tail,
+					// or give them back
+    bool Extend(FileHeader *hdr, int hdrSector, int newSize,
+		int reserved = 0);
+					// Allocate space for an open file
+					// to grow (cf. OpenFile::Flush),
+					// using up "reserved" sectors
+
+    void Sync();			// Write back the bitmap and the
+					// directories, and commit them
+    void Flush();			// Same, unless the file system is
+					// busy: then, once it is done
+
     void List();			// List all the files in the file system
 
     void Print();			// List all the files and their contents
 
+    Directory *GetDirectory(int sector);
+					// The directory whose header is at
+					// "sector", kept in memory
+
+    Inode *OpenInode(int sector);	// The shared i-node of a file, for
+    void CloseInode(Inode *inode);	// one more OpenFile, or one less
+
+    void CleanSegments();		// Body of the cleaner thread, on a
+					// log-structured disk
+    void Defragment();			// Start the defragmenter thread
+    int DefragmentFiles();		// Its body: put each file in one
+					// piece, and return how many moved
+    void PrintStats();			// Print the layout, and what the
+					// cleaner did
+    int PrintFragmentation();		// Print how fragmented the files,
+					// and the free space, are; return
+					// how many files are away from
+					// their cylinder group
+
   private:
    OpenFile* freeMapFile;		// Bit map of free disk blocks,
 					// represented as a file
-   OpenFile* directoryFile;		// "Root" directory -- list of 
-					// file names, represented as a file
+   FreeMap *freeMap;			// ... and kept in memory
+   bool freeMapDirty;			// Changed since written back?
+   ::List<Directory *> *directories;	// Directories kept in memory, the
+					// "root" directory first
+   ::List<Inode *> *inodes;		// I-nodes of the open files
+   Lock *lock;				// Protects all of the above
+   int users;				// Threads holding, or waiting for,
+					// the lock
+   int nested;				// Operations the holder started
+					// within its own
+   bool syncNeeded;			// Should the holder write back?
+
+   bool logStructured;			// Is space allocated at the log
+					// head, rather than near each file?
+   int logHead;				// Where the next sectors are to go
+   Semaphore *cleanNeeded;		// Wakes up the cleaner thread
+   bool cleanerAwake;			// ... unless it is at work already
+   int segmentsCleaned, filesMoved;	// Statistics
+
+   void Enter();			// Acquire the lock
+   void Leave();			// Release it, committing first if
+					// asked to, or if the journal fills
+   void LogChanges();			// Write back the bitmap and the
+					// directories to the journal,
+					// holding the lock
+   OpenFile *OpenMetadata(int sector);	// Open the bitmap or a directory
+
+   int *LogGoal();			// Where to allocate data: the log
+					// head, or NULL if not a log
+   void MoveLogHead();			// Move the log head on to a clean
+					// segment, if it needs to
+   int SegmentUse(int segment);		// Sectors in use in a segment
+   int NumCleanSegments();		// Segments with none in use
+   int PickVictims(bool *victims, int wanted);
+					// The segments best worth cleaning
+   void MoveFiles(bool *victims, ::List<FileHeader *> *moved);
+					// Relocate the closed files that
+					// have data in them
+   bool DefragmentFile(const char *path);
+					// Move one file into one piece
+   int PlaceFor(FileHeader *hdr, int sector);
+					// Where to move it to, or -1 if
+					// it is better left where it is
+
+   Inode *FindInode(int sector);	// OpenInode, holding the lock, and
+					// without reading in the header
+   int FindDirectory(const char *path, char *name);
+					// Follow "path" to the directory
+					// holding its last component
+   bool Make(const char *path, int initialSize, bool isDirectory);
+   bool Delete(const char *path, bool isDirectory);
+					// Create/remove a file or directory
 };
 
 #endif // FILESYS
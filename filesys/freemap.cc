@@ -0,0 +1,319 @@
+// freemap.cc
+//	Routines to keep track of the free sectors of the disk, by
+//	cylinder group.
+//
+//	Searches for free space start in the group of the sector they
+//	are given as a goal, and then move out to the groups on either
+//	side of it, nearest first.  A group is skipped at once if its
+//	count says it has no free sector; only the bits of the groups
+//	worth looking at are tested.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "freemap.h"
+#include "disk.h"
+
+//----------------------------------------------------------------------
+// FreeMap::FreeMap
+// 	Initialize the map of free sectors of a disk, with every sector
+//	free.
+//
+//	"sectors" is the number of sectors on the disk
+//----------------------------------------------------------------------
+
+FreeMap::FreeMap(int sectors)
+{
+    numSectors = sectors;
+    groupSectors = TracksPerGroup * SectorsPerTrack;
+    numGroups = divRoundUp(numSectors, groupSectors);
+    map = new BitMap(numSectors);
+    numFree = new int[numGroups];
+    numReserved = 0;
+    Recount();
+}
+
+FreeMap::~FreeMap()
+{
+    delete map;
+    delete [] numFree;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::Mark/Clear
+// 	Take a free sector, or give back one in use, keeping count.
+//
+//	"sector" is the sector to take or give back
+//----------------------------------------------------------------------
+
+void
+FreeMap::Mark(int sector)
+{
+    ASSERT(!map->Test(sector));
+    map->Mark(sector);
+    numFree[GroupOf(sector)]--;
+    numClear--;
+}
+
+void
+FreeMap::Clear(int sector)
+{
+    ASSERT(map->Test(sector));
+    map->Clear(sector);
+    numFree[GroupOf(sector)]++;
+    numClear++;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::GroupEnd
+// 	Return the sector after the last one of "group".
+//----------------------------------------------------------------------
+
+int
+FreeMap::GroupEnd(int group)
+{
+    int end = GroupStart(group + 1);
+
+    return (end > numSectors) ? numSectors : end;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::Find
+// 	Take a free sector, and return it: the first one at or after
+//	"goal" in its group, or else the first one of the group, or else
+//	the first one of the nearest group that has any.  Return -1 if
+//	the disk is full, or its free sectors are all reserved.
+//
+//	"goal" is where we would like the sector to be
+//----------------------------------------------------------------------
+
+int
+FreeMap::Find(int goal)
+{
+    int group = GroupOf(goal), distance, side, which, sector;
+
+    if (NumClear() <= 0)
+	return -1;
+    for (distance = 0; distance < numGroups; distance++)
+	for (side = -1; side <= 1; side += 2) {
+	    which = group + side * distance;
+	    if (which < 0 || which >= numGroups || numFree[which] == 0
+		    || (distance == 0 && side == 1))
+		continue;
+	    if (which != group)
+		goal = GroupStart(which);
+	    for (sector = goal; sector < GroupEnd(which); sector++)
+		if (!map->Test(sector)) {
+		    Mark(sector);
+		    return sector;
+		}
+	    for (sector = GroupStart(which); sector < goal; sector++)
+		if (!map->Test(sector)) {
+		    Mark(sector);
+		    return sector;
+		}
+	}
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::FindRun
+// 	Find free sectors for the next "wanted" sectors of a file.  Best
+//	is to go on right at "goal", where the file's last extent (or its
+//	header, or the log) ends.  Otherwise take the free run long enough
+//	for all of them on the track nearest the goal, looking in the
+//	goal's group first, and then in the groups further and further
+//	away; or failing that the longest free run on the disk.
+//
+//	Return the first sector found, and set "*length" to how many of
+//	the "wanted" sectors fit there.  Return -1 if the disk is full.
+//	The sectors are not taken: the caller marks those it uses.
+//
+//	"goal" is where we would like the sectors to start
+//	"wanted" is how many sectors are still to be allocated
+//----------------------------------------------------------------------
+
+int
+FreeMap::FindRun(int goal, int wanted, int *length)
+{
+    int best = -1, bestLength = 0;
+    int group, distance, side, which, start, runLength, end;
+
+    if (goal >= numSectors)
+	goal = numSectors - 1;
+    if (!map->Test(goal)) {		// we can just go on
+	for (end = goal; end < numSectors && end - goal < wanted
+			 && !map->Test(end); end++)
+	    ;
+	*length = end - goal;
+	return goal;
+    }
+
+    group = GroupOf(goal);
+    for (distance = 0; distance < numGroups; distance++)
+	for (side = -1; side <= 1; side += 2) {
+	    which = group + side * distance;
+	    if (which < 0 || which >= numGroups || numFree[which] == 0
+		    || (distance == 0 && side == 1))
+		continue;
+	    start = BestRun(which, goal, wanted, &runLength);
+	    if (runLength >= wanted) {
+		*length = wanted;
+		return start;
+	    }
+	    if (runLength > bestLength) {
+		best = start;
+		bestLength = runLength;
+	    }
+	}
+    *length = bestLength;
+    return best;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::BestRun
+// 	Return the free run starting in "group" that FindRun would take:
+//	the one long enough for "wanted" sectors on the track nearest
+//	"goal", or else the longest.  Set "*length" to its length (it may
+//	go on into the next group).  Return -1, with "*length" 0, if the
+//	group has no free sector.
+//----------------------------------------------------------------------
+
+int
+FreeMap::BestRun(int group, int goal, int wanted, int *length)
+{
+    int best = -1, bestLength = 0, bestDistance = 0;
+    int start, end, groupEnd = GroupEnd(group);
+
+    for (start = GroupStart(group); start < groupEnd; start = end + 1) {
+	while (start < groupEnd && map->Test(start))
+	    start++;
+	if (start == groupEnd)
+	    break;			// no more free runs
+	for (end = start; end < numSectors && !map->Test(end); end++)
+	    ;
+
+	int runLength = end - start;
+	int distance = abs(start / SectorsPerTrack - goal / SectorsPerTrack);
+	bool fits = (runLength >= wanted), bestFits = (bestLength >= wanted);
+
+	if (best == -1 || (fits && (!bestFits || distance < bestDistance))
+	    || (!fits && !bestFits && runLength > bestLength)) {
+	    best = start;
+	    bestLength = runLength;
+	    bestDistance = distance;
+	}
+    }
+    *length = bestLength;
+    return best;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::SpareGroup
+// 	Return the first group after "after" (going round the disk) that
+//	has at least its share of the free sectors.  New directories go
+//	there, so that each one has room for its files to grow nearby.
+//----------------------------------------------------------------------
+
+int
+FreeMap::SpareGroup(int after)
+{
+    for (int i = 1; i <= numGroups; i++) {
+	int group = (after + i) % numGroups;
+
+	if (numFree[group] * numGroups >= numClear && numFree[group] > 0)
+	    return group;
+    }
+    return after;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::FreeRuns
+// 	Return how many runs of free sectors there are, and set
+//	"*longest" to the length of the longest one: the more runs, and
+//	the shorter, the more fragmented the free space is.
+//----------------------------------------------------------------------
+
+int
+FreeMap::FreeRuns(int *longest)
+{
+    int runs = 0, start, end;
+
+    *longest = 0;
+    for (start = 0; start < numSectors; start = end) {
+	if (map->Test(start)) {
+	    end = start + 1;
+	    continue;
+	}
+	for (end = start; end < numSectors && !map->Test(end); end++)
+	    ;
+	runs++;
+	if (end - start > *longest)
+	    *longest = end - start;
+    }
+    return runs;
+}
+
+//----------------------------------------------------------------------
+// FreeMap::Recount
+// 	Count the free sectors of each group, and of the disk.
+//----------------------------------------------------------------------
+
+void
+FreeMap::Recount()
+{
+    numClear = 0;
+    for (int group = 0; group < numGroups; group++) {
+	numFree[group] = 0;
+	for (int sector = GroupStart(group); sector < GroupEnd(group);
+	     sector++)
+	    if (!map->Test(sector))
+		numFree[group]++;
+	numClear += numFree[group];
+    }
+}
+
+//----------------------------------------------------------------------
+// FreeMap::FetchFrom/WriteBack
+// 	Read the map from the bitmap file, and count its free sectors;
+//	or write it back there.
+//
+//	"file" is the bitmap file
+//----------------------------------------------------------------------
+
+void
+FreeMap::FetchFrom(OpenFile *file)
+{
+    map->FetchFrom(file);
+    Recount();
+}
+
+void
+FreeMap::WriteBack(OpenFile *file)
+{
+    map->WriteBack(file);
+}
+
+//----------------------------------------------------------------------
+// FreeMap::Print/PrintGroups
+// 	Print the sectors in use, for debugging; or how many sectors are
+//	free in each group.
+//----------------------------------------------------------------------
+
+void
+FreeMap::Print()
+{
+    map->Print();
+}
+
+void
+FreeMap::PrintGroups()
+{
+    printf("Cylinder groups: %d of %d sectors, free:", numGroups,
+	   groupSectors);
+    for (int group = 0; group < numGroups; group++)
+	printf(" %d", numFree[group]);
+    printf("\n");
+}
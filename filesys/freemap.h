@@ -0,0 +1,90 @@
+// freemap.h
+//	Data structures to keep track of the free sectors of the disk,
+//	divided into cylinder groups.
+//
+//	The disk is cut into groups of TracksPerGroup tracks.  Each group
+//	has its own part of the bitmap of free sectors, and a count of
+//	how many of them are free, so that a search for free space can
+//	skip the groups that have none, and stay within one group when it
+//	can: its sectors are close together, and going from one to another
+//	takes short seeks only.  The file system keeps a directory, the
+//	headers of its files and their data in the same group, and spreads
+//	directories over the groups.
+//
+//	On disk, the bitmaps of the groups are stored one after the other,
+//	as the bitmap of the whole disk; the counts are worked out from
+//	it when the file system is mounted.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FREEMAP_H
+#define FREEMAP_H
+
+#include "copyright.h"
+#include "bitmap.h"
+
+#define TracksPerGroup	4		// tracks in a cylinder group
+
+// The following class defines the map of free sectors: a bitmap,
+// with one bit per sector, and the number of free sectors in each
+// cylinder group.
+
+class FreeMap {
+  public:
+    FreeMap(int numSectors);		// Initialize a map of "numSectors"
+					// sectors, all of them free
+    ~FreeMap();
+
+    void Mark(int sector);		// Take a sector
+    void Clear(int sector);		// Give it back
+    bool Test(int sector) { return map->Test(sector); }
+					// Is the sector in use?
+    int NumClear() { return numClear - numReserved; }
+					// How many sectors are free, and
+					// not reserved?
+    void Reserve(int sectors) { numReserved += sectors; }
+    void Unreserve(int sectors) { numReserved -= sectors; }
+					// Set free sectors aside, for data
+					// to be allocated later, or give
+					// them back
+
+    int Find(int goal);			// Take a free sector near "goal",
+					// and return it, or -1 if none
+    int FindRun(int goal, int wanted, int *length);
+					// Where to put "wanted" sectors
+					// near "goal" (they are not taken)
+
+    int GroupOf(int sector) { return sector / groupSectors; }
+    int GroupStart(int group) { return group * groupSectors; }
+    int SpareGroup(int after);		// A group with room to spare, for
+					// a new directory
+    int BestRun(int group, int goal, int wanted, int *length);
+					// The run FindRun would pick within
+					// a group, or -1 if it has none
+    int FreeRuns(int *longest);		// How many runs of free sectors,
+					// and the length of the longest
+
+    void FetchFrom(OpenFile *file);	// Read the map from a file, and
+					// count the free sectors
+    void WriteBack(OpenFile *file);	// Write the map to a file
+    void Print();			// Print the sectors in use
+    void PrintGroups();			// Print the free sectors of each
+					// group
+
+  private:
+    BitMap *map;			// Which sectors are in use
+    int numSectors;			// Sectors on the disk
+    int groupSectors;			// Sectors in a group
+    int numGroups;			// Groups on the disk (the last one
+					// may be short)
+    int *numFree;			// Free sectors in each group
+    int numClear;			// ... and on the whole disk
+    int numReserved;			// Free sectors set aside
+
+    int GroupEnd(int group);		// Sector after the last of a group
+    void Recount();			// Work out the counts from the map
+};
+
+#endif // FREEMAP_H
@@ -4,9 +4,13 @@
 //	We implement:
 //	   Copy -- copy a file from UNIX to Nachos
 //	   Print -- cat the contents of a Nachos file 
+//	   Import/Export -- copy files (or a whole UNIX directory, into
+//		Nachos) between UNIX and Nachos, in bulk
 //	   Perftest -- a stress test for the Nachos file system
 //		read and write a really large file in tiny chunks
-//		(won't work on baseline system!)
+//		(won't work on baseline system!), then read several
+//		files at once from concurrent threads, and compare
+//		reading a file laid out on a fresh and a fragmented disk
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -20,6 +24,8 @@
 #include "thread.h"
 #include "disk.h"
 #include "stats.h"
+#include "synch.h"
+#include "synchdisk.h"
 
 #define TransferSize 	10 	// make it small, just to be difficult
 
@@ -96,6 +102,191 @@ Print(const char *name)
     return;
 }
 
+//----------------------------------------------------------------------
+// Import/Export
+// 	Copy a UNIX file to a Nachos file, or a Nachos file to a UNIX
+//	file, in bulk.  The Nachos file is given all of its space when it
+//	is created, and the data moves in chunks of BulkChunk bytes,
+//	BulkDepth of them under way at once, straight between our buffers
+//	and the disk (cf. OpenFile::WriteAsync).  So the disk always has
+//	the next chunk queued while we fill or empty another.
+//
+//	Import copies a whole UNIX directory, and those below it, into a
+//	new Nachos directory, too.
+//
+//	Print how many bytes were moved, and how fast, in MB per simulated
+//	second (taking a tick to be a microsecond, cf. stats.h).
+//----------------------------------------------------------------------
+
+#define BulkChunk	(32 * SectorSize)	// bytes per transfer
+#define BulkDepth	4			// transfers under way at once
+
+static int
+ChunkAt(int position, int fileLength)
+{
+    return (fileLength - position < BulkChunk) ? fileLength - position
+					       : BulkChunk;
+}
+
+static void
+PrintRate(const char *what, const char *name, int bytes, int ticks)
+{
+    printf("%s %s: %d bytes in %d ticks, %.2f MB/s\n", what, name, bytes,
+	   ticks, (ticks > 0) ? (double) bytes / ticks : 0.0);
+}
+
+static int
+ImportFile(const char *from, const char *to)
+{
+    FILE *fp;
+    OpenFile *openFile;
+    DiskHandle *handle[BulkDepth];
+    char *buffers, *data;
+    int fileLength, position, slot, wanted;
+
+    if ((fp = fopen(from, "r")) == NULL) {
+	printf("Import: couldn't open input file %s\n", from);
+	return -1;
+    }
+    fseek(fp, 0, 2);
+    fileLength = ftell(fp);
+    fseek(fp, 0, 0);
+
+    DEBUG('f', "Importing file %s, size %d, to file %s\n", from, fileLength,
+	  to);
+    if (!fileSystem->Create(to, fileLength)
+	    || (openFile = fileSystem->Open(to)) == NULL) {
+	printf("Import: couldn't create output file %s\n", to);
+	fclose(fp);
+	return -1;
+    }
+
+    buffers = new char[BulkDepth * BulkChunk];
+    for (slot = 0; slot < BulkDepth; slot++)
+	handle[slot] = NULL;
+    for (position = 0; position < fileLength; position += BulkChunk) {
+	slot = (position / BulkChunk) % BulkDepth;
+	data = &buffers[slot * BulkChunk];
+	if (handle[slot] != NULL) {		// wait for the buffer
+	    handle[slot]->Wait();
+	    delete handle[slot];
+	    handle[slot] = NULL;
+	}
+	wanted = ChunkAt(position, fileLength);
+	if ((int) fread(data, sizeof(char), wanted, fp) < wanted) {
+	    printf("Import: couldn't read input file %s\n", from);
+	    break;
+	}
+	handle[slot] = openFile->WriteAsync(data, wanted, position);
+    }
+    for (slot = 0; slot < BulkDepth; slot++)
+	if (handle[slot] != NULL) {
+	    handle[slot]->Wait();
+	    delete handle[slot];
+	}
+    delete [] buffers;
+
+    delete openFile;
+    fclose(fp);
+    if (position < fileLength) {	// don't leave a half-written file
+	fileSystem->Remove(to);
+	return -1;
+    }
+    return fileLength;
+}
+
+static int
+ImportTree(const char *from, const char *to)
+{
+    void *dir;
+    const char *name;
+    char *fromPath, *toPath;
+    int bytes = 0, moved;
+
+    if (!IsDirectory(from))
+	return ImportFile(from, to);
+    if ((dir = OpenDirectory(from)) == NULL || !fileSystem->Mkdir(to)) {
+	printf("Import: couldn't copy directory %s\n", from);
+	if (dir != NULL)
+	    CloseDirectory(dir);
+	return -1;
+    }
+    while ((name = ReadDirectory(dir)) != NULL) {
+	if (!strcmp(name, ".") || !strcmp(name, ".."))
+	    continue;
+	fromPath = new char[strlen(from) + strlen(name) + 2];
+	toPath = new char[strlen(to) + strlen(name) + 2];
+	sprintf(fromPath, "%s/%s", from, name);
+	sprintf(toPath, "%s/%s", to, name);
+	moved = ImportTree(fromPath, toPath);
+	if (moved < 0 || bytes < 0)
+	    bytes = -1;			// go on with the rest, though
+	else
+	    bytes += moved;
+	delete [] fromPath;
+	delete [] toPath;
+    }
+    CloseDirectory(dir);
+    return bytes;
+}
+
+void
+Import(const char *from, const char *to)
+{
+    int start = stats->totalTicks;
+    int bytes = ImportTree(from, to);
+
+    if (bytes >= 0)
+	PrintRate("Imported", from, bytes, stats->totalTicks - start);
+}
+
+void
+Export(const char *from, const char *to)
+{
+    FILE *fp;
+    OpenFile *openFile;
+    DiskHandle *handle[BulkDepth];
+    char *buffers;
+    int fileLength, next, done, slot, amount;
+    int start = stats->totalTicks;
+
+    if ((openFile = fileSystem->Open(from)) == NULL) {
+	printf("Export: unable to open file %s\n", from);
+	return;
+    }
+    if (!openFile->Flush()) {		// the whole file on disk
+	printf("Export: unable to flush file %s\n", from);
+	delete openFile;
+	return;
+    }
+    if ((fp = fopen(to, "w")) == NULL) {
+	printf("Export: couldn't open output file %s\n", to);
+	delete openFile;
+	return;
+    }
+    fileLength = openFile->Length();
+
+    buffers = new char[BulkDepth * BulkChunk];
+    for (next = done = 0; done < fileLength; done += amount) {
+	for (; next < fileLength && next < done + BulkDepth * BulkChunk;
+	     next += BulkChunk) {
+	    slot = (next / BulkChunk) % BulkDepth;
+	    handle[slot] = openFile->ReadAsync(&buffers[slot * BulkChunk],
+				ChunkAt(next, fileLength), next);
+	}
+	slot = (done / BulkChunk) % BulkDepth;
+	handle[slot]->Wait();
+	delete handle[slot];
+	amount = ChunkAt(done, fileLength);
+	fwrite(&buffers[slot * BulkChunk], sizeof(char), amount, fp);
+    }
+    delete [] buffers;
+
+    fclose(fp);
+    delete openFile;
+    PrintRate("Exported", from, fileLength, stats->totalTicks - start);
+}
+
 //----------------------------------------------------------------------
 // PerformanceTest
 // 	Stress the Nachos file system by creating a large file, writing
@@ -169,6 +360,896 @@ FileRead()
     delete openFile;	// close file
 }
 
+//----------------------------------------------------------------------
+// ConcurrentRead
+// 	Read NumReaders files at the same time, one thread per file, so
+//	that several requests are waiting for the disk at once and the
+//	order in which SynchDisk serves them matters.  Run with -nc to
+//	send every read to the disk.
+//----------------------------------------------------------------------
+
+#define NumReaders	4
+#define ReaderFileSize	((int)(ContentSize * 300))
+
+static Semaphore *readersDone;
+static int readerNumber[NumReaders];
+
+static void
+ReaderName(int which, char *name)
+{
+    sprintf(name, "Reader%d", which);
+}
+
+static void
+ReaderThread(void *arg)
+{
+    char name[10], buffer[10];
+    OpenFile *openFile;
+    int i;
+
+    ReaderName(*(int *) arg, name);
+    if ((openFile = fileSystem->Open(name)) == NULL) {
+	printf("Perf test: unable to open file %s\n", name);
+	readersDone->V();
+	return;
+    }
+    for (i = 0; i < ReaderFileSize; i += ContentSize)
+	if ((openFile->Read(buffer, ContentSize) < 10)
+		|| strncmp(buffer, Contents, ContentSize)) {
+	    printf("Perf test: unable to read %s\n", name);
+	    break;
+	}
+    delete openFile;
+    readersDone->V();
+}
+
+static void
+ConcurrentRead()
+{
+    char name[10];
+    OpenFile *openFile;
+    int i, which, start;
+
+    printf("Concurrent read of %d %d byte files, in %d byte chunks\n",
+	NumReaders, ReaderFileSize, (int)ContentSize);
+    for (which = 0; which < NumReaders; which++) {
+	ReaderName(which, name);
+	if (!fileSystem->Create(name, ReaderFileSize)
+		|| (openFile = fileSystem->Open(name)) == NULL) {
+	    printf("Perf test: can't create %s\n", name);
+	    return;
+	}
+	for (i = 0; i < ReaderFileSize; i += ContentSize)
+	    openFile->Write(Contents, ContentSize);
+	delete openFile;
+    }
+    synchDisk->Sync();
+
+    readersDone = new Semaphore("readers done", 0);
+    start = stats->totalTicks;
+    for (which = 0; which < NumReaders; which++) {
+	Thread *reader = new Thread("reader");
+	readerNumber[which] = which;
+	reader->Fork(ReaderThread, (void *) &readerNumber[which]);
+    }
+    for (which = 0; which < NumReaders; which++)
+	readersDone->P();
+    printf("Concurrent read took %d ticks\n", stats->totalTicks - start);
+    delete readersDone;
+
+    for (which = 0; which < NumReaders; which++) {
+	ReaderName(which, name);
+	fileSystem->Remove(name);
+    }
+}
+
+//----------------------------------------------------------------------
+// SharedFileTest
+// 	Have NumSharers threads use one file at once, each through its
+//	own OpenFile: first all of them reading the whole file, which
+//	they may do at the same time, then each writing its own part of
+//	it, in small chunks.  The parts do not start on sector
+//	boundaries, so neighbours share a sector, and would lose each
+//	other's bytes if their writes to it were not serialized.  Run
+//	with -nc to send every read to the disk.
+//----------------------------------------------------------------------
+
+#define NumSharers	4
+#define SharedFileName	"Shared"
+#define SharedFileSize	((int)(ContentSize * 400))
+#define SharedPart	(SharedFileSize / NumSharers)
+
+static Semaphore *sharersDone;
+static int sharerNumber[NumSharers];
+
+static void
+SharedReader(void *arg)
+{
+    char buffer[10];
+    OpenFile *openFile;
+    int i;
+
+    if ((openFile = fileSystem->Open(SharedFileName)) == NULL) {
+	printf("Perf test: unable to open file %s\n", SharedFileName);
+	sharersDone->V();
+	return;
+    }
+    for (i = 0; i < SharedFileSize; i += ContentSize)
+	if ((openFile->Read(buffer, ContentSize) < (int) ContentSize)
+		|| strncmp(buffer, Contents, ContentSize)) {
+	    printf("Perf test: unable to read %s\n", SharedFileName);
+	    break;
+	}
+    delete openFile;
+    sharersDone->V();
+}
+
+static void
+SharedWriter(void *arg)
+{
+    int which = *(int *) arg;
+    char buffer[10];
+    OpenFile *openFile;
+    int i;
+
+    if ((openFile = fileSystem->Open(SharedFileName)) == NULL) {
+	printf("Perf test: unable to open file %s\n", SharedFileName);
+	sharersDone->V();
+	return;
+    }
+    memset(buffer, 'a' + which, ContentSize);
+    for (i = 0; i < SharedPart; i += ContentSize)
+	if (openFile->WriteAt(buffer, ContentSize, which * SharedPart + i)
+		< (int) ContentSize) {
+	    printf("Perf test: unable to write %s\n", SharedFileName);
+	    break;
+	}
+    delete openFile;
+    sharersDone->V();
+}
+
+static void
+RunSharers(VoidFunctionPtr body)
+{
+    int which;
+
+    for (which = 0; which < NumSharers; which++) {
+	Thread *sharer = new Thread("sharer");
+	sharerNumber[which] = which;
+	sharer->Fork(body, (void *) &sharerNumber[which]);
+    }
+    for (which = 0; which < NumSharers; which++)
+	sharersDone->P();
+}
+
+static void
+SharedFileTest()
+{
+    char *data = new char[SharedFileSize];
+    OpenFile *openFile;
+    int i, start;
+
+    printf("Shared file of %d bytes, used by %d threads\n",
+	SharedFileSize, NumSharers);
+    if (!fileSystem->Create(SharedFileName, SharedFileSize)
+	    || (openFile = fileSystem->Open(SharedFileName)) == NULL) {
+	printf("Perf test: can't create %s\n", SharedFileName);
+	delete [] data;
+	return;
+    }
+    for (i = 0; i < SharedFileSize; i += ContentSize)
+	openFile->Write(Contents, ContentSize);
+    openFile->Flush();
+    synchDisk->Sync();
+
+    sharersDone = new Semaphore("sharers done", 0);
+    start = stats->totalTicks;
+    RunSharers(SharedReader);
+    printf("Shared read took %d ticks\n", stats->totalTicks - start);
+    start = stats->totalTicks;
+    RunSharers(SharedWriter);
+    printf("Shared writes took %d ticks\n", stats->totalTicks - start);
+    delete sharersDone;
+
+    if (openFile->ReadAt(data, SharedFileSize, 0) < SharedFileSize)
+	printf("Perf test: unable to read %s\n", SharedFileName);
+    else
+	for (i = 0; i < SharedFileSize; i++)
+	    if (data[i] != 'a' + i / SharedPart) {
+		printf("Perf test: lost write at byte %d of %s\n", i,
+		       SharedFileName);
+		break;
+	    }
+    delete openFile;
+    delete [] data;
+    fileSystem->Remove(SharedFileName);
+}
+
+//----------------------------------------------------------------------
+// LayoutTest
+// 	Time a sequential read of a file allocated on a fresh disk, and
+//	of one allocated after removing every other file of a series of
+//	small ones, so that it has to fill the holes.  Run with -nc to
+//	send every read to the disk.
+//----------------------------------------------------------------------
+
+#define LayoutFileSize	((int)(ContentSize * 2000))
+#define NumFragments	8
+#define FragmentSize	(2 * SectorSize)
+
+static bool
+TimedRead(const char *name, const char *layout)
+{
+    char buffer[10];
+    OpenFile *openFile;
+    int i, start;
+
+    if (!fileSystem->Create(name, LayoutFileSize)
+	    || (openFile = fileSystem->Open(name)) == NULL) {
+	printf("Perf test: can't create %s\n", name);
+	return false;
+    }
+    for (i = 0; i < LayoutFileSize; i += ContentSize)
+	openFile->Write(Contents, ContentSize);
+    synchDisk->Sync();
+
+    openFile->Seek(0);
+    start = stats->totalTicks;
+    for (i = 0; i < LayoutFileSize; i += ContentSize)
+	if ((openFile->Read(buffer, ContentSize) < 10)
+		|| strncmp(buffer, Contents, ContentSize)) {
+	    printf("Perf test: unable to read %s\n", name);
+	    break;
+	}
+    printf("Sequential read on a %s disk took %d ticks\n", layout,
+	stats->totalTicks - start);
+    delete openFile;
+    return fileSystem->Remove(name);
+}
+
+static void
+LayoutTest()
+{
+    char name[10];
+    int which;
+
+    printf("Sequential read of a %d byte file, in %d byte chunks\n",
+	LayoutFileSize, (int)ContentSize);
+    if (!TimedRead("Fresh", "fresh"))
+	return;
+
+    for (which = 0; which < NumFragments; which++) {
+	sprintf(name, "Frag%d", which);
+	fileSystem->Create(name, FragmentSize);
+    }
+    for (which = 0; which < NumFragments; which += 2) {
+	sprintf(name, "Frag%d", which);
+	fileSystem->Remove(name);
+    }
+    TimedRead("Fragmented", "fragmented");
+    for (which = 1; which < NumFragments; which += 2) {
+	sprintf(name, "Frag%d", which);
+	fileSystem->Remove(name);
+    }
+}
+
+//----------------------------------------------------------------------
+// DirectoryTest
+// 	Fill a directory two levels down with NumDirFiles files, so that
+//	it has to grow to many buckets, and time looking all of them up.
+//	Then check that the directory can be removed only once it is
+//	empty.
+//----------------------------------------------------------------------
+
+#define NumDirFiles	200
+#define DirFileName	"/Perf/Dir/File%d"
+
+static void
+DirectoryTest()
+{
+    char name[30];
+    OpenFile *openFile;
+    int which, start;
+
+    printf("Lookup of %d files in a directory\n", NumDirFiles);
+    if (!fileSystem->Mkdir("Perf") || !fileSystem->Mkdir("/Perf/Dir")) {
+	printf("Perf test: can't create directories\n");
+	return;
+    }
+    for (which = 0; which < NumDirFiles; which++) {
+	sprintf(name, DirFileName, which);
+	if (!fileSystem->Create(name, 0)) {
+	    printf("Perf test: can't create %s\n", name);
+	    break;
+	}
+    }
+    if ((openFile = fileSystem->Open("/Perf/./Dir/../Dir/File0")) == NULL)
+	printf("Perf test: unable to follow . and ..\n");
+    delete openFile;
+
+    start = stats->totalTicks;
+    for (which = 0; which < NumDirFiles; which++) {
+	sprintf(name, DirFileName, which);
+	if ((openFile = fileSystem->Open(name)) == NULL) {
+	    printf("Perf test: unable to open %s\n", name);
+	    break;
+	}
+	delete openFile;
+    }
+    printf("Lookup took %d ticks\n", stats->totalTicks - start);
+
+    if (fileSystem->Rmdir("/Perf/Dir"))
+	printf("Perf test: removed a directory that was not empty\n");
+    for (which = 0; which < NumDirFiles; which++) {
+	sprintf(name, DirFileName, which);
+	fileSystem->Remove(name);
+    }
+    if (!fileSystem->Rmdir("/Perf/Dir/") || !fileSystem->Rmdir("Perf"))
+	printf("Perf test: unable to remove directories\n");
+}
+
+//----------------------------------------------------------------------
+// MetadataTest
+// 	Time creating, and then removing, NumMetaFiles empty files: this
+//	measures the file system operations themselves, not the data.
+//----------------------------------------------------------------------
+
+#define NumMetaFiles	100
+#define MetaFileName	"/Meta/File%d"
+
+static void
+MetadataTest()
+{
+    char name[30];
+    int which, start;
+
+    printf("Create and remove %d empty files\n", NumMetaFiles);
+    if (!fileSystem->Mkdir("Meta")) {
+	printf("Perf test: can't create directory\n");
+	return;
+    }
+    start = stats->totalTicks;
+    for (which = 0; which < NumMetaFiles; which++) {
+	sprintf(name, MetaFileName, which);
+	if (!fileSystem->Create(name, 0)) {
+	    printf("Perf test: can't create %s\n", name);
+	    break;
+	}
+    }
+    printf("Creates took %d ticks\n", stats->totalTicks - start);
+
+    start = stats->totalTicks;
+    for (which = 0; which < NumMetaFiles; which++) {
+	sprintf(name, MetaFileName, which);
+	if (!fileSystem->Remove(name)) {
+	    printf("Perf test: unable to remove %s\n", name);
+	    break;
+	}
+    }
+    printf("Removes took %d ticks\n", stats->totalTicks - start);
+    if (!fileSystem->Rmdir("Meta"))
+	printf("Perf test: unable to remove directory\n");
+}
+
+//----------------------------------------------------------------------
+// OpenTest
+// 	Time opening NumOpens times a file that is already open.  Then
+//	check that two OpenFiles of a file see the same data, and that
+//	a file removed while open can still be read until it is closed.
+//----------------------------------------------------------------------
+
+#define NumOpens	100
+
+static void
+OpenTest()
+{
+    char buffer[10];
+    OpenFile *first, *second;
+    int which, start;
+
+    printf("Open %d times a file that is already open\n", NumOpens);
+    if (!fileSystem->Create(FileName, 0)
+	    || (first = fileSystem->Open(FileName)) == NULL) {
+	printf("Perf test: can't create %s\n", FileName);
+	return;
+    }
+    start = stats->totalTicks;
+    for (which = 0; which < NumOpens; which++) {
+	second = fileSystem->Open(FileName);
+	delete second;
+    }
+    printf("Opens took %d ticks\n", stats->totalTicks - start);
+
+    second = fileSystem->Open(FileName);
+    first->Write(Contents, ContentSize);
+    if (second->ReadAt(buffer, ContentSize, 0) < (int) ContentSize
+	    || strncmp(buffer, Contents, ContentSize))
+	printf("Perf test: open files do not share their data\n");
+    if (!fileSystem->Remove(FileName) || fileSystem->Open(FileName) != NULL)
+	printf("Perf test: unable to remove %s\n", FileName);
+    if (second->ReadAt(buffer, ContentSize, 0) < (int) ContentSize
+	    || strncmp(buffer, Contents, ContentSize))
+	printf("Perf test: file removed while open lost its data\n");
+    delete first;
+    delete second;
+}
+
+//----------------------------------------------------------------------
+// BulkTest
+// 	Time writing, and then reading back, a BulkSize byte file with a
+//	single WriteAt and a single ReadAt: whole sectors go straight
+//	between our buffer and the disk cache.  Then check that reads
+//	and writes that start or end part way into a sector only change
+//	the bytes they should.
+//----------------------------------------------------------------------
+
+#define BulkSize	(64 * SectorSize)
+#define BulkFileName	"Bulk"
+
+static void
+BulkTest()
+{
+    char *data = new char[BulkSize], *buffer = new char[BulkSize];
+    OpenFile *openFile;
+    int i, start;
+
+    printf("Write and read a %d byte file in one go\n", BulkSize);
+    if (!fileSystem->Create(BulkFileName, 0)
+	    || (openFile = fileSystem->Open(BulkFileName)) == NULL) {
+	printf("Perf test: can't create %s\n", BulkFileName);
+	delete [] data;
+	delete [] buffer;
+	return;
+    }
+    for (i = 0; i < BulkSize; i++)
+	data[i] = 'a' + i % 23;
+
+    start = stats->totalTicks;
+    if (openFile->WriteAt(data, BulkSize, 0) < BulkSize || !openFile->Flush())
+	printf("Perf test: unable to write %s\n", BulkFileName);
+    synchDisk->Sync();
+    printf("Bulk write took %d ticks\n", stats->totalTicks - start);
+
+    start = stats->totalTicks;
+    if (openFile->ReadAt(buffer, BulkSize, 0) < BulkSize
+	    || memcmp(buffer, data, BulkSize))
+	printf("Perf test: unable to read %s\n", BulkFileName);
+    printf("Bulk read took %d ticks\n", stats->totalTicks - start);
+
+    for (i = 0; i < 3 * SectorSize; i++)
+	data[SectorSize / 2 + i] = 'A' + i % 26;
+    openFile->WriteAt(&data[SectorSize / 2], 3 * SectorSize, SectorSize / 2);
+    bcopy("unalign", &data[5 * SectorSize + 3], 7);
+    openFile->WriteAt(&data[5 * SectorSize + 3], 7, 5 * SectorSize + 3);
+    if (openFile->ReadAt(buffer, BulkSize - 5, 5) < BulkSize - 5
+	    || memcmp(buffer, &data[5], BulkSize - 5)
+	    || openFile->ReadAt(buffer, 2 * SectorSize, SectorSize - 1)
+		< 2 * SectorSize
+	    || memcmp(buffer, &data[SectorSize - 1], 2 * SectorSize))
+	printf("Perf test: unaligned transfers lost data\n");
+
+    delete openFile;
+    fileSystem->Remove(BulkFileName);
+    delete [] data;
+    delete [] buffer;
+}
+
+//----------------------------------------------------------------------
+// SmallFileTest
+// 	Time writing NumSmallFiles files of SmallFileSize bytes, over
+//	and over for NumRounds rounds, removing every other file after
+//	each round, so that the free space gets scattered; and then
+//	syncing them to disk.  Run with and without -lfs, to compare the
+//	log-structured layout with the classic one.
+//----------------------------------------------------------------------
+
+#define NumSmallFiles	40
+#define SmallFileSize	(3 * SectorSize)
+#define NumRounds	8
+#define SmallFileName	"/Small/R%dF%d"
+
+static void
+SmallFileTest()
+{
+    char name[30], data[SmallFileSize];
+    OpenFile *openFile;
+    int round, which, start;
+
+    printf("Write %d files of %d bytes, %d times over, removing every "
+	   "other one\n", NumSmallFiles, SmallFileSize, NumRounds);
+    if (!fileSystem->Mkdir("Small")) {
+	printf("Perf test: can't create directory\n");
+	return;
+    }
+    for (which = 0; which < SmallFileSize; which++)
+	data[which] = Contents[which % ContentSize];
+
+    start = stats->totalTicks;
+    for (round = 0; round < NumRounds; round++) {
+	for (which = 0; which < NumSmallFiles; which++) {
+	    sprintf(name, SmallFileName, round, which);
+	    if (!fileSystem->Create(name, 0)
+		    || (openFile = fileSystem->Open(name)) == NULL) {
+		printf("Perf test: can't create %s\n", name);
+		return;
+	    }
+	    if (openFile->Write(data, SmallFileSize) < SmallFileSize)
+		printf("Perf test: unable to write %s\n", name);
+	    delete openFile;
+	}
+	for (which = 0; which < NumSmallFiles; which += 2) {
+	    sprintf(name, SmallFileName, round, which);
+	    fileSystem->Remove(name);
+	}
+    }
+    fileSystem->Sync();
+    synchDisk->Sync();
+    printf("Small file writes took %d ticks\n", stats->totalTicks - start);
+
+    for (round = 0; round < NumRounds; round++)
+	for (which = 1; which < NumSmallFiles; which += 2) {
+	    sprintf(name, SmallFileName, round, which);
+	    if ((openFile = fileSystem->Open(name)) == NULL
+		    || openFile->Read(data, SmallFileSize) < SmallFileSize
+		    || strncmp(data, Contents, ContentSize))
+		printf("Perf test: unable to read %s\n", name);
+	    delete openFile;
+	    fileSystem->Remove(name);
+	}
+    if (!fileSystem->Rmdir("Small"))
+	printf("Perf test: unable to remove directory\n");
+}
+
+//----------------------------------------------------------------------
+// TinyFileTest
+// 	Time reading NumTinyFiles files of TinyFileSize bytes -- the size
+//	of a configuration file -- each opened, read and closed in turn,
+//	after they have all been synced to disk.  Run with -nc to count
+//	every sector read, header and data.  Then grow one of them to a
+//	few sectors, and check that the bytes it had are still there.
+//----------------------------------------------------------------------
+
+#define NumTinyFiles	30
+#define TinyFileSize	60
+#define TinyFileName	"/Tiny/File%d"
+#define TinyGrowth	8		// times over it is written, to grow
+
+static void
+TinyFileTest()
+{
+    char name[30], data[TinyFileSize], buffer[TinyGrowth * TinyFileSize];
+    OpenFile *openFile;
+    int which, start, reads;
+
+    printf("Read %d files of %d bytes\n", NumTinyFiles, TinyFileSize);
+    if (!fileSystem->Mkdir("Tiny")) {
+	printf("Perf test: can't create directory\n");
+	return;
+    }
+    for (which = 0; which < TinyFileSize; which++)
+	data[which] = Contents[which % ContentSize];
+    for (which = 0; which < NumTinyFiles; which++) {
+	sprintf(name, TinyFileName, which);
+	if (!fileSystem->Create(name, 0)
+		|| (openFile = fileSystem->Open(name)) == NULL) {
+	    printf("Perf test: can't create %s\n", name);
+	    return;
+	}
+	if (openFile->Write(data, TinyFileSize) < TinyFileSize)
+	    printf("Perf test: unable to write %s\n", name);
+	delete openFile;
+    }
+    fileSystem->Sync();
+    synchDisk->Sync();
+
+    start = stats->totalTicks;
+    reads = stats->numDiskReads;
+    for (which = 0; which < NumTinyFiles; which++) {
+	sprintf(name, TinyFileName, which);
+	if ((openFile = fileSystem->Open(name)) == NULL
+		|| openFile->Read(buffer, TinyFileSize) < TinyFileSize
+		|| memcmp(buffer, data, TinyFileSize))
+	    printf("Perf test: unable to read %s\n", name);
+	delete openFile;
+    }
+    printf("Tiny file reads took %d ticks, %d disk reads\n",
+	   stats->totalTicks - start, stats->numDiskReads - reads);
+
+    sprintf(name, TinyFileName, 0);
+    if ((openFile = fileSystem->Open(name)) == NULL) {
+	printf("Perf test: unable to open %s\n", name);
+	return;
+    }
+    for (which = 1; which < TinyGrowth; which++) {
+	openFile->WriteAt(data, TinyFileSize, which * TinyFileSize);
+	openFile->Flush();
+    }
+    if (openFile->ReadAt(buffer, TinyGrowth * TinyFileSize, 0)
+	    < TinyGrowth * TinyFileSize)
+	printf("Perf test: unable to read %s\n", name);
+    else
+	for (which = 0; which < TinyGrowth; which++)
+	    if (memcmp(&buffer[which * TinyFileSize], data, TinyFileSize)) {
+		printf("Perf test: %s lost data as it grew\n", name);
+		break;
+	    }
+    delete openFile;
+
+    for (which = 0; which < NumTinyFiles; which++) {
+	sprintf(name, TinyFileName, which);
+	fileSystem->Remove(name);
+    }
+    if (!fileSystem->Rmdir("Tiny"))
+	printf("Perf test: unable to remove directory\n");
+}
+
+//----------------------------------------------------------------------
+// GroupTest
+// 	Time reading NumGroupDirs directories of NumGroupFiles files
+//	each, one directory at a time, after creating the files in turn
+//	in all of the directories -- as when several users work at once.
+//	Files that share a directory are read together, so the less the
+//	disk head has to travel between them, the better.  Run with -nc
+//	to see the seeks.
+//----------------------------------------------------------------------
+
+#define NumGroupDirs	4
+#define NumGroupFiles	8
+#define GroupFileSize	(4 * SectorSize)
+#define GroupDirName	"/Group%d"
+#define GroupFileName	"/Group%d/File%d"
+
+static void
+GroupTest()
+{
+    char name[30], data[GroupFileSize], buffer[GroupFileSize];
+    OpenFile *openFile;
+    int dir, which, start;
+
+    printf("Read %d directories of %d files, created side by side\n",
+	   NumGroupDirs, NumGroupFiles);
+    for (dir = 0; dir < NumGroupDirs; dir++) {
+	sprintf(name, GroupDirName, dir);
+	if (!fileSystem->Mkdir(name)) {
+	    printf("Perf test: can't create directory\n");
+	    return;
+	}
+    }
+    for (which = 0; which < GroupFileSize; which++)
+	data[which] = Contents[which % ContentSize];
+    for (which = 0; which < NumGroupFiles; which++)
+	for (dir = 0; dir < NumGroupDirs; dir++) {
+	    sprintf(name, GroupFileName, dir, which);
+	    if (!fileSystem->Create(name, 0)
+		    || (openFile = fileSystem->Open(name)) == NULL) {
+		printf("Perf test: can't create %s\n", name);
+		return;
+	    }
+	    if (openFile->Write(data, GroupFileSize) < GroupFileSize)
+		printf("Perf test: unable to write %s\n", name);
+	    delete openFile;
+	}
+    fileSystem->Sync();
+    synchDisk->Sync();
+
+    start = stats->totalTicks;
+    for (dir = 0; dir < NumGroupDirs; dir++)
+	for (which = 0; which < NumGroupFiles; which++) {
+	    sprintf(name, GroupFileName, dir, which);
+	    if ((openFile = fileSystem->Open(name)) == NULL
+		    || openFile->Read(buffer, GroupFileSize) < GroupFileSize
+		    || memcmp(buffer, data, GroupFileSize))
+		printf("Perf test: unable to read %s\n", name);
+	    delete openFile;
+	}
+    printf("Directory at a time reads took %d ticks\n",
+	   stats->totalTicks - start);
+
+    for (dir = 0; dir < NumGroupDirs; dir++) {
+	for (which = 0; which < NumGroupFiles; which++) {
+	    sprintf(name, GroupFileName, dir, which);
+	    fileSystem->Remove(name);
+	}
+	sprintf(name, GroupDirName, dir);
+	if (!fileSystem->Rmdir(name))
+	    printf("Perf test: unable to remove directory\n");
+    }
+}
+
+//----------------------------------------------------------------------
+// DefragTest
+// 	Time reading NumDefragFiles files that were appended to in turn,
+//	a sector at a time, so that they are in many extents; then run
+//	the defragmenter over them, and time reading them again.  Run
+//	with -nc to see the seeks.  Defragmenting must not move any file
+//	out of its header's cylinder group.
+//
+//	The files are small enough for the defragmenter to find room for
+//	them in their group, and so for the disk cache to hold them; the
+//	cache is filled with a scratch file before each timing, so that
+//	both read the files from the disk.
+//----------------------------------------------------------------------
+
+#define NumDefragFiles	4
+#define DefragChunks	12
+#define DefragFileSize	(DefragChunks * SectorSize)
+#define DefragFileName	"/Defrag/File%d"
+#define ScratchName	"/DefragScratch"
+#define ScratchSize	(CacheSectors * SectorSize)
+
+static void
+TimedReads(const char *layout, const char *data)
+{
+    char name[30], buffer[DefragFileSize];
+    OpenFile *openFile;
+    int which, start;
+
+    if ((openFile = fileSystem->Open(ScratchName)) != NULL)
+	for (which = 0; which < ScratchSize; which += DefragFileSize)
+	    openFile->Read(buffer, DefragFileSize);
+    delete openFile;
+
+    start = stats->totalTicks;
+
+    for (which = 0; which < NumDefragFiles; which++) {
+	sprintf(name, DefragFileName, which);
+	if ((openFile = fileSystem->Open(name)) == NULL
+		|| openFile->Read(buffer, DefragFileSize) < DefragFileSize
+		|| memcmp(buffer, data, DefragFileSize))
+	    printf("Perf test: unable to read %s\n", name);
+	delete openFile;
+    }
+    printf("Reading %s files took %d ticks\n", layout,
+	   stats->totalTicks - start);
+}
+
+static void
+DefragTest()
+{
+    char name[30], data[DefragFileSize];
+    OpenFile *openFile[NumDefragFiles];
+    int which, chunk, moved, start, away;
+
+    printf("Defragment %d files of %d bytes, appended to in turn\n",
+	   NumDefragFiles, DefragFileSize);
+    if (!fileSystem->Create(ScratchName, ScratchSize)) {
+	printf("Perf test: can't create %s\n", ScratchName);
+	return;
+    }
+    if (!fileSystem->Mkdir("Defrag")) {
+	printf("Perf test: can't create directory\n");
+	return;
+    }
+    for (which = 0; which < DefragFileSize; which++)
+	data[which] = Contents[which % ContentSize];
+    for (which = 0; which < NumDefragFiles; which++) {
+	sprintf(name, DefragFileName, which);
+	if (!fileSystem->Create(name, 0)
+		|| (openFile[which] = fileSystem->Open(name)) == NULL) {
+	    printf("Perf test: can't create %s\n", name);
+	    return;
+	}
+    }
+    for (chunk = 0; chunk < DefragChunks; chunk++)
+	for (which = 0; which < NumDefragFiles; which++) {
+	    openFile[which]->Write(&data[chunk * SectorSize], SectorSize);
+	    openFile[which]->Flush();
+	}
+    for (which = 0; which < NumDefragFiles; which++)
+	delete openFile[which];
+    fileSystem->Sync();
+    synchDisk->Sync();
+
+    away = fileSystem->PrintFragmentation();
+    TimedReads("fragmented", data);
+    start = stats->totalTicks;
+    moved = fileSystem->DefragmentFiles();
+    printf("Defragmenting moved %d files, took %d ticks\n", moved,
+	   stats->totalTicks - start);
+    synchDisk->Sync();
+    if (fileSystem->PrintFragmentation() > away)
+	printf("Perf test: defragmenting moved files out of their group\n");
+    TimedReads("defragmented", data);
+
+    for (which = 0; which < NumDefragFiles; which++) {
+	sprintf(name, DefragFileName, which);
+	fileSystem->Remove(name);
+    }
+    if (!fileSystem->Rmdir("Defrag"))
+	printf("Perf test: unable to remove directory\n");
+    fileSystem->Remove(ScratchName);
+}
+
+//----------------------------------------------------------------------
+// ImportTest
+// 	Time copying a UNIX file of ImportSize bytes into Nachos with
+//	Copy, a few bytes at a time, and with Import, in bulk; then
+//	Export it back, and check that it is unchanged.  Last, import a
+//	UNIX directory holding two copies of it.
+//----------------------------------------------------------------------
+
+#define ImportSize	(128 * SectorSize)
+#define HostFileName	"perftest.in"
+#define HostCopyName	"perftest.out"
+#define HostDirName	"perftest.dir"
+
+static bool
+WriteHostFile(const char *name, const char *data)
+{
+    FILE *fp;
+
+    if ((fp = fopen(name, "w")) == NULL) {
+	printf("Perf test: can't create UNIX file %s\n", name);
+	return false;
+    }
+    fwrite(data, sizeof(char), ImportSize, fp);
+    fclose(fp);
+    return true;
+}
+
+static void
+ImportTest()
+{
+    char *data = new char[ImportSize], *buffer = new char[ImportSize];
+    char name[30];
+    OpenFile *openFile;
+    FILE *fp;
+    int which, start;
+
+    printf("Copy a %d byte UNIX file into Nachos, and back\n", ImportSize);
+    for (which = 0; which < ImportSize; which++)
+	data[which] = Contents[which % ContentSize];
+    if (!WriteHostFile(HostFileName, data)) {
+	delete [] data;
+	delete [] buffer;
+	return;
+    }
+
+    start = stats->totalTicks;
+    Copy(HostFileName, "Copied");
+    synchDisk->Sync();
+    printf("Copy took %d ticks\n", stats->totalTicks - start);
+    fileSystem->Remove("Copied");
+
+    start = stats->totalTicks;
+    Import(HostFileName, "Imported");
+    synchDisk->Sync();
+    printf("Import took %d ticks\n", stats->totalTicks - start);
+    Export("Imported", HostCopyName);
+    if ((fp = fopen(HostCopyName, "r")) == NULL
+	    || (int) fread(buffer, sizeof(char), ImportSize, fp) < ImportSize
+	    || memcmp(buffer, data, ImportSize))
+	printf("Perf test: unable to export Imported\n");
+    if (fp != NULL)
+	fclose(fp);
+    fileSystem->Remove("Imported");
+    Unlink(HostCopyName);
+
+    MakeDirectory(HostDirName);
+    for (which = 0; which < 2; which++) {
+	sprintf(name, HostDirName "/File%d", which);
+	WriteHostFile(name, data);
+    }
+    Import(HostDirName, "Imports");
+    for (which = 0; which < 2; which++) {
+	sprintf(name, "Imports/File%d", which);
+	if ((openFile = fileSystem->Open(name)) == NULL
+		|| openFile->Read(buffer, ImportSize) < ImportSize
+		|| memcmp(buffer, data, ImportSize))
+	    printf("Perf test: unable to import %s\n", name);
+	delete openFile;
+	fileSystem->Remove(name);
+	sprintf(name, HostDirName "/File%d", which);
+	Unlink(name);
+    }
+    if (!fileSystem->Rmdir("Imports"))
+	printf("Perf test: unable to remove directory\n");
+    RemoveDirectory(HostDirName);
+    Unlink(HostFileName);
+    delete [] data;
+    delete [] buffer;
+}
+
 void
 PerformanceTest()
 {
@@ -180,6 +1261,21 @@ PerformanceTest()
       printf("Perf test: unable to remove %s\n", FileName);
       return;
     }
+    ConcurrentRead();
+    SharedFileTest();
+    LayoutTest();
+    DirectoryTest();
+    MetadataTest();
+    OpenTest();
+    BulkTest();
+    SmallFileTest();
+    TinyFileTest();
+    GroupTest();
+    DefragTest();
+    ImportTest();
     stats->Print();
+    synchDisk->PrintStats();
+    journal->PrintStats();
+    fileSystem->PrintStats();
 }
 
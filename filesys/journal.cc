@@ -0,0 +1,595 @@
+// journal.cc
+//	Routines to keep a write-ahead log of the file system metadata.
+//
+//	A transaction is committed in two steps:
+//	   write its descriptor blocks, sector images and commit block to
+//	     the log, as one batch of consecutive sectors, and wait for
+//	     them; from now on the transaction survives a crash
+//	   write the images to their home sectors (which may well just
+//	     leave them in the disk cache)
+//
+//	Writing the commit block along with the rest saves the disk a
+//	rotation per commit; the checksum in it tells replay whether
+//	the rest made it to the disk too.
+//
+//	The log is not circular: transactions are appended until the
+//	next one does not fit, and then the log is emptied, by writing
+//	back the whole disk cache (so that every image logged is home)
+//	and then advancing the sequence number in the superblock.
+//
+//	Replay needs two passes over the log: one to find out which
+//	sectors were revoked, and when, and one to write the images that
+//	were logged after the last revoke of their sector.  Replaying a
+//	transaction twice does no harm, so there is no need to record
+//	which transactions are already home.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "journal.h"
+#include "system.h"
+
+int LogSectors = MinLogSectors;
+
+#define SuperMagic	0x4c4f4753	// "LOGS"
+#define DescriptorMagic	0x4c4f4744	// "LOGD"
+#define CommitMagic	0x4c4f4743	// "LOGC"
+
+//----------------------------------------------------------------------
+// JournalCommitter
+// 	Body of the committer thread, a C routine for Thread::Fork.
+//----------------------------------------------------------------------
+
+static void
+JournalCommitter(void *arg)
+{
+    ((Journal *) arg)->CommitClosed();
+}
+
+//----------------------------------------------------------------------
+// AddToChecksum
+// 	Return the checksum of the log sectors before "sector", "sum",
+//	updated to cover "sector" too.
+//----------------------------------------------------------------------
+
+static int
+AddToChecksum(int sum, const char *sector)
+{
+    const unsigned *word = (const unsigned *) sector;
+    unsigned result = (unsigned) sum;
+
+    for (unsigned i = 0; i < SectorSize / sizeof(unsigned); i++)
+	result = ((result << 1) | (result >> 31)) ^ word[i];
+    return (int) result;
+}
+
+//----------------------------------------------------------------------
+// Transaction::Transaction
+// 	Initialize an empty transaction.  Room for its images is bounded
+//	by the size of the log; a sector is revoked at most once.
+//----------------------------------------------------------------------
+
+Transaction::Transaction()
+{
+    numImages = numRevoked = 0;
+    homes = new int[LogSectors];
+    images = new char[LogSectors * SectorSize];
+    revoked = new int[NumSectors];
+}
+
+Transaction::~Transaction()
+{
+    delete [] homes;
+    delete [] images;
+    delete [] revoked;
+}
+
+//----------------------------------------------------------------------
+// Transaction::FindImage
+// 	Return where in the transaction the image of "sector" is, or -1
+//	if it has none.
+//----------------------------------------------------------------------
+
+int
+Transaction::FindImage(int sector)
+{
+    for (int i = 0; i < numImages; i++)
+	if (homes[i] == sector)
+	    return i;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Transaction::Revokes
+// 	Return true if the transaction revokes "sector".
+//----------------------------------------------------------------------
+
+bool
+Transaction::Revokes(int sector)
+{
+    for (int i = 0; i < numRevoked; i++)
+	if (revoked[i] == sector)
+	    return true;
+    return false;
+}
+
+//----------------------------------------------------------------------
+// Transaction::LogSize
+// 	Return the number of log sectors the transaction takes: its
+//	descriptors, its images, and the commit block.
+//----------------------------------------------------------------------
+
+int
+Transaction::LogSize()
+{
+    return divRoundUp(numImages + numRevoked, DescriptorEntries)
+	+ numImages + 1;
+}
+
+//----------------------------------------------------------------------
+// Journal::Journal
+// 	Initialize the journal.  If "format", the log area is new: write
+//	an empty log to it.  Otherwise, replay the transactions committed
+//	to it, bringing the metadata on disk up to date after a crash.
+//	Also start the committer thread.
+//
+//	The size of the log follows from the geometry of the disk, which
+//	is known by now (from -geom, or from the disk label).  The half
+//	kept in reserve (cf. IsFull) must take one more operation, and
+//	that may log the whole bitmap file -- a bit per sector, plus the
+//	layout word (cf. FreeMapFileSize) -- along with a few headers
+//	and directory buckets.  Small disks keep a log of MinLogSectors.
+//----------------------------------------------------------------------
+
+Journal::Journal(bool format)
+{
+    int bitmapSectors = divRoundUp(divRoundUp(NumSectors, BitsInWord)
+				   * sizeof(unsigned) + sizeof(int),
+				   SectorSize);
+
+    LogSectors = 2 * bitmapSectors + MinLogSectors / 2;
+    if (LogSectors < MinLogSectors)
+	LogSectors = MinLogSectors;
+    DEBUG('f', "Log of %d sectors.\n", LogSectors);
+
+    lock = new Lock("journal");
+    running = new Transaction;
+    closed = new Transaction;
+    committing = false;
+    committed = new Condition("journal committed", lock);
+    commitNeeded = new Semaphore("journal commit needed", 0);
+    logged = new BitMap(NumSectors);
+    sequence = 1;
+    head = 1;
+    commits = checkpoints = sectorsLogged = sectorsWritten = 0;
+
+    if (format)
+	WriteSuperblock();
+    else
+	Replay();
+
+    Thread *committer = new Thread("journal committer");
+    committer->Fork(JournalCommitter, this);
+}
+
+//----------------------------------------------------------------------
+// Journal::~Journal
+// 	De-allocate the journal.  Whatever was not committed is lost.
+//----------------------------------------------------------------------
+
+Journal::~Journal()
+{
+    delete running;
+    delete closed;
+    delete committed;
+    delete commitNeeded;
+    delete lock;
+    delete logged;
+}
+
+//----------------------------------------------------------------------
+// Journal::Write
+// 	Record "data" as the new contents of metadata sector "sector",
+//	in the running transaction.  A sector written several times
+//	before the transaction is closed is logged only once.
+//----------------------------------------------------------------------
+
+void
+Journal::Write(int sector, const char *data)
+{
+    int i, which;
+
+    lock->Acquire();
+    for (i = 0; i < running->numRevoked; i++)	// freed, and in use again
+	if (running->revoked[i] == sector) {
+	    running->revoked[i] = running->revoked[--running->numRevoked];
+	    logged->Mark(sector);	// its old images are still logged
+	    break;
+	}
+    if ((which = running->FindImage(sector)) == -1) {
+	which = running->numImages++;
+	running->homes[which] = sector;
+	ASSERT(running->LogSize() < LogSectors);
+    }
+    bcopy(data, &running->images[which * SectorSize], SectorSize);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Read
+// 	If the running transaction, or the one being committed, has new
+//	contents for "sector", copy them into "data" and return true.
+//	Otherwise, the sector is up to date at home, and the caller must
+//	read it from there.
+//----------------------------------------------------------------------
+
+bool
+Journal::Read(int sector, char *data)
+{
+    int which;
+    bool found = true;
+
+    lock->Acquire();
+    if ((which = running->FindImage(sector)) != -1)
+	bcopy(&running->images[which * SectorSize], data, SectorSize);
+    else if (committing && (which = closed->FindImage(sector)) != -1)
+	bcopy(&closed->images[which * SectorSize], data, SectorSize);
+    else
+	found = false;
+    lock->Release();
+    return found;
+}
+
+//----------------------------------------------------------------------
+// Journal::Forget
+// 	Called when a sector is freed.  Drop its image from the running
+//	transaction, if any; and if it was logged by a transaction that
+//	may still be replayed, revoke it, since it may be given to a file
+//	and hold data that the old image must not overwrite.  The revoke
+//	also keeps the transaction being committed, if any, from writing
+//	its image home (cf. Commit).
+//----------------------------------------------------------------------
+
+void
+Journal::Forget(int sector)
+{
+    int which, last;
+
+    lock->Acquire();
+    if ((which = running->FindImage(sector)) != -1) {
+	last = --running->numImages;
+	running->homes[which] = running->homes[last];
+	bcopy(&running->images[last * SectorSize],
+	      &running->images[which * SectorSize], SectorSize);
+    }
+    if (logged->Test(sector)) {
+	logged->Clear(sector);
+	running->revoked[running->numRevoked++] = sector;
+	ASSERT(running->LogSize() < LogSectors);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::IsFull
+// 	Return true if the running transaction is big enough that it
+//	should be committed as soon as the operations under way are
+//	done.  Half the log is kept in reserve for them, and for the
+//	changes made while the transaction before is being committed.
+//----------------------------------------------------------------------
+
+bool
+Journal::IsFull()
+{
+    return running->numImages + running->numRevoked >= LogSectors / 2;
+}
+
+//----------------------------------------------------------------------
+// Journal::Close
+// 	End the running transaction, hand it to the committer thread, and
+//	start a new one.  The caller must make sure the transaction holds
+//	whole operations only.
+//
+//	If the transaction before is still being committed, wait for it
+//	first, if "wait" (this is what holds back threads that make
+//	changes faster than the disk can log them); otherwise, leave the
+//	running transaction open, and return false.
+//----------------------------------------------------------------------
+
+bool
+Journal::Close(bool wait)
+{
+    Transaction *empty;
+
+    lock->Acquire();
+    if (committing && !wait) {
+	lock->Release();
+	return false;
+    }
+    while (committing)
+	committed->Wait();
+    if (!running->IsEmpty()) {
+	empty = closed;
+	closed = running;
+	running = empty;
+	committing = true;
+	for (int i = 0; i < closed->numImages; i++)
+	    logged->Mark(closed->homes[i]);	// from now on, revoke them
+	commitNeeded->V();
+    }
+    lock->Release();
+    return true;
+}
+
+//----------------------------------------------------------------------
+// Journal::Sync
+// 	Wait until the transaction closed last, if any, is committed.
+//----------------------------------------------------------------------
+
+void
+Journal::Sync()
+{
+    lock->Acquire();
+    while (committing)
+	committed->Wait();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::CommitClosed
+// 	Body of the committer thread: commit each transaction closed.
+//----------------------------------------------------------------------
+
+void
+Journal::CommitClosed()
+{
+    for (;;) {
+	commitNeeded->P();
+	Commit();
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+// 	Commit the closed transaction.  The lock is not held while the
+//	disk is busy, so that threads can go on adding to the running
+//	transaction.
+//----------------------------------------------------------------------
+
+void
+Journal::Commit()
+{
+    int numEntries, size, entry, sum, i;
+    LogBlock *block;
+    char *buffer;
+    int *sectors;
+
+    ASSERT(committing);
+    numEntries = closed->numImages + closed->numRevoked;
+    size = closed->LogSize();
+    if (head + size > LogSectors)
+	Checkpoint();
+    DEBUG('f', "Committing transaction %d: %d images, %d revoked\n",
+	  sequence, closed->numImages, closed->numRevoked);
+
+    // lay out the descriptors and images, and then the commit block
+    buffer = new char[size * SectorSize];
+    sectors = new int[size];
+    bzero(buffer, size * SectorSize);
+    for (i = 0; i < size; i++)
+	sectors[i] = LogSector + head + i;
+    entry = 0;
+    for (i = 0; i < size - 1; ) {
+	block = (LogBlock *) &buffer[i++ * SectorSize];
+	block->magic = DescriptorMagic;
+	block->sequence = sequence;
+	for (block->count = 0; block->count < DescriptorEntries
+		&& entry < numEntries; block->count++, entry++)
+	    if (entry < closed->numImages) {
+		block->entries[block->count] = closed->homes[entry];
+		bcopy(&closed->images[entry * SectorSize],
+		      &buffer[i++ * SectorSize], SectorSize);
+	    } else
+		block->entries[block->count] =
+		    -1 - closed->revoked[entry - closed->numImages];
+    }
+    block = (LogBlock *) &buffer[(size - 1) * SectorSize];
+    block->magic = CommitMagic;
+    block->sequence = sequence;
+    for (sum = 0, i = 0; i < size - 1; i++)
+	sum = AddToChecksum(sum, &buffer[i * SectorSize]);
+    block->checksum = sum;
+
+    synchDisk->WriteThrough(size, sectors, buffer);
+
+    // the transaction is safe: now write the images home -- except those
+    // of sectors freed since it was closed (Forget revoked them in the
+    // running transaction), which may hold file data by now
+    lock->Acquire();
+    for (i = entry = 0; i < closed->numImages; i++)
+	if (!running->Revokes(closed->homes[i])) {
+	    closed->homes[entry] = closed->homes[i];
+	    bcopy(&closed->images[i * SectorSize],
+		  &closed->images[entry++ * SectorSize], SectorSize);
+	}
+    closed->numImages = entry;
+    DiskHandle *handle = synchDisk->Submit(closed->numImages, closed->homes,
+					   closed->images, true);
+    lock->Release();
+    handle->Wait();
+    delete handle;
+    delete [] sectors;
+    delete [] buffer;
+
+    commits++;
+    sectorsLogged += size;
+    sectorsWritten += closed->numImages;
+    head += size;
+    sequence++;
+
+    lock->Acquire();
+    closed->numImages = closed->numRevoked = 0;
+    committing = false;
+    committed->Broadcast();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::Checkpoint
+// 	Empty the log: make sure every image logged so far is at home on
+//	disk, and then move the start of the log past it.  Called without
+//	holding the lock, at mount time or from Commit.
+//----------------------------------------------------------------------
+
+void
+Journal::Checkpoint()
+{
+    DEBUG('f', "Emptying the log before transaction %d\n", sequence);
+    synchDisk->Sync();
+    WriteSuperblock();
+    head = 1;
+    checkpoints++;
+
+    // the old images will not be replayed, but those of the transaction
+    // being committed will
+    lock->Acquire();
+    delete logged;
+    logged = new BitMap(NumSectors);
+    for (int i = 0; i < closed->numImages; i++)
+	logged->Mark(closed->homes[i]);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteSuperblock
+// 	Write the superblock, saying that replay starts at the running
+//	transaction.
+//----------------------------------------------------------------------
+
+void
+Journal::WriteSuperblock()
+{
+    LogBlock block;
+    int sector = LogSector;
+
+    bzero((char *) &block, sizeof(block));
+    block.magic = SuperMagic;
+    block.sequence = sequence;
+    synchDisk->WriteThrough(1, &sector, (char *) &block);
+}
+
+//----------------------------------------------------------------------
+// Journal::Replay
+// 	Replay the transactions committed to the log since it was last
+//	emptied, and then empty it.
+//----------------------------------------------------------------------
+
+void
+Journal::Replay()
+{
+    LogBlock block;
+    int *revokedAt = new int[NumSectors];
+    int first, position, next, i;
+
+    synchDisk->ReadSector(LogSector, (char *) &block);
+    if (block.magic != SuperMagic) {
+	printf("No journal on disk: please format it (-f)\n");
+	delete [] revokedAt;
+	return;
+    }
+    first = sequence = block.sequence;
+    for (i = 0; i < NumSectors; i++)
+	revokedAt[i] = 0;
+
+    for (position = 1; (next = Scan(position, revokedAt, false)) != -1; )
+	position = next;		// find the revoked sectors
+    sequence = first;
+    for (position = 1; (next = Scan(position, revokedAt, true)) != -1; )
+	position = next;		// replay the rest
+
+    DEBUG('f', "Replayed transactions %d to %d\n", first, sequence - 1);
+    if (sequence > first)
+	Checkpoint();
+    delete [] revokedAt;
+}
+
+//----------------------------------------------------------------------
+// Journal::Scan
+// 	Read transaction number "sequence", starting at "position" in the
+//	log.  If it is not all there (or is not there at all, or its
+//	checksum does not match), return -1.
+//	Otherwise, note in "revokedAt" the sectors it revokes, or if
+//	"replay", write home its images of sectors not revoked later;
+//	then return where the next transaction starts, and advance
+//	"sequence".
+//----------------------------------------------------------------------
+
+int
+Journal::Scan(int position, int *revokedAt, bool replay)
+{
+    LogBlock block;
+    char data[SectorSize];
+    int start = position, sum = 0, i, home;
+
+    // first make sure the transaction was committed, all of it
+    for (;;) {
+	if (position >= LogSectors)
+	    return -1;
+	synchDisk->ReadSector(LogSector + position++, (char *) &block);
+	if (block.sequence != sequence)
+	    return -1;
+	if (block.magic == CommitMagic)
+	    break;
+	if (block.magic != DescriptorMagic || block.count < 0
+		|| block.count > DescriptorEntries)
+	    return -1;
+	sum = AddToChecksum(sum, (char *) &block);
+	for (i = 0; i < block.count; i++)
+	    if (block.entries[i] >= 0) {	// revokes take no log space
+		if (position >= LogSectors)
+		    return -1;
+		synchDisk->ReadSector(LogSector + position++, data);
+		sum = AddToChecksum(sum, data);
+	    }
+    }
+    if (block.checksum != sum)
+	return -1;
+
+    // then go through it
+    for (position = start; ; ) {
+	synchDisk->ReadSector(LogSector + position++, (char *) &block);
+	if (block.magic == CommitMagic)
+	    break;
+	for (i = 0; i < block.count; i++) {
+	    home = block.entries[i];
+	    if (home < 0) {
+		if (!replay)
+		    revokedAt[-1 - home] = sequence;
+		continue;
+	    }
+	    if (replay && revokedAt[home] < sequence) {
+		synchDisk->ReadSector(LogSector + position, data);
+		synchDisk->WriteSector(home, data);
+	    }
+	    position++;
+	}
+    }
+    sequence++;
+    return position;
+}
+
+//----------------------------------------------------------------------
+// Journal::PrintStats
+// 	Print how many transactions were committed, and how many sectors
+//	they took in the log and at home.
+//----------------------------------------------------------------------
+
+void
+Journal::PrintStats()
+{
+    printf("Journal: %d commits, %d sectors logged, %d written home, "
+	   "%d checkpoints\n", commits, sectorsLogged, sectorsWritten,
+	   checkpoints);
+}
@@ -0,0 +1,149 @@
+// journal.h
+//	Data structures for a write-ahead log of file system metadata.
+//
+//	Every change to a file header, to the bitmap of free sectors, or
+//	to a directory is recorded in the journal as the new contents of
+//	the sectors it touches.  Changes are gathered in a transaction,
+//	which is committed -- written to the log area on disk, and only
+//	then to the sectors' home locations -- once enough of them have
+//	piled up, or every FlushInterval ticks.  After a crash, the
+//	committed transactions are replayed at mount time, so the
+//	metadata on disk is always as it was after some whole number of
+//	transactions.
+//
+//	Committing is done in two steps: Close ends the running
+//	transaction, at a point where it holds whole operations only,
+//	and starts a new one; a committer thread then writes the closed
+//	transaction to disk, while the next one is being gathered.
+//
+//	File data is not journaled.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "disk.h"
+#include "bitmap.h"
+#include "synch.h"
+
+#define LogSector	2		// first sector of the log area
+#define MinLogSectors	128		// sectors in the log area, at least
+
+extern int LogSectors;			// sectors in the log area, sized
+					// from the geometry of the disk
+					// (cf. Journal::Journal)
+
+// The log area starts with a superblock, giving the sequence number of
+// the first transaction still to be replayed.  Transactions follow it,
+// one after the other.  Each is one or more descriptor blocks, each
+// followed by the sector images it lists, and then a commit block:
+//
+//	descriptor: magic, sequence, count, entries[DescriptorEntries]
+//	commit:	    magic, sequence, checksum
+//
+// The checksum covers every sector of the transaction before the
+// commit block, so the whole transaction can be written at once: if
+// the disk stops part way, the checksum does not match, and the
+// transaction is ignored.
+//
+// An entry is either the home sector of the image that follows, or
+// -1 - sector to "revoke" a sector: the sector was freed, and may
+// now hold file data, so images of it logged before must not be
+// replayed.
+
+#define DescriptorEntries	((int)(SectorSize / sizeof(int)) - 4)
+
+class LogBlock {
+  public:
+    int magic;				// Kind of block
+    int sequence;			// Transaction it belongs to
+    int count;				// Entries used (descriptors only)
+    int checksum;			// Of the transaction (commits only)
+    int entries[DescriptorEntries];	// Home sector, or -1 - revoked
+};
+
+// The following class defines a transaction in memory: the latest
+// images of the sectors it changed, and the sectors it revoked.
+
+class Transaction {
+  public:
+    Transaction();			// An empty transaction
+    ~Transaction();
+
+    int FindImage(int sector);		// Index of a sector's image, or -1
+    bool Revokes(int sector);		// Is the sector revoked by it?
+    int LogSize();			// Log sectors it takes
+    bool IsEmpty() { return numImages + numRevoked == 0; }
+
+    int numImages;			// Sector images in the transaction
+    int *homes;				// ... their home sectors
+    char *images;			// ... and their contents
+    int numRevoked;			// Sectors revoked by it
+    int *revoked;
+};
+
+// The following class defines the journal.  There is one, shared by
+// all threads.  Metadata sectors are written with Write instead of
+// SynchDisk::WriteSector, and read with Read before falling back to
+// SynchDisk::ReadSector, since their latest contents may not be home
+// yet.
+//
+// Only one transaction is committed at a time.  A thread that closes
+// one while the one before is still being committed waits for it.
+
+class Journal {
+  public:
+    Journal(bool format);		// Initialize the log area, if
+					// "format", or else replay it
+    ~Journal();
+
+    void Write(int sector, const char *data);
+					// Record new contents for a
+					// metadata sector
+    bool Read(int sector, char *data);	// Get the contents not yet written
+					// home, if any
+    void Forget(int sector);		// The sector was freed
+
+    bool IsFull();			// Time to commit?
+    bool Close(bool wait);		// End the running transaction, have
+					// it committed, and start a new one
+    void Sync();			// Wait until every transaction
+					// closed so far is committed
+
+    void CommitClosed();		// Body of the committer thread
+
+    void PrintStats();			// Print how much was logged
+
+  private:
+    Lock *lock;				// Protects the transactions and
+					// "logged"
+    Transaction *running;		// Transaction gathering changes
+    Transaction *closed;		// Transaction being committed
+    bool committing;			// Is "closed" being committed?
+    Condition *committed;		// Signalled when it is done
+    Semaphore *commitNeeded;		// Wakes up the committer thread
+    BitMap *logged;			// Sectors logged since the log was
+					// last emptied
+
+    int sequence;			// Number of the next transaction
+					// to commit
+    int head;				// Where in the log it is to go
+
+    int commits, checkpoints;		// Statistics
+    int sectorsLogged, sectorsWritten;
+
+    void Commit();			// Write the closed transaction to
+					// the log, and then home
+    void Checkpoint();			// Empty the log
+    void WriteSuperblock();
+    void Replay();			// Replay the log, at mount time
+    int Scan(int position, int *revokedAt, bool replay);
+					// Read (and replay) a transaction
+};
+
+#endif // JOURNAL_H
@@ -5,7 +5,8 @@
 //	the OpenFile data structure).
 //
 //	Also as in UNIX, for convenience, we keep the file header in
-//	memory while the file is open.
+//	memory while the file is open, in an i-node shared by all the
+//	OpenFiles of the file.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -15,30 +16,183 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "system.h"
+#include "synch.h"
+
+// Read-ahead window, in sectors.  It starts at MinReadAhead on the first
+// sequential Read and doubles each time the reader catches up with it.
+#define MinReadAhead	2
+#define MaxReadAhead	16
+
+// States of an i-node's header.
+enum { NotFetched, Fetching, Fetched };
+
+// Bytes appended to a file are buffered until there are TailSize of
+// them (or the file is closed), and only then given disk space, all
+// at once.  Small appends so end up in long runs of sectors.
+#define TailSize	(16 * SectorSize)
+
+// Whole sectors a read can list on the stack; longer reads allocate.
+#define ListedSectors	32
 
 //----------------------------------------------------------------------
-// OpenFile::OpenFile
-// 	Open a Nachos file for reading and writing.  Bring the file header
-//	into memory while the file is open.
+// RangeLock::RangeLock
+// 	Initialize the lock on a file's sectors, with nothing locked.
+//----------------------------------------------------------------------
+
+RangeLock::RangeLock()
+{
+    requests = NULL;
+    waiting = new List<Thread *>;
+}
+
+RangeLock::~RangeLock()
+{
+    ASSERT(requests == NULL);
+    delete waiting;
+}
+
+//----------------------------------------------------------------------
+// RangeLock::Acquire
+// 	Queue a request for sectors "first" to "last" of the file, and
+//	wait until no earlier request conflicts with it.  Return it, to
+//	be handed back to Release.
 //
-//	"sector" -- the location on disk of the file header for this file
+//	"exclusive" -- is the caller going to change the sectors?
 //----------------------------------------------------------------------
 
-OpenFile::OpenFile(int sector)
-{ 
+LockedRange *
+RangeLock::Acquire(int first, int last, bool exclusive)
+{
+    LockedRange *range = new LockedRange, **end, *earlier;
+    IntStatus oldLevel;
+
+    range->first = first;
+    range->last = last;
+    range->exclusive = exclusive;
+    range->owner = this;
+    range->next = NULL;
+
+    oldLevel = interrupt->SetLevel(IntOff);
+    for (end = &requests; *end != NULL; end = &(*end)->next)
+	;
+    *end = range;
+    for (earlier = requests; earlier != range; )
+	if ((exclusive || earlier->exclusive)
+		&& earlier->first <= last && first <= earlier->last) {
+	    waiting->Append(currentThread);
+	    currentThread->Sleep();
+	    earlier = requests;			// start over
+	} else
+	    earlier = earlier->next;
+    interrupt->SetLevel(oldLevel);
+    return range;
+}
+
+//----------------------------------------------------------------------
+// RangeLock::Release
+// 	Unlock a range returned by Acquire, and let the requests waiting
+//	for it check again.
+//----------------------------------------------------------------------
+
+void
+RangeLock::Release(LockedRange *range)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    LockedRange **prev;
+    Thread *thread;
+
+    for (prev = &requests; *prev != range; prev = &(*prev)->next)
+	ASSERT(*prev != NULL);
+    *prev = range->next;
+    while ((thread = waiting->Remove()) != NULL)
+	scheduler->ReadyToRun(thread);
+    interrupt->SetLevel(oldLevel);
+    delete range;
+}
+
+//----------------------------------------------------------------------
+// Inode::Inode
+// 	Initialize the in-memory i-node of a file, which keeps its header
+//	in memory for as long as the file is open.  The header is read
+//	in by Fetch.
+//
+//	"hdrSector" -- the location on disk of the file header for this file
+//----------------------------------------------------------------------
+
+Inode::Inode(int hdrSector)
+{
+    sector = hdrSector;
     hdr = new FileHeader;
+    state = NotFetched;
+    fetched = new Semaphore("inode fetched", 0);
+    refCount = 0;
+    removed = false;
+    journaled = false;
+    tail = NULL;
+    tailLength = 0;
+    tailSectors = 0;
+    lock = new RangeLock;
+}
+
+Inode::~Inode()
+{
+    delete lock;
+    delete [] tail;
+    delete fetched;
+    delete hdr;
+}
+
+//----------------------------------------------------------------------
+// Inode::Fetch
+// 	Read in the file header, unless it already is.  If another thread
+//	is reading it, wait until it is done (and let the next waiter go).
+//----------------------------------------------------------------------
+
+void
+Inode::Fetch()
+{
+    if (state == Fetched)
+	return;
+    if (state == Fetching) {
+	fetched->P();
+	fetched->V();
+	return;
+    }
+    state = Fetching;
     hdr->FetchFrom(sector);
+    state = Fetched;
+    fetched->V();
+}
+
+//----------------------------------------------------------------------
+// OpenFile::OpenFile
+// 	Open a Nachos file for reading and writing.  The caller has
+//	already accounted for us in the file's i-node, and read in the
+//	header.
+//
+//	"fileInode" -- the in-memory i-node of the file
+//----------------------------------------------------------------------
+
+OpenFile::OpenFile(Inode *fileInode)
+{ 
+    inode = fileInode;
+    hdr = inode->hdr;
     seekPosition = 0;
+    readEnd = 0;
+    raWindow = raLimit = 0;
 }
 
 //----------------------------------------------------------------------
 // OpenFile::~OpenFile
 // 	Close a Nachos file, de-allocating any in-memory data structures.
+//	Bytes still buffered at the end of the file are written out first;
+//	the disk space they need was reserved when they were written.
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile()
 {
-    delete hdr;
+    ASSERT(Flush());
+    fileSystem->CloseInode(inode);
 }
 
 //----------------------------------------------------------------------
@@ -71,8 +225,11 @@ OpenFile::Seek(int position)
 int
 OpenFile::Read(char *into, int numBytes)
 {
+   bool sequential = (seekPosition == readEnd);
    int result = ReadAt(into, numBytes, seekPosition);
    seekPosition += result;
+   readEnd = seekPosition;
+   ReadAhead(sequential);
    return result;
 }
 
@@ -90,18 +247,24 @@ OpenFile::Write(const char *into, int numBytes)
 //	Return the number of bytes actually written or read, but has
 //	no side effects (except that Write modifies the file, of course).
 //
-//	There is no guarantee the request starts or ends on an even disk sector
-//	boundary; however the disk only knows how to read/write a whole disk
-//	sector at a time.  Thus:
+//	The file has two parts: the bytes that have been given disk space
+//	(hdr->FileLength() of them), and the bytes appended since, which
+//	are still held in the i-node's "tail".  Reads and writes past the
+//	end of the first part go to the buffer; writing past the end of
+//	the file (but not beyond it -- files have no holes) appends to
+//	it.  When the buffer fills up, it is flushed to disk; an append
+//	of a whole buffer's worth, when the buffer is empty, goes to disk
+//	straight from the caller's buffer instead.
 //
-//	For ReadAt:
-//	   We read in all of the full or partial sectors that are part of the
-//	   request, but we only copy the part we are interested in.
-//	For WriteAt:
-//	   We must first read in any sectors that will be partially written,
-//	   so that we don't overwrite the unmodified portion.  We then copy
-//	   in the data that will be modified, and write back all the full
-//	   or partial sectors that are part of the request.
+//	Bytes are taken into the buffer only once the disk space they
+//	will need is reserved (cf. ReserveTail), so that flushing them
+//	cannot fail.  A write that needs more space than the disk has
+//	left stops short, and returns how much of the data it took.
+//
+//	A read locks the sectors it covers, shared; a write locks them
+//	exclusive, or the whole file, if it reaches the tail.  Sectors,
+//	rather than bytes, since writes to the same sector would undo
+//	each other.
 //
 //	"into" -- the buffer to contain the data to be read from disk 
 //	"from" -- the buffer containing the data to be written to disk 
@@ -113,73 +276,538 @@ OpenFile::Write(const char *into, int numBytes)
 int
 OpenFile::ReadAt(char *into, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    char *buf;
+    int fileLength, length, onDisk = 0;
+    LockedRange *range;
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if (numBytes <= 0)
+	return 0;
+    range = inode->lock->Acquire(divRoundDown(position, SectorSize),
+		divRoundDown(position + numBytes - 1, SectorSize), false);
+    fileLength = hdr->FileLength();
+    length = Length();
+    if (position >= length) {
+	inode->lock->Release(range);
     	return 0; 				// check request
-    if ((position + numBytes) > fileLength)		
-	numBytes = fileLength - position;
+    }
+    if ((position + numBytes) > length)		
+	numBytes = length - position;
     DEBUG('f', "Reading %d bytes at %d, from file of length %d.\n", 	
-			numBytes, position, fileLength);
+			numBytes, position, length);
 
-    firstSector = divRoundDown(position, SectorSize);
-    lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
-
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)	
-        synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize), 
-					&buf[(i - firstSector) * SectorSize]);
-
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete [] buf;
+    if (position < fileLength) {
+	onDisk = (position + numBytes > fileLength) ? fileLength - position
+						    : numBytes;
+	ReadDisk(into, onDisk, position);
+    }
+    if (onDisk < numBytes)
+	bcopy(&inode->tail[position + onDisk - fileLength], &into[onDisk],
+	      numBytes - onDisk);
+    inode->lock->Release(range);
     return numBytes;
 }
 
 int
 OpenFile::WriteAt(const char *from, int numBytes, int position)
 {
-    int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char *buf;
+    int fileLength, done = 0, offset, count;
+    LockedRange *range;
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if (numBytes <= 0)
+	return 0;
+    range = inode->lock->Acquire(divRoundDown(position, SectorSize),
+		divRoundDown(position + numBytes - 1, SectorSize), true);
+    if (position + numBytes > hdr->FileLength()) {
+	inode->lock->Release(range);		// the tail changes
+	range = inode->lock->Acquire(0, EndOfFile, true);
+    }
+    fileLength = hdr->FileLength();
+    if (position > Length()) {
+	inode->lock->Release(range);
 	return 0;				// check request
-    if ((position + numBytes) > fileLength)
-	numBytes = fileLength - position;
-    DEBUG('f', "Writing %d bytes at %d, from file of length %d.\n", 	
-			numBytes, position, fileLength);
+    }
+    DEBUG('f', "Writing %d bytes at %d, to file of length %d.\n", 	
+			numBytes, position, Length());
+
+    if (position < fileLength) {
+	done = (position + numBytes > fileLength) ? fileLength - position
+						  : numBytes;
+	WriteDisk(from, done, position);
+	if (hdr->IsInline())			// the data is in the header
+	    hdr->WriteBack(inode->sector);
+    }
+    while (done < numBytes) {			// the rest goes in the tail
+	offset = position + done - hdr->FileLength();
+	if (offset == 0 && inode->tailLength == 0
+		&& numBytes - done >= TailSize) {
+	    if (!Append(&from[done], TailSize))
+		break;				// disk full
+	    done += TailSize;
+	    continue;
+	}
+	if (inode->tail == NULL)
+	    inode->tail = new char[TailSize];
+	if (offset == TailSize) {
+	    if (!WriteTail())
+		break;				// disk full
+	    continue;
+	}
+	count = TailSize - offset;
+	if (count > numBytes - done)
+	    count = numBytes - done;
+	if (!ReserveTail(offset + count))
+	    break;				// disk full
+	bcopy(&from[done], &inode->tail[offset], count);
+	if (offset + count > inode->tailLength)
+	    inode->tailLength = offset + count;
+	done += count;
+    }
+    inode->lock->Release(range);
+    return done;
+}
+
+//----------------------------------------------------------------------
+// SplitRequest
+// 	Work out which sectors of the file a request covers entirely,
+//	and which it covers only in part, at either end.  Only the latter
+//	need to be staged in a buffer of our own.
+//
+//	Return how many partial sectors there are (0, 1 or 2), and list
+//	them in "edges"; set "*first" and "*last" to the first and last
+//	sectors covered entirely (*first > *last if there are none).
+//	All are sector numbers within the file.
+//----------------------------------------------------------------------
+
+static int
+SplitRequest(int numBytes, int position, int *first, int *last, int *edges)
+{
+    int firstSector = divRoundDown(position, SectorSize);
+    int lastSector = divRoundDown(position + numBytes - 1, SectorSize);
+    int numEdges = 0;
+
+    *first = divRoundUp(position, SectorSize);
+    *last = divRoundDown(position + numBytes, SectorSize) - 1;
+    if (firstSector < *first)
+	edges[numEdges++] = firstSector;
+    if (lastSector > *last && (numEdges == 0 || lastSector != firstSector))
+	edges[numEdges++] = lastSector;
+    return numEdges;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadDisk/WriteDisk
+// 	Read/write a portion of the file that has been given disk space.
+//
+//	There is no guarantee the request starts or ends on an even disk sector
+//	boundary; however the disk only knows how to read/write a whole disk
+//	sector at a time.  Sectors the request covers entirely are moved
+//	straight between the caller's buffer and the disk (or the disk
+//	cache); only the partial sectors at either end are staged.  Thus:
+//
+//	For ReadDisk:
+//	   We read the whole sectors into the caller's buffer, and the
+//	   partial ones into ours, copying only the part we are
+//	   interested in.  The sectors are submitted to the disk before
+//	   we wait for any, so they can be read in the order that suits
+//	   the disk.
+//	For WriteDisk:
+//	   We must first read in any sectors that will be partially written,
+//	   so that we don't overwrite the unmodified portion.  We then copy
+//	   in the data that will be modified, and write back all the full
+//	   or partial sectors that are part of the request.
+//
+//	The sectors of metadata files are written to the journal instead,
+//	and read from it when it has contents not yet written home.
+//
+//	A file small enough to have its data in the header (cf.
+//	FileHeader::IsInline) needs no disk access at all: the caller
+//	writes the header back.
+//
+//	"position" + "numBytes" must not be beyond hdr->FileLength() (for
+//	ReadDisk, beyond the end of the file's last sector).
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadDisk(char *into, int numBytes, int position)
+{
+    int first, last, numEdges, numWhole, i, start, end;
+    int edges[2], edgeSectors[2], wholeSectors[ListedSectors];
+    int *sectors = wholeSectors;
+    char staged[2 * SectorSize];
+    char *whole;
+    DiskHandle *handle = NULL, *edgeHandle = NULL;
+
+    if (hdr->IsInline()) {
+	ASSERT(position + numBytes <= hdr->FileLength());
+	bcopy(&hdr->InlineData()[position], into, numBytes);
+	return;
+    }
+    ASSERT(position + numBytes
+	   <= divRoundUp(hdr->FileLength(), SectorSize) * SectorSize);
+    numEdges = SplitRequest(numBytes, position, &first, &last, edges);
+    numWhole = last - first + 1;
+    whole = &into[first * SectorSize - position];
+
+    // start reading the whole sectors, and then the partial ones
+    if (numWhole > 0) {
+	if (numWhole > ListedSectors)
+	    sectors = new int[numWhole];
+	for (i = 0; i < numWhole; i++)
+	    sectors[i] = hdr->ByteToSector((first + i) * SectorSize);
+	handle = synchDisk->Submit(numWhole, sectors, whole, false);
+    }
+    for (i = 0; i < numEdges; i++)
+	edgeSectors[i] = hdr->ByteToSector(edges[i] * SectorSize);
+    if (numEdges > 0)
+	edgeHandle = synchDisk->Submit(numEdges, edgeSectors, staged, false);
+
+    if (handle != NULL) {
+	handle->Wait();
+	delete handle;
+	if (inode->journaled)
+	    for (i = 0; i < numWhole; i++)
+		journal->Read(sectors[i], &whole[i * SectorSize]);
+    }
+    if (sectors != wholeSectors)
+	delete [] sectors;
+    if (edgeHandle != NULL) {
+	edgeHandle->Wait();
+	delete edgeHandle;
+    }
+
+    // copy the part we want of the partial sectors
+    for (i = 0; i < numEdges; i++) {
+	if (inode->journaled)
+	    journal->Read(edgeSectors[i], &staged[i * SectorSize]);
+	start = edges[i] * SectorSize;
+	end = start + SectorSize;
+	if (start < position)
+	    start = position;
+	if (end > position + numBytes)
+	    end = position + numBytes;
+	bcopy(&staged[i * SectorSize + start - edges[i] * SectorSize],
+	      &into[start - position], end - start);
+    }
+}
 
+void
+OpenFile::WriteDisk(const char *from, int numBytes, int position)
+{
+    int first, last, numEdges, i, firstSector, lastSector, sector;
+    int edges[2], edgeSectors[2];
+    char staged[2 * SectorSize];
+    const char *data;
+    DiskHandle *handle;
+
+    ASSERT(position + numBytes <= hdr->FileLength());
+    if (hdr->IsInline()) {
+	bcopy(from, &hdr->InlineData()[position], numBytes);
+	return;
+    }
+    numEdges = SplitRequest(numBytes, position, &first, &last, edges);
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
 
-    buf = new char[numSectors * SectorSize];
+// read in first and last sector, if they are to be partially modified,
+// in one batch, and copy in the bytes we want to change
+    for (i = 0; i < numEdges; i++)
+	edgeSectors[i] = hdr->ByteToSector(edges[i] * SectorSize);
+    if (numEdges > 0) {
+	handle = synchDisk->Submit(numEdges, edgeSectors, staged, false);
+	handle->Wait();
+	delete handle;
+    }
+    for (i = 0; i < numEdges; i++) {
+	int start = edges[i] * SectorSize, end = start + SectorSize;
 
-    firstAligned = (position == (firstSector * SectorSize));
-    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+	if (inode->journaled)
+	    journal->Read(edgeSectors[i], &staged[i * SectorSize]);
+	if (start < position)
+	    start = position;
+	if (end > position + numBytes)
+	    end = position + numBytes;
+	bcopy(&from[start - position],
+	      &staged[i * SectorSize + start - edges[i] * SectorSize],
+	      end - start);
+    }
 
-// read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);	
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize], 
-				SectorSize, lastSector * SectorSize);	
+// write the sectors back, the whole ones straight from "from"
+    for (i = firstSector; i <= lastSector; i++) {
+	if (i >= first && i <= last)
+	    data = &from[i * SectorSize - position];
+	else
+	    data = &staged[(i == edges[0]) ? 0 : SectorSize];
+	sector = hdr->ByteToSector(i * SectorSize);
+	if (inode->journaled)
+	    journal->Write(sector, data);
+	else
+	    synchDisk->WriteSector(sector, data);
+    }
+}
 
-// copy in the bytes we want to change 
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+//----------------------------------------------------------------------
+// ReleaseRange
+// 	Called when the last sector of an asynchronous transfer is done,
+//	to unlock the sectors it covered.
+//----------------------------------------------------------------------
 
-// write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)	
-        synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize), 
-					&buf[(i - firstSector) * SectorSize]);
-    delete [] buf;
-    return numBytes;
+static void
+ReleaseRange(void *arg)
+{
+    LockedRange *range = (LockedRange *) arg;
+
+    range->owner->Release(range);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadAsync/WriteAsync
+// 	Start reading/writing a portion of the file that has been given
+//	disk space, straight between the caller's buffer and the disk (or
+//	the disk cache), and return at once.  The handle returned is done
+//	once every sector has been moved (cf. SynchDisk::Submit); the
+//	caller must leave its buffer alone until then.  Bulk transfers
+//	keep several of these under way, so that the disk always has the
+//	next sectors queued.
+//
+//	"position" must be at the start of a sector, and the portion must
+//	end at the end of a sector, or of the file.  The buffer holds
+//	whole sectors: whatever follows the end of the file in the last
+//	one is written as it is.
+//
+//	The sectors stay locked, as for ReadAt/WriteAt, until the last
+//	of them is done.  A file with its data in its header, or a
+//	metadata file, is read or written synchronously instead; the
+//	handle is then done already.
+//
+//	"into" -- the buffer to read into
+//	"from" -- the buffer to write from
+//	"numBytes" -- the number of bytes to transfer
+//	"position" -- the offset within the file of the first byte
+//----------------------------------------------------------------------
+
+DiskHandle *
+OpenFile::ReadAsync(char *into, int numBytes, int position)
+{
+    return StartTransfer(into, numBytes, position, false);
+}
+
+DiskHandle *
+OpenFile::WriteAsync(const char *from, int numBytes, int position)
+{
+    return StartTransfer((char *) from, numBytes, position, true);
+}
+
+DiskHandle *
+OpenFile::StartTransfer(char *data, int numBytes, int position,
+			bool writing)
+{
+    int first = position / SectorSize;
+    int numSectors = divRoundUp(numBytes, SectorSize);
+    int *sectors;
+    LockedRange *range;
+    DiskHandle *handle;
+
+    ASSERT(numBytes > 0 && position % SectorSize == 0);
+    if (inode->journaled || hdr->IsInline()) {
+	if (writing)
+	    WriteAt(data, numBytes, position);
+	else
+	    ReadAt(data, numBytes, position);
+	return synchDisk->Submit(0, NULL, NULL, writing);
+    }
+
+    range = inode->lock->Acquire(first, first + numSectors - 1, writing);
+    ASSERT(position + numBytes <= hdr->FileLength()
+	   && (numBytes % SectorSize == 0
+	       || position + numBytes == hdr->FileLength()));
+    sectors = new int[numSectors];
+    for (int i = 0; i < numSectors; i++)
+	sectors[i] = hdr->ByteToSector((first + i) * SectorSize);
+    handle = synchDisk->Submit(numSectors, sectors, data, writing, NULL,
+			       ReleaseRange, range);
+    delete [] sectors;
+    return handle;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Flush/WriteTail
+// 	Give disk space to the bytes appended to the file, and write them
+//	out: first the data, then the grown file header, so that the
+//	header on disk never points at sectors holding garbage.  Flush
+//	locks the file; WriteTail is for callers that already have.
+//
+//	Return false, keeping the bytes buffered, if the disk is full
+//	(which the sectors reserved for the bytes should rule out).
+//----------------------------------------------------------------------
+
+bool
+OpenFile::Flush()
+{
+    LockedRange *range = inode->lock->Acquire(0, EndOfFile, true);
+    bool flushed = WriteTail();
+
+    inode->lock->Release(range);
+    return flushed;
+}
+
+bool
+OpenFile::WriteTail()
+{
+    if (inode->tailLength == 0)
+	return true;
+    if (!Append(inode->tail, inode->tailLength, inode->tailSectors))
+	return false;
+    inode->tailLength = 0;
+    inode->tailSectors = 0;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReserveTail
+// 	Make sure enough free sectors are reserved for the tail to grow
+//	to "length" bytes: the data sectors the file will need beyond
+//	those it has (all of them, for a file leaving its header), and
+//	one extent block for every ExtentsPerBlock of them, in case each
+//	ends up in an extent of its own.
+//
+//	Return false, leaving the reservation as it was, if the disk
+//	does not have that many free sectors left.
+//----------------------------------------------------------------------
+
+bool
+OpenFile::ReserveTail(int length)
+{
+    int fileLength = hdr->FileLength();
+    int newLength = fileLength + length;
+    int data, wanted;
+
+    if (hdr->IsInline())
+	data = (newLength <= InlineSize) ? 0
+					 : divRoundUp(newLength, SectorSize);
+    else
+	data = divRoundUp(newLength, SectorSize)
+	       - divRoundUp(fileLength, SectorSize);
+    wanted = data + divRoundUp(data, ExtentsPerBlock);
+    if (wanted <= inode->tailSectors)
+	return true;
+    if (!fileSystem->Reserve(wanted - inode->tailSectors))
+	return false;
+    inode->tailSectors = wanted;
+    return true;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Append
+// 	Grow the file by "numBytes" bytes, giving them disk space, and
+//	write them out from "from" (cf. Flush), using up the "reserved"
+//	sectors set aside for them.  Return false, leaving the file as it
+//	was, if the disk is full.
+//
+//	A file outgrowing the room in its header takes the data kept
+//	there along to its new sectors, in the same write.
+//----------------------------------------------------------------------
+
+bool
+OpenFile::Append(const char *from, int numBytes, int reserved)
+{
+    int fileLength = hdr->FileLength();
+    char *moved = NULL;
+
+    if (hdr->IsInline() && fileLength > 0
+	    && fileLength + numBytes > InlineSize) {
+	moved = new char[fileLength + numBytes];
+	bcopy(hdr->InlineData(), moved, fileLength);
+	bcopy(from, &moved[fileLength], numBytes);
+    }
+    if (!fileSystem->Extend(hdr, inode->sector, fileLength + numBytes,
+			    reserved)) {
+	delete [] moved;
+	return false;
+    }
+    if (moved != NULL) {
+	WriteDisk(moved, fileLength + numBytes, 0);
+	delete [] moved;
+    } else
+	WriteDisk(from, numBytes, fileLength);
+    hdr->WriteBack(inode->sector);
+    return true;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::Discard
+// 	Forget the bytes appended to the file since it was last flushed,
+//	as if they had never been written.  Used to back out of an append
+//	that could not be given disk space.
+//----------------------------------------------------------------------
+
+void
+OpenFile::Discard()
+{
+    LockedRange *range = inode->lock->Acquire(0, EndOfFile, true);
+
+    fileSystem->Unreserve(inode->tailSectors);
+    inode->tailLength = 0;
+    inode->tailSectors = 0;
+    inode->lock->Release(range);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+// 	Called after each Read, to start loading into the disk cache the
+//	sectors the reader is likely to want next.  A Read that does not
+//	start where the previous one stopped (after a Seek, say) turns
+//	read-ahead off until the reader goes sequential again.
+//
+//	Prefetching is asynchronous; it only costs us time when the
+//	window runs dry, so the window is refilled (and doubled, up to
+//	MaxReadAhead) once the reader gets half way through it.
+//
+//	Once the disk head is on a track, the rest of that track comes
+//	out of the disk's track buffer at one sector per RotationTime
+//	(cf. Disk::ComputeLatency), so when the window ends part way
+//	into a track we stretch it to cover the file's remaining sectors
+//	on that track.
+//
+//	"sequential" -- did the last Read start where the one before ended?
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadAhead(bool sequential)
+{
+    int numSectors, next = divRoundUp(seekPosition, SectorSize);
+    int last, track;
+    LockedRange *range;
+
+    if (!sequential) {
+	raWindow = 0;
+	return;
+    }
+    if (raWindow == 0) {			// start a new sequential run
+	raWindow = MinReadAhead;
+	raLimit = next;
+    } else if (raLimit - next > raWindow / 2)
+	return;					// still enough read ahead
+    else if (raWindow < MaxReadAhead)
+	raWindow *= 2;
+
+    // any range keeps out writers growing the file, and so the header
+    range = inode->lock->Acquire(next, next, false);
+    numSectors = hdr->IsInline() ? 0
+				 : divRoundUp(hdr->FileLength(), SectorSize);
+    if (raLimit < next)
+	raLimit = next;
+    last = next + raWindow;
+    if (last > numSectors)
+	last = numSectors;
+    if (last > raLimit) {
+	track = hdr->ByteToSector((last - 1) * SectorSize) / SectorsPerTrack;
+	while (last < numSectors && last < next + SectorsPerTrack
+	       && hdr->ByteToSector(last * SectorSize) / SectorsPerTrack
+		  == track)
+	    last++;
+    }
+    for (; raLimit < last; raLimit++)
+	synchDisk->Prefetch(hdr->ByteToSector(raLimit * SectorSize));
+    inode->lock->Release(range);
 }
 
 //----------------------------------------------------------------------
@@ -190,5 +818,5 @@ OpenFile::WriteAt(const char *from, int numBytes, int position)
 int
 OpenFile::Length() 
 { 
-    return hdr->FileLength(); 
+    return hdr->FileLength() + inode->tailLength; 
 }
@@ -9,9 +9,10 @@
 //
 //	The other is the "real" implementation, that turns these
 //	operations into read and write disk sector requests. 
-//	In this baseline implementation of the file system, we don't 
-//	worry about concurrent accesses to the file system
-//	by different threads -- this is part of the assignment.
+//	Threads may use a file at the same time, through one OpenFile
+//	or several: each read or write locks the sectors it covers
+//	(cf. RangeLock), so readers share the file, and writers wait
+//	only for those using the same sectors.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -59,12 +60,95 @@ class OpenFile {
 };
 
 #else // FILESYS
+#include "list.h"
+
+class DiskHandle;
 class FileHeader;
+class RangeLock;
+class Semaphore;
+class Thread;
+
+// The following class defines a lock on ranges of a file's sectors.
+// A range is held either shared, by a reader, or exclusive, by a
+// writer; two ranges conflict when they overlap and one of them is
+// exclusive.  So any number of readers, and writers to disjoint parts
+// of the file, can go on at once, each waiting for its own disk
+// requests.  Growing the file locks all of it.
+//
+// Requests are granted in the order they are made: one waits for
+// every earlier request it conflicts with, granted or not, so a
+// stream of readers cannot keep a writer out forever.  Like SynchDisk,
+// the lock is made atomic by disabling interrupts.
+
+// Past the last sector of any file: locking up to it locks the file.
+#define EndOfFile	0x7fffffff
+
+class LockedRange {
+  public:
+    int first, last;			// Sectors covered
+    bool exclusive;			// Held by a writer?
+    RangeLock *owner;			// Lock it was acquired from
+    LockedRange *next;			// Next request, in arrival order
+};
+
+class RangeLock {
+  public:
+    RangeLock();			// Nothing locked
+    ~RangeLock();
+
+    LockedRange *Acquire(int first, int last, bool exclusive);
+					// Wait until sectors "first" to
+					// "last" can be locked, and lock them
+    void Release(LockedRange *range);	// Unlock them
+
+  private:
+    LockedRange *requests;		// Granted and waiting, oldest first
+    List<Thread *> *waiting;		// Threads of the waiting requests
+};
+
+// The following class defines the in-memory "i-node" of a file: what
+// all the OpenFiles of the file share.  FileSystem keeps a table of
+// them, with one entry per open file (cf. FileSystem::OpenInode), so
+// that opening a file that is already open needs no disk access, and
+// every OpenFile sees the same header and the same unflushed bytes.
+//
+// An i-node enters the table before its header is read in, so that the
+// file system lock need not be held during the read; Fetch reads it,
+// or waits for the thread that is reading it.
+//
+// Internal data structures kept public so that OpenFile and FileSystem
+// can access them directly.
+
+class Inode {
+  public:
+    Inode(int sector);			// An i-node for the header at
+    ~Inode();				// "sector", not read in yet
+
+    void Fetch();			// Make sure the header is read in
+
+    int sector;				// Where the header lives on disk
+    FileHeader *hdr;			// The file header
+    int state;				// Is the header read in?
+    Semaphore *fetched;			// V'ed once it is
+    int refCount;			// Number of OpenFiles using it
+    bool removed;			// Removed while open?  Then its
+					// space is freed on the last close
+    bool journaled;			// Metadata (the bitmap, or a
+					// directory)?  Then its data goes
+					// through the journal
+
+    char *tail;				// Bytes appended to the file, not
+    int tailLength;			// yet given disk space (they follow
+					// the hdr->FileLength() bytes on disk)
+    int tailSectors;			// Free sectors reserved for them
+    RangeLock *lock;			// Serializes conflicting reads and
+					// writes of the file
+};
 
 class OpenFile {
   public:
-    OpenFile(int sector);		// Open a file whose header is located
-					// at "sector" on the disk
+    OpenFile(Inode *fileInode);		// Open a file, given its i-node
+					// (from FileSystem::OpenInode)
     ~OpenFile();			// Close the file
 
     void Seek(int position); 		// Set the position from which to 
@@ -75,21 +159,62 @@ class OpenFile {
 					// starting at the implicit position.
 					// Return the # actually read/written,
 					// and increment position in file.
+					// Sequential Reads also read ahead.
     int Write(const char *from, int numBytes);
 
     int ReadAt(char *into, int numBytes, int position);
     					// Read/write bytes from the file,
 					// bypassing the implicit position.
+					// Writing past the end of the file
+					// makes it grow.
     int WriteAt(const char *from, int numBytes, int position);
 
+    DiskHandle *ReadAsync(char *into, int numBytes, int position);
+    DiskHandle *WriteAsync(const char *from, int numBytes, int position);
+					// Start reading/writing whole
+					// sectors straight to or from the
+					// caller's buffer, and return at
+					// once; wait on the handle, then
+					// delete it
+
+    bool Flush();			// Allocate disk space for the bytes
+					// appended to the file, and write
+					// them out.  False if the disk is full
+					// (these two lock the whole file)
+    void Discard();			// Forget the bytes appended since
+					// the last Flush
+
     int Length(); 			// Return the number of bytes in the
 					// file (this interface is simpler 
 					// than the UNIX idiom -- lseek to 
 					// end of file, tell, lseek back 
     
   private:
-    FileHeader *hdr;			// Header for this file 
+    Inode *inode;			// Shared with the other OpenFiles
+					// of this file
+    FileHeader *hdr;			// Header for this file (inode->hdr)
     int seekPosition;			// Current position within the file
+
+    int readEnd;			// Where the last Read stopped
+    int raWindow;			// Sectors to keep read ahead, 0 if
+					// the file is not read sequentially
+    int raLimit;			// First sector not yet read ahead
+
+    void ReadAhead(bool sequential);	// Prefetch the sectors following
+					// seekPosition
+    void ReadDisk(char *into, int numBytes, int position);
+    void WriteDisk(const char *from, int numBytes, int position);
+					// Transfer bytes within the part of
+					// the file that has disk space
+    bool Append(const char *from, int numBytes, int reserved = 0);
+					// Give disk space to bytes appended
+					// to the file, and write them out
+    bool ReserveTail(int length);	// Reserve the sectors a tail of
+					// "length" bytes will need
+    DiskHandle *StartTransfer(char *data, int numBytes, int position,
+			      bool writing);
+					// ReadAsync/WriteAsync
+    bool WriteTail();			// Flush, with the file locked
 };
 
 #endif // FILESYS
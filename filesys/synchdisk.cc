@@ -1,63 +1,349 @@
-// synchdisk.cc 
-//	Routines to synchronously access the disk.  The physical disk 
+// synchdisk.cc
+//	Routines to synchronously access the disk.  The physical disk
 //	is an asynchronous device (disk requests return immediately, and
 //	an interrupt happens later on).  This is a layer on top of
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Each request carries a semaphore to synchronize the interrupt
+//	handler with the requesting thread.  And, because the physical
+//	disk can only handle one operation at a time, requests are kept
+//	on a queue and handed to the disk one by one, from the interrupt
+//	handler of the previous request.  The queue is shared with the
+//	interrupt handler, so it is protected by disabling interrupts
+//	rather than by a Lock.
+//
+//	The queue is kept sorted by sector number, and the next track to
+//	visit is chosen as an elevator would (C-LOOK): the first one at
+//	or beyond the track under the head, or else the lowest one.  The
+//	head only sweeps one way, so no request waits for more than one
+//	pass over the disk.  Within that track, requests are served in
+//	the order their sectors come around under the head.
+//
+//	A volume striped over several disks keeps a queue like that for
+//	each of them, and each disk interrupt starts the next request of
+//	that disk alone.  A batch of requests spread over the disks is
+//	then served by all of them at once.
+//
+//	On top of the queue sits a write-back sector cache.  It is also
+//	protected by disabling interrupts, so that the Async routines
+//	can use it without blocking.  A thread that has to move an entry
+//	to or from the disk marks it busy, so that the entry stays
+//	consistent while the thread sleeps waiting for the transfer.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
-// All rights reserved.  See copyright.h for copyright notice and limitation 
+// All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "system.h"
 
 //----------------------------------------------------------------------
 // DiskRequestDone
-// 	Disk interrupt handler.  Need this to be a C routine, because 
+// 	Disk interrupt handler.  Need this to be a C routine, because
 //	C++ can't handle pointers to member functions.
 //----------------------------------------------------------------------
 
 static void
 DiskRequestDone (void* arg)
+{
+    DiskUnit* unit = (DiskUnit *)arg;
+
+    unit->volume->RequestDone(unit);
+}
+
+//----------------------------------------------------------------------
+// DiskFlusher
+// 	Body of the flush thread, again a C routine for Thread::Fork.
+//----------------------------------------------------------------------
+
+static void
+DiskFlusher (void* arg)
 {
     SynchDisk* disk = (SynchDisk *)arg;
 
-    disk->RequestDone();
+    disk->FlushDirty();
+}
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest
+// 	Initialize a pending disk request.
+//----------------------------------------------------------------------
+
+DiskRequest::DiskRequest(int sectorNumber, bool isWrite, char *buffer,
+			 DiskHandle *whenDone, CacheEntry *toFill)
+{
+    sector = place = sectorNumber;
+    writing = isWrite;
+    data = buffer;
+    handle = whenDone;
+    fill = toFill;
+    merged = NULL;
+}
+
+//----------------------------------------------------------------------
+// DiskHandle::DiskHandle
+// 	Initialize a handle for asynchronous disk requests.
+//
+//	"whenDone" -- semaphore to V when the requests complete, or NULL
+//	"func", "funcArg" -- routine to call then, and its argument
+//----------------------------------------------------------------------
+
+DiskHandle::DiskHandle(Semaphore *whenDone, VoidFunctionPtr func,
+		       void *funcArg)
+{
+    pending = 0;
+    done = whenDone;
+    callback = func;
+    callbackArg = funcArg;
+    waiting = false;
+    wakeup = new Semaphore("disk handle", 0);
+}
+
+DiskHandle::~DiskHandle()
+{
+    ASSERT(pending == 0);
+    delete wakeup;
+}
+
+//----------------------------------------------------------------------
+// DiskHandle::Wait
+// 	Block until every request on the handle is complete.
+//----------------------------------------------------------------------
+
+void
+DiskHandle::Wait()
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+
+    if (pending > 0) {
+	ASSERT(!waiting);
+	waiting = true;
+	wakeup->P();
+    }
+
+    interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// DiskHandle::Expect/RequestDone
+// 	Count requests in and out.  When the last one is done, wake up
+//	whoever is waiting for them, and call the callback last, as it
+//	may delete the handle.  Both assume interrupts are disabled.
+//----------------------------------------------------------------------
+
+void
+DiskHandle::Expect(int count)
+{
+    pending += count;
+}
+
+void
+DiskHandle::RequestDone()
+{
+    ASSERT(pending > 0);
+    if (--pending > 0)
+	return;
+
+    if (waiting) {
+	waiting = false;
+	wakeup->V();
+    }
+    if (done != NULL)
+	done->V();
+    if (callback != NULL)
+	(*callback)(callbackArg);
+}
+
+//----------------------------------------------------------------------
+// SameSector, OnOrAfterTrack, SameRequest
+// 	Match functions for List::Find and List::RemoveMatch, to look for
+//	queued requests.
+//----------------------------------------------------------------------
+
+static bool
+SameSector(DiskRequest *request, void *sector)
+{
+    return request->sector == *(int *) sector;
+}
+
+static bool
+OnOrAfterTrack(DiskRequest *request, void *track)
+{
+    return request->place / SectorsPerTrack >= *(int *) track;
+}
+
+static bool
+SameRequest(DiskRequest *request, void *wanted)
+{
+    return request == (DiskRequest *) wanted;
+}
+
+//----------------------------------------------------------------------
+// NearestOnTrack
+// 	Match function that never matches: List::Find walks it over the
+//	whole queue, and it remembers the request on "scan->track" that
+//	the disk can reach soonest.
+//----------------------------------------------------------------------
+
+struct TrackScan {
+    Disk *disk;				// Disk, to ask for latencies
+    int track;				// Track being looked at
+    DiskRequest *best;			// Nearest request found so far
+    int bestTicks;			// ... and how long it would take
+};
+
+static bool
+NearestOnTrack(DiskRequest *request, void *arg)
+{
+    TrackScan *scan = (TrackScan *) arg;
+
+    if (request->place / SectorsPerTrack == scan->track) {
+	int ticks = scan->disk->ComputeLatency(request->place,
+					       request->writing);
+
+	if (scan->best == NULL || ticks < scan->bestTicks) {
+	    scan->best = request;
+	    scan->bestTicks = ticks;
+	}
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------
+// CacheEntry::CacheEntry
+// 	Initialize an empty cache entry.
+//----------------------------------------------------------------------
+
+CacheEntry::CacheEntry()
+{
+    sector = -1;
+    valid = dirty = busy = stale = prefetched = false;
+    lastUse = 0;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
-//	initializing the physical disk.
+//	initializing the physical disk.  Also start the thread that
+//	periodically writes back the cache.
+//
+//	A volume striped over several disks needs them all to have the
+//	same geometry, and a whole number of stripe units on each.  The
+//	volume is only as good as the disks and stripe unit it is used
+//	with: they must be the same every time.
 //
 //	"name" -- UNIX file name to be used as storage for the disk data
-//	   (usually, "DISK")
+//	   (usually, "DISK"); with more than one disk, the disks are in
+//	   "name" followed by 0, 1, ...
+//	"useCache" -- if false, every request goes to the disk
+//	"disks" -- how many disks to stripe the volume over
+//	"stripeSectors" -- how many sectors in a row go to the same disk
 //----------------------------------------------------------------------
 
-SynchDisk::SynchDisk(const char* name)
+SynchDisk::SynchDisk(const char* name, bool useCache, int disks,
+		     int stripeSectors)
 {
-    semaphore = new Semaphore("synch disk", 0);
-    lock = new Lock("synch disk lock");
-    disk = new Disk(name, DiskRequestDone, this);
+    int sectorsPerTrack = 0, numTracks = 0;
+
+    ASSERT(disks > 0 && disks <= MaxDisks && stripeSectors > 0);
+    numUnits = disks;
+    stripeUnit = stripeSectors;
+    for (int i = 0; i < numUnits; i++) {
+	DiskUnit *unit = &units[i];
+	char *unitName = UnitName(name, i, numUnits);
+
+	unit->volume = this;
+	unit->queue = new List<DiskRequest *>;
+	unit->current = NULL;
+	unit->issuedAt = 0;
+	unit->headSector = 0;		// where the Disk starts out
+	unit->busyTicks = unit->requests = unit->seekTracks = 0;
+	unit->disk = new Disk(unitName, DiskRequestDone, unit);
+	delete [] unitName;
+	if (i == 0) {
+	    sectorsPerTrack = SectorsPerTrack;
+	    numTracks = NumTracks;
+	}
+	ASSERT(SectorsPerTrack == sectorsPerTrack && NumTracks == numTracks);
+    }
+    ASSERT(NumSectors % stripeUnit == 0);
+    NumSectors *= numUnits;		// the size of the whole volume
+
+    numEntries = useCache ? CacheSectors : 0;
+    cache = new CacheEntry[CacheSectors];
+    useClock = 0;
+    busyWaiters = 0;
+    entryDone = new Semaphore("cache entry done", 0);
+
+    flushNeeded = new Semaphore("cache flush needed", 0);
+    flushPending = false;
+    lastFlush = 0;
+    flushHook = NULL;
+    flushHookArg = NULL;
+    hits = misses = 0;
+    readAheads = readAheadHits = 0;
+    merges = 0;
+
+    Thread *flusher = new Thread("disk flusher");
+    flusher->Fork(DiskFlusher, this);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::UnitName
+// 	Return the UNIX file name of disk "unit" of a volume striped over
+//	"disks" disks, stored in "name" (cf. SynchDisk::SynchDisk).  The
+//	name is a new string, which the caller must delete.
+//----------------------------------------------------------------------
+
+char *
+SynchDisk::UnitName(const char *name, int unit, int disks)
+{
+    int size = strlen(name) + 12;	// room for any int
+    char *unitName = new char[size];
+
+    if (disks == 1)
+	snprintf(unitName, size, "%s", name);
+    else
+	snprintf(unitName, size, "%s%d", name, unit);
+    return unitName;
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::~SynchDisk
-// 	De-allocate data structures needed for the synchronous disk
-//	abstraction.
+// 	Write back the dirty sectors, and de-allocate data structures
+//	needed for the synchronous disk abstraction.
+//
+//	We are only deleted when Nachos halts, when there may be no thread
+//	left to wait for the disk.  So we queue the write backs and then
+//	complete the requests ourselves, with interrupts left disabled so
+//	that the interrupts already scheduled for them never fire.  This
+//	is safe because the simulated disk transfers the data as soon as
+//	a request is issued.
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk()
 {
-    delete disk;
-    delete lock;
-    delete semaphore;
+    DiskHandle done;
+
+    interrupt->SetLevel(IntOff);
+    for (int i = 0; i < numEntries; i++)
+	if (cache[i].valid && cache[i].dirty) {
+	    done.Expect(1);
+	    Enqueue(new DiskRequest(cache[i].sector, true, cache[i].data,
+				    &done));
+	    cache[i].dirty = false;
+	}
+    for (int i = 0; i < numUnits; i++) {
+	while (units[i].current != NULL)
+	    units[i].disk->HandleInterrupt();
+	delete units[i].disk;
+	delete units[i].queue;
+    }
+    delete [] cache;
+    delete entryDone;
+    delete flushNeeded;
 }
 
 //----------------------------------------------------------------------
@@ -72,16 +358,22 @@ SynchDisk::~SynchDisk()
 void
 SynchDisk::ReadSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
-    lock->Release();
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    CacheEntry *entry = GetEntry(sectorNumber, true);
+
+    if (entry != NULL)
+	bcopy(entry->data, data, SectorSize);
+    else
+	Transfer(sectorNumber, false, data);	// no room in the cache
+
+    interrupt->SetLevel(oldLevel);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::WriteSector
 // 	Write the contents of a buffer into a disk sector.  Return only
-//	after the data has been written.
+//	after the data has been written (into the cache, if there is
+//	room; the disk is updated later).
 //
 //	"sectorNumber" -- the disk sector to be written
 //	"data" -- the new contents of the disk sector
@@ -90,20 +382,722 @@ SynchDisk::ReadSector(int sectorNumber, char* data)
 void
 SynchDisk::WriteSector(int sectorNumber, const char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
-    lock->Release();
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    CacheEntry *entry = GetEntry(sectorNumber, false);
+
+    if (entry != NULL) {
+	bcopy(data, entry->data, SectorSize);
+	entry->dirty = true;
+    } else
+	Transfer(sectorNumber, true, (char *) data);
+
+    interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectorAsync/WriteSectorAsync
+// 	Read/write a disk sector without waiting.  Return a handle that
+//	is done once the transfer is complete; until then the caller
+//	must not touch "data".  See Submit.
+//
+//	"sectorNumber" -- the disk sector to read/write
+//	"data" -- the buffer to read into/write from
+//	"done" -- semaphore to signal on completion, or NULL
+//	"callback", "callbackArg" -- routine to call on completion
+//----------------------------------------------------------------------
+
+DiskHandle *
+SynchDisk::ReadSectorAsync(int sectorNumber, char* data, Semaphore *done,
+			   VoidFunctionPtr callback, void *callbackArg)
+{
+    return Submit(1, &sectorNumber, data, false, done, callback,
+		  callbackArg);
+}
+
+DiskHandle *
+SynchDisk::WriteSectorAsync(int sectorNumber, const char* data,
+			    Semaphore *done, VoidFunctionPtr callback,
+			    void *callbackArg)
+{
+    return Submit(1, &sectorNumber, (char *) data, true, done, callback,
+		  callbackArg);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Submit
+// 	Start reading/writing a batch of sectors, without waiting for
+//	any of them.  All the requests are queued before we return, so
+//	the disk can take them in whatever order suits it best.
+//
+//	Return a handle that is done once every sector has been moved.
+//	The handle is held until the whole batch has been started, so
+//	it cannot be done early even if some sectors are cache hits.
+//	(If every sector hits, the callback runs before we return; a
+//	callback that deletes the handle makes the value returned
+//	useless.)
+//
+//	"numSectors" -- how many sectors to transfer
+//	"sectors" -- the disk sectors to read/write
+//	"data" -- numSectors * SectorSize bytes to read into/write from
+//	"writing" -- is this a batch of writes?
+//	"done", "callback", "callbackArg" -- as for the handle
+//----------------------------------------------------------------------
+
+DiskHandle *
+SynchDisk::Submit(int numSectors, int *sectors, char *data, bool writing,
+		  Semaphore *done, VoidFunctionPtr callback,
+		  void *callbackArg)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    DiskHandle *handle = new DiskHandle(done, callback, callbackArg);
+
+    handle->Expect(numSectors + 1);
+    for (int i = 0; i < numSectors; i++)
+	if (writing)
+	    StartWrite(sectors[i], &data[i * SectorSize], handle);
+	else
+	    StartRead(sectors[i], &data[i * SectorSize], handle);
+    handle->RequestDone();		// whole batch started
+
+    interrupt->SetLevel(oldLevel);
+    return handle;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartRead
+// 	Start one sector of an asynchronous read.  A hit completes at
+//	once.  On a miss, a clean cache entry (if one can be spared
+//	without a write back) is filled from the disk and the caller's
+//	copy rides along on the same transfer.  A sector that is busy in
+//	the cache, or that finds no room, is read straight from the disk.
+//	Assumes interrupts are disabled.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartRead(int sectorNumber, char *data, DiskHandle *handle)
+{
+    CacheEntry *entry = Lookup(sectorNumber);
+    DiskRequest *request;
+
+    if (entry != NULL && !entry->busy) {
+	Touch(entry);
+	bcopy(entry->data, data, SectorSize);
+	handle->RequestDone();
+	return;
+    }
+
+    request = new DiskRequest(sectorNumber, false, data, handle);
+    if (entry == NULL && (entry = Victim(true)) != NULL) {
+	DiskRequest *fill = new DiskRequest(sectorNumber, false, entry->data,
+					    NULL, entry);
+	misses++;
+	Claim(entry, sectorNumber);
+	entry->busy = true;
+	fill->merged = request;
+	request = fill;
+    }
+    Enqueue(request);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartWrite
+// 	Start one sector of an asynchronous write.  If the sector is in
+//	the cache, or a clean entry can take it, the write completes at
+//	once (the disk is updated later, as for WriteSector).  Otherwise
+//	it is queued for the disk.  Assumes interrupts are disabled.
+//
+//	A write that goes around a busy entry marks it stale, so that the
+//	thread transferring it discards the entry when it is done.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartWrite(int sectorNumber, char *data, DiskHandle *handle)
+{
+    CacheEntry *entry = Lookup(sectorNumber);
+
+    if (entry != NULL && entry->busy) {
+	entry->stale = true;
+	entry = NULL;
+    } else if (entry != NULL)
+	Touch(entry);
+    else if ((entry = Victim(true)) != NULL) {
+	misses++;
+	Claim(entry, sectorNumber);	// no need to read what we overwrite
+    }
+
+    if (entry == NULL) {
+	Enqueue(new DiskRequest(sectorNumber, true, data, handle));
+	return;
+    }
+    bcopy(data, entry->data, SectorSize);
+    entry->dirty = true;
+    handle->RequestDone();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteThrough
+// 	Write a batch of sectors to the disk itself, bypassing the write
+//	back cache, and return only once every one of them is on disk.
+//	The journal needs this to know when its log writes are safe.
+//	Copies of the sectors in the cache are brought up to date (and
+//	are now clean), or, if busy, marked stale.
+//
+//	"numSectors" -- how many sectors to write
+//	"sectors" -- the disk sectors to write
+//	"data" -- numSectors * SectorSize bytes to write
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteThrough(int numSectors, int *sectors, const char *data)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    DiskHandle done;
+
+    done.Expect(numSectors);
+    for (int i = 0; i < numSectors; i++) {
+	CacheEntry *entry = Lookup(sectors[i]);
+	char *buffer = (char *) &data[i * SectorSize];
+
+	if (entry != NULL && entry->busy)
+	    entry->stale = true;
+	else if (entry != NULL) {
+	    bcopy(buffer, entry->data, SectorSize);
+	    entry->dirty = false;
+	}
+	Enqueue(new DiskRequest(sectors[i], true, buffer, &done));
+    }
+    done.Wait();
+
+    interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+// 	Start reading a sector into the cache, without waiting for it.
+//	The entry stays busy until the disk is done (see RequestDone), so
+//	a thread that wants the sector meanwhile simply waits for it.
+//
+//	Read-ahead is only a hint: we give up if the sector is already
+//	cached, or if the only entries left are dirty or busy (writing
+//	one back would mean waiting, and read-ahead must not evict data
+//	that has not reached the disk yet).
+//
+//	"sectorNumber" -- the disk sector to read ahead
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Prefetch(int sectorNumber)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    CacheEntry *entry = NULL;
+
+    if (Lookup(sectorNumber) == NULL)
+	entry = Victim(true);
+    if (entry != NULL) {
+	DEBUG('f', "Reading ahead sector %d.\n", sectorNumber);
+	readAheads++;
+	Claim(entry, sectorNumber);
+	entry->busy = entry->prefetched = true;
+	Enqueue(new DiskRequest(sectorNumber, false, entry->data, NULL,
+				entry));
+    }
+
+    interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Sync
+// 	Write every dirty sector back to the disk, returning once they
+//	have all been written.  The write backs are queued all at once,
+//	so that the disk can take them in elevator order.
+//
+//	Entries that are busy (being written back by the flush thread
+//	or by an eviction, or being filled) are waited for, and looked
+//	at again, so that when we return no transfer started before us
+//	is still in flight.  The journal relies on this to reuse the
+//	log only after every committed sector reached its home.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Sync()
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    bool flushing[CacheSectors];
+    int i;
+
+    for (;;) {
+	DiskHandle done;
+	bool queued = false, busy = false;
+
+	for (i = 0; i < numEntries; i++) {
+	    CacheEntry *entry = &cache[i];
+
+	    busy = busy || entry->busy;
+	    flushing[i] = entry->valid && entry->dirty && !entry->busy;
+	    if (!flushing[i])
+		continue;
+	    entry->busy = true;
+	    entry->dirty = false;
+	    queued = true;
+	    done.Expect(1);
+	    Enqueue(new DiskRequest(entry->sector, true, entry->data, &done));
+	}
+	if (!queued) {
+	    if (!busy)			// nothing dirty, nothing in flight
+		break;
+	    WaitForEntry();		// then look again
+	    continue;
+	}
+	done.Wait();
+	for (i = 0; i < numEntries; i++)
+	    if (flushing[i]) {
+		if (cache[i].stale)	// rewritten behind our back
+		    cache[i].valid = false;
+		EntryDone(&cache[i]);
+	    }
+    }
+    lastFlush = stats->totalTicks;
+
+    interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::SetFlushHook
+// 	Have the flush thread call "func(arg)" each time it wakes up,
+//	before writing back the cache, or stop doing so if "func" is NULL.
+//	This lets the file system write back the metadata it keeps in
+//	memory (cf. FileSystem::Sync).
+//----------------------------------------------------------------------
+
+void
+SynchDisk::SetFlushHook(VoidFunctionPtr func, void *arg)
+{
+    flushHook = func;
+    flushHookArg = arg;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CheckFlush
+// 	Called from the timer interrupt handler.  If FlushInterval ticks
+//	went by since the last write back, and there is something to
+//	write (or a hook that may have something), wake up the flush
+//	thread.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::CheckFlush()
+{
+    if (flushPending || stats->totalTicks - lastFlush < FlushInterval)
+	return;
+
+    if (flushHook != NULL) {
+	flushPending = true;
+	flushNeeded->V();
+	return;
+    }
+    for (int i = 0; i < numEntries; i++)
+	if (cache[i].valid && cache[i].dirty) {
+	    flushPending = true;
+	    flushNeeded->V();
+	    return;
+	}
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FlushDirty
+// 	Body of the flush thread: write back the cache each time the
+//	timer says so, after calling the flush hook, if any.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::FlushDirty()
+{
+    for (;;) {
+	flushNeeded->P();
+	if (flushHook != NULL)
+	    (*flushHook)(flushHookArg);
+	DEBUG('f', "Flushing the disk cache.\n");
+	Sync();
+	flushPending = false;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Lookup
+// 	Return the entry holding "sectorNumber" (perhaps busy), or NULL
+//	if the sector is not in the cache.  Assumes interrupts are
+//	disabled.
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::Lookup(int sectorNumber)
+{
+    for (int i = 0; i < numEntries; i++)
+	if (cache[i].valid && cache[i].sector == sectorNumber)
+	    return &cache[i];
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::GetEntry
+// 	Return the entry holding "sectorNumber", ready to be used: valid
+//	and not busy.  On a miss, the least recently used entry is
+//	written back if dirty, and then (if "fill") loaded with the
+//	sector.  Return NULL if every entry is busy.  Assumes interrupts
+//	are disabled; they stay disabled after we return, so the caller
+//	can use the entry before anyone else gets to it.
+//
+//	The entry takes its new sector number before the write back, so
+//	that nobody else loads the same sector meanwhile.  A thread that
+//	wants the old sector misses and queues a read behind our write.
+//
+//	"sectorNumber" -- the sector wanted
+//	"fill" -- read the sector from disk on a miss?  (not needed when
+//		the caller is about to overwrite the whole sector)
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::GetEntry(int sectorNumber, bool fill)
+{
+    for (;;) {
+	CacheEntry *entry = Lookup(sectorNumber);
+
+	if (entry != NULL) {
+	    if (entry->busy) {		// wait, then look again
+		WaitForEntry();
+		continue;
+	    }
+	    Touch(entry);
+	    return entry;
+	}
+
+	entry = Victim(false);
+	if (entry == NULL)
+	    return NULL;
+
+	misses++;
+	int oldSector = entry->sector;
+	bool writeBack = entry->valid && entry->dirty;
+
+	Claim(entry, sectorNumber);
+	entry->busy = true;
+	if (writeBack)
+	    Transfer(oldSector, true, entry->data);
+	if (fill)
+	    Transfer(sectorNumber, false, entry->data);
+
+	bool stale = entry->stale;
+	EntryDone(entry);
+	if (stale) {			// rewritten behind our back
+	    entry->valid = false;
+	    continue;
+	}
+	entry->lastUse = ++useClock;
+	return entry;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Victim
+// 	Return the entry to replace on a miss: the least recently used
+//	one that is not busy, preferring empty entries.  Return NULL if
+//	there is none.  Assumes interrupts are disabled.
+//
+//	"clean" -- only consider entries that need no write back
+//----------------------------------------------------------------------
+
+CacheEntry *
+SynchDisk::Victim(bool clean)
+{
+    CacheEntry *entry = NULL;
+
+    for (int i = 0; i < numEntries; i++) {
+	if (cache[i].busy || (clean && cache[i].valid && cache[i].dirty))
+	    continue;
+	if (entry == NULL || !cache[i].valid
+	    || (entry->valid && cache[i].lastUse < entry->lastUse))
+	    entry = &cache[i];
+    }
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Claim
+// 	Give "entry" to "sectorNumber".  Its old contents, which the
+//	caller has written back if needed, are forgotten.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Claim(CacheEntry *entry, int sectorNumber)
+{
+    entry->sector = sectorNumber;
+    entry->valid = true;
+    entry->dirty = entry->stale = entry->prefetched = false;
+    entry->lastUse = ++useClock;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Touch
+// 	Account for a hit on "entry", and mark it recently used.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Touch(CacheEntry *entry)
+{
+    hits++;
+    if (entry->prefetched) {
+	readAheadHits++;
+	entry->prefetched = false;
+    }
+    entry->lastUse = ++useClock;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WaitForEntry/EntryDone
+// 	A thread finding a busy entry waits until some transfer ends, and
+//	then looks again.  When a transfer ends, every waiter is woken.
+//	Both assume interrupts are disabled.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WaitForEntry()
+{
+    busyWaiters++;
+    entryDone->P();
+}
+
+void
+SynchDisk::EntryDone(CacheEntry *entry)
+{
+    entry->busy = false;
+    entry->stale = false;
+    for (; busyWaiters > 0; busyWaiters--)
+	entryDone->V();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Transfer
+// 	Queue a request for the disk, and wait until it is done.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Transfer(int sectorNumber, bool writing, char *data)
+{
+    DiskHandle done;
+
+    done.Expect(1);
+    Enqueue(new DiskRequest(sectorNumber, writing, data, &done));
+    done.Wait();			// wait for interrupt
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Locate
+// 	Return the disk holding sector "sectorNumber" of the volume, and
+//	set "*place" to where it is on that disk.  The volume is cut into
+//	stripes of "stripeUnit" sectors, dealt out to the disks in turn.
+//----------------------------------------------------------------------
+
+DiskUnit *
+SynchDisk::Locate(int sectorNumber, int *place)
+{
+    int stripe = sectorNumber / stripeUnit;
+
+    ASSERT(sectorNumber >= 0 && sectorNumber < NumSectors);
+    *place = (stripe / numUnits) * stripeUnit + sectorNumber % stripeUnit;
+    return &units[stripe % numUnits];
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Enqueue
+// 	Add a request to the queue of its disk, in sector order, and
+//	start it right away if that disk is idle.  If a request for the
+//	same sector is already queued, the two are merged instead.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Enqueue(DiskRequest *request)
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    DiskUnit *unit = Locate(request->sector, &request->place);
+    DiskRequest *pending = unit->queue->Find(SameSector, &request->sector);
+
+    if (pending == NULL || !Merge(unit, pending, request))
+	unit->queue->SortedInsert(request, request->place);
+    if (unit->current == NULL)
+	StartNext(unit);
+
+    interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Merge
+// 	Combine "request" with "pending", a queued request for the same
+//	sector that the disk has not started yet.  Return true if that
+//	takes care of "request", false if it still has to be queued.
+//	Assumes interrupts are disabled.
+//
+//	A read behind a write gets the data being written, without going
+//	to the disk.  A read behind a read shares its transfer.  A write
+//	makes the pending request moot: a pending write is superseded,
+//	and pending reads are completed with the new data.  Either way
+//	"pending" is done, and "request" takes its place.
+//----------------------------------------------------------------------
+
+bool
+SynchDisk::Merge(DiskUnit *unit, DiskRequest *pending, DiskRequest *request)
+{
+    merges++;
+    if (!request->writing) {
+	if (pending->writing) {
+	    bcopy(pending->data, request->data, SectorSize);
+	    Complete(request);
+	} else {
+	    DiskRequest *last = request;
+
+	    while (last->merged != NULL)	// it may bring reads along
+		last = last->merged;
+	    last->merged = pending->merged;
+	    pending->merged = request;
+	}
+	return true;
+    }
+
+    unit->queue->RemoveMatch(SameSector, &request->sector);
+    if (!pending->writing)
+	bcopy(request->data, pending->data, SectorSize);
+    Complete(pending);
+    return false;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	Hand the next queued request, if any, to "unit".  The track is
+//	the first one at or beyond the head, or the lowest one once the
+//	head has swept past them all (C-LOOK); on that track, we take
+//	the request with the least rotational delay.  Assumes interrupts
+//	are disabled.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartNext(DiskUnit *unit)
+{
+    TrackScan scan;
+    DiskRequest *next, *current;
+
+    scan.track = unit->headSector / SectorsPerTrack;
+    next = unit->queue->Find(OnOrAfterTrack, &scan.track);
+    if (next == NULL) {
+	scan.track = 0;			// wrap around to the lowest track
+	next = unit->queue->Find(OnOrAfterTrack, &scan.track);
+    }
+    unit->current = NULL;
+    if (next == NULL)
+	return;				// nothing left to do
+
+    scan.disk = unit->disk;
+    scan.track = next->place / SectorsPerTrack;
+    scan.best = NULL;
+    unit->queue->Find(NearestOnTrack, &scan);
+    current = unit->current = unit->queue->RemoveMatch(SameRequest,
+						       scan.best);
+
+    unit->requests++;
+    unit->seekTracks += abs(current->place / SectorsPerTrack
+			    - unit->headSector / SectorsPerTrack);
+    unit->headSector = current->place;
+    unit->issuedAt = stats->totalTicks;
+    if (current->writing)
+	unit->disk->WriteRequest(current->place, current->data);
+    else
+	unit->disk->ReadRequest(current->place, current->data);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::RequestDone
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Wake up the thread (or task) waiting for
+//	the disk request to finish, and start the next request for the
+//	same disk.  A read-ahead has nobody waiting; release its cache
+//	entry instead.
+//
+//	"unit" -- the disk that finished a request
+//----------------------------------------------------------------------
+
+void
+SynchDisk::RequestDone(DiskUnit *unit)
+{
+    DiskRequest *finished = unit->current;
+
+    ASSERT(finished != NULL);
+    unit->busyTicks += stats->totalTicks - unit->issuedAt;
+    StartNext(unit);
+    Complete(finished);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Complete
+// 	A request is done: hand its data to the reads merged into it, and
+//	wake up everyone waiting.  A cache fill has no handle; its cache
+//	entry is released instead.  Assumes interrupts are disabled.
 //----------------------------------------------------------------------
 
 void
-SynchDisk::RequestDone()
-{ 
-    semaphore->V();
+SynchDisk::Complete(DiskRequest *request)
+{
+    DiskRequest *next;
+
+    for (next = request->merged; next != NULL; next = next->merged)
+	bcopy(request->data, next->data, SectorSize);
+
+    for (; request != NULL; request = next) {
+	next = request->merged;
+	if (request->fill != NULL) {
+	    CacheEntry *entry = request->fill;
+
+	    if (entry->stale)		// rewritten behind our back
+		entry->valid = false;
+	    EntryDone(entry);
+	} else
+	    request->handle->RequestDone();
+	delete request;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::PrintStats
+// 	Print the cache hit rate, and how long the disk was busy.  For a
+//	striped volume, the disk figures are added up over its disks, and
+//	also shown for each of them.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::PrintStats()
+{
+    int accesses = hits + misses;
+    int busyTicks = 0, requests = 0, seekTracks = 0;
+
+    for (int i = 0; i < numUnits; i++) {
+	busyTicks += units[i].busyTicks;
+	requests += units[i].requests;
+	seekTracks += units[i].seekTracks;
+    }
+
+    if (numEntries == 0)
+	printf("Disk cache: disabled\n");
+    else
+	printf("Disk cache: %d sectors, hits %d, misses %d (%d%% hit rate)\n",
+	    numEntries, hits, misses,
+	    accesses > 0 ? (100 * hits) / accesses : 0);
+    if (readAheads > 0)
+	printf("Read-ahead: %d sectors, %d used\n", readAheads, readAheadHits);
+    printf("Disk busy: %d ticks\n", busyTicks);
+    printf("Disk requests: %d, merged %d, average seek %d.%02d tracks\n",
+	requests, merges, requests > 0 ? seekTracks / requests : 0,
+	requests > 0 ? (100 * seekTracks / requests) % 100 : 0);
+    if (numUnits > 1) {
+	printf("Striped over %d disks, %d sectors at a time\n", numUnits,
+	    stripeUnit);
+	for (int i = 0; i < numUnits; i++)
+	    printf("Disk %d: busy %d ticks, %d requests\n", i,
+		units[i].busyTicks, units[i].requests);
+    }
 }
@@ -13,6 +13,112 @@
 
 #include "disk.h"
 #include "synch.h"
+#include "list.h"
+
+#define CacheSectors	64		// number of sectors kept in the cache
+#define MaxDisks	8		// most disks a volume can stripe over
+#define FlushInterval	(100 * TimerTicks)
+					// how often dirty sectors are written
+					// back by the flush thread
+
+class CacheEntry;
+class SynchDisk;
+
+// The following class keeps track of one or more asynchronous disk
+// requests (a single sector, or a batch given to SynchDisk::Submit).
+// When the last of them completes, the handle V's "done" and calls
+// "callback" (in that order, and from the disk interrupt handler, or
+// from the submitting thread if every sector was in the cache).
+//
+// The handle belongs to the caller, who deletes it once it is done --
+// after Wait() returns, or from the callback itself.
+
+class DiskHandle {
+  public:
+    DiskHandle(Semaphore *whenDone = NULL, VoidFunctionPtr func = NULL,
+	       void *funcArg = NULL);
+    ~DiskHandle();
+
+    bool IsDone() { return pending == 0; }
+    void Wait();			// Block until every request is done;
+					// only one thread may wait
+
+    void Expect(int count);		// Called by SynchDisk: "count" more
+    void RequestDone();			// requests pending, or one less
+
+  private:
+    int pending;			// Requests not yet complete
+    Semaphore *done;			// V'ed when they all are, or NULL
+    VoidFunctionPtr callback;		// Called when they all are, or NULL
+    void *callbackArg;
+    bool waiting;			// Is a thread blocked in Wait()?
+    Semaphore *wakeup;			// ... on this semaphore
+};
+
+// The following class defines a pending disk request: which sector,
+// in which direction, the caller's buffer, and the handle to signal
+// once the disk has finished with it.  A read-ahead request has no
+// handle; instead, the cache entry it fills is released when done.
+// Reads of the same sector share a single transfer: the requests that
+// joined a queued read hang from its "merged" list.
+//
+// "sector" is a sector of the volume; "place" is where it lives on
+// the disk that holds it (see SynchDisk::Locate).
+
+class DiskRequest {
+  public:
+    DiskRequest(int sectorNumber, bool isWrite, char *buffer,
+		DiskHandle *whenDone, CacheEntry *toFill = NULL);
+
+    int sector;				// Sector to read or write
+    int place;				// ... on its disk
+    bool writing;			// Is this a write request?
+    char *data;				// Buffer to transfer from/into
+    DiskHandle *handle;			// Signalled when the request completes
+    CacheEntry *fill;			// Entry being filled, if any
+    DiskRequest *merged;		// Reads completed by this transfer
+};
+
+// The following class defines one of the disks a volume is made of:
+// the raw device, and the requests queued for it.  Each disk has its
+// own head, and works through its own queue; the disks of a volume
+// all work at the same time.
+
+class DiskUnit {
+  public:
+    SynchDisk *volume;			// Volume the disk belongs to
+    Disk *disk;		  		// Raw disk device
+    List<DiskRequest *> *queue;		// Requests waiting for the disk
+    DiskRequest *current;		// Request the disk is working on,
+					// NULL if the disk is idle
+    int issuedAt;			// When "current" was handed to the disk
+    int headSector;			// Sector of the last request handed
+					// to the disk, where the head is
+
+    int busyTicks;			// Ticks the disk spent on requests
+    int requests;			// Requests handed to the disk
+    int seekTracks;			// Total tracks the head moved
+};
+
+// The following class defines one entry of the sector cache.  An entry
+// is "busy" while a thread is moving its contents to or from the disk;
+// nobody else may touch the data until the transfer is complete.
+
+class CacheEntry {
+  public:
+    CacheEntry();
+
+    int sector;				// Sector held by this entry
+    bool valid;				// Does the entry hold a sector?
+    bool dirty;				// Modified since read from disk?
+    bool busy;				// Transfer to/from disk in progress?
+    bool stale;				// Sector rewritten behind the cache
+					// during the transfer (see
+					// WriteSectorAsync)
+    int lastUse;			// For LRU replacement
+    bool prefetched;			// Read ahead, and not used yet?
+    char data[SectorSize];		// Contents of the sector
+};
 
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
@@ -23,31 +129,165 @@
 //
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
-// returning.
+// returning.  Requests from different threads are queued, and handed
+// to the disk one at a time from the disk interrupt handler, in C-LOOK
+// order: sweeping towards higher sectors from the head position, then
+// jumping back to the lowest pending sector.  There is at most one
+// queued request per sector; a new one is merged into it.
+//
+// The disk may in fact be a volume striped over several disks (RAID
+// 0): sectors are dealt out to the disks "stripeUnit" at a time, so
+// that a run of sectors spreads over all of them.  Each disk has its
+// own queue, and serves it while the others serve theirs.  The volume
+// has as many sectors as all its disks together; NumSectors is set to
+// that, while SectorsPerTrack and NumTracks still describe each disk.
+//
+// Sectors are kept in a write-back cache of CacheSectors entries,
+// replaced in LRU order.  Dirty sectors reach the disk when they are
+// evicted, when Sync() is called, every FlushInterval ticks (from a
+// flush thread woken by the system timer), and when Nachos halts.
+// The file system hooks into the flush thread (SetFlushHook) to write
+// back the metadata it keeps in memory first.
+//
+// The "Async" versions, and Submit, never block: they return a
+// DiskHandle at once, and signal it when the data has been moved.
+// Cache hits complete right away; misses are queued for the disk,
+// going through a clean cache entry when one can be spared.  The
+// caller (a thread, or a kernel Task, cf. task.h, awaiting "done"
+// with TASK_P) must keep "data" untouched until the handle is done.
+//
+// Prefetch() starts loading a sector into the cache and returns at
+// once; a later read of that sector waits for the transfer if it is
+// still under way.  OpenFile uses it to read ahead of sequential
+// readers.
+
 class SynchDisk {
   public:
-    SynchDisk(const char* name);    	// Initialize a synchronous disk,
-					// by initializing the raw Disk.
-    ~SynchDisk();			// De-allocate the synch disk data
+    SynchDisk(const char* name, bool useCache = true, int disks = 1,
+	      int stripeSectors = 1);
+    					// Initialize a synchronous disk,
+					// by initializing the raw Disk
+					// (or Disks, "name"0 to "name"n-1,
+					// if striping over more than one).
+    ~SynchDisk();			// Write back the cache, and
+					// de-allocate the synch disk data
+
+    static char *UnitName(const char *name, int unit, int disks);
+					// UNIX file of disk "unit" of a
+					// volume over "disks" disks (a new
+					// string the caller must delete)
     
     void ReadSector(int sectorNumber, char* data);
     					// Read/write a disk sector, returning
     					// only once the data is actually read 
-					// or written.  These call
-    					// Disk::ReadRequest/WriteRequest and
-					// then wait until the request is done.
+					// or written (into the cache).  These
+    					// call Disk::ReadRequest/WriteRequest
+					// on a miss and wait until the
+					// request is done.
     void WriteSector(int sectorNumber, const char* data);
     
-    void RequestDone();			// Called by the disk device interrupt
+    DiskHandle *ReadSectorAsync(int sectorNumber, char* data,
+				Semaphore *done = NULL,
+				VoidFunctionPtr callback = NULL,
+				void *callbackArg = NULL);
+					// Start a read/write and return at
+					// once, with a handle that is done
+					// when the request completes.
+    DiskHandle *WriteSectorAsync(int sectorNumber, const char* data,
+				 Semaphore *done = NULL,
+				 VoidFunctionPtr callback = NULL,
+				 void *callbackArg = NULL);
+
+    DiskHandle *Submit(int numSectors, int *sectors, char *data,
+		       bool writing, Semaphore *done = NULL,
+		       VoidFunctionPtr callback = NULL,
+		       void *callbackArg = NULL);
+					// Same, for a batch of sectors;
+					// "data" holds numSectors sectors
+
+    void WriteThrough(int numSectors, int *sectors, const char *data);
+					// Write a batch of sectors straight
+					// to the disk, returning once they
+					// are all there
+
+    void Prefetch(int sectorNumber);	// Start loading a sector into the
+					// cache, if it is not there already
+					// and a clean entry can be spared
+
+    void Sync();			// Write back all dirty sectors, and
+					// wait until they are on disk
+
+    void SetFlushHook(VoidFunctionPtr func, void *arg);
+					// Have the flush thread call
+					// "func(arg)" before each write back
+
+    void CheckFlush();			// Called by the timer interrupt
+					// handler: wake up the flush thread
+					// if it is time to write back
+
+    void FlushDirty();			// Body of the flush thread
+
+    void RequestDone(DiskUnit *unit);	// Called by the disk device interrupt
 					// handler, to signal that the
-					// current disk operation is complete.
+					// current operation of "unit" is
+					// complete.
+
+    void PrintStats();			// Print cache hit rate and disk usage
 
   private:
-    Disk *disk;		  		// Raw disk device
-    Semaphore *semaphore; 		// To synchronize requesting thread 
-					// with the interrupt handler
-    Lock *lock;		  		// Only one read/write request
-					// can be sent to the disk at a time
+    DiskUnit units[MaxDisks];		// Disks the volume is striped over
+    int numUnits;			// ... how many of them
+    int stripeUnit;			// Sectors in a row on the same disk
+
+    CacheEntry *cache;			// The sector cache
+    int numEntries;			// Number of entries, 0 if no cache
+    int useClock;			// Advanced on every cache access
+    int busyWaiters;			// Threads waiting for a busy entry
+    Semaphore *entryDone;		// V'ed for them when a transfer ends
+
+    Semaphore *flushNeeded;		// Wakes up the flush thread
+    bool flushPending;			// Has it been woken up already?
+    int lastFlush;			// When dirty sectors were last
+					// written back
+    VoidFunctionPtr flushHook;		// Called by the flush thread, to
+    void *flushHookArg;			// write back data kept elsewhere
+
+    int hits, misses;			// Cache statistics
+    int readAheads, readAheadHits;	// Sectors prefetched, and how many
+					// of them were used
+    int merges;				// Requests merged into queued ones
+
+    DiskUnit *Locate(int sectorNumber, int *place);
+					// Disk holding a sector of the
+					// volume, and where on that disk
+    void Enqueue(DiskRequest *request);	// Queue a request, starting it
+					// if its disk is idle
+    void StartNext(DiskUnit *unit);	// Hand the next queued request
+					// to the disk
+    bool Merge(DiskUnit *unit, DiskRequest *pending, DiskRequest *request);
+					// Combine a request with a queued
+					// one for the same sector
+    void Complete(DiskRequest *request);
+					// Wake up everyone waiting for a
+					// request
+    void Transfer(int sectorNumber, bool writing, char *data);
+					// Queue a request and wait for it
+    void StartRead(int sectorNumber, char *data, DiskHandle *handle);
+    void StartWrite(int sectorNumber, char *data, DiskHandle *handle);
+					// Start one sector of an Async
+					// request
+
+    CacheEntry *Lookup(int sectorNumber);
+					// Entry holding a sector, if any
+    CacheEntry *GetEntry(int sectorNumber, bool fill);
+					// Entry holding a sector, loading
+					// it into the cache if needed
+    CacheEntry *Victim(bool clean);	// Entry to replace on a miss
+    void Claim(CacheEntry *entry, int sectorNumber);
+					// Give an entry to a new sector
+    void Touch(CacheEntry *entry);	// Account for a cache hit
+    void WaitForEntry();		// Wait until some transfer ends
+    void EntryDone(CacheEntry *entry);	// A transfer has ended
 };
 
 #endif // SYNCHDISK_H
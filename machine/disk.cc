@@ -1,6 +1,7 @@
 // disk.cc 
 //	Routines to simulate a physical disk device; reading and writing
-//	to the disk is simulated as reading and writing to a UNIX file.
+//	to the disk is simulated as copying to and from a UNIX file,
+//	mapped into memory.
 //	See disk.h for details about the behavior of disks (and
 //	therefore about the behavior of this simulation).
 //
@@ -17,13 +18,30 @@
 #include "disk.h"
 #include "system.h"
 
+// The geometry of the disk; the defaults are for a new disk, and are
+// replaced by those of the disk in the UNIX file, if there is one.
+int SectorsPerTrack = 32;
+int NumTracks = 32;
+int NumSectors = SectorsPerTrack * NumTracks;
+
 // We put this at the front of the UNIX file representing the
 // disk, to make it less likely we will accidentally treat a useful file 
-// as a disk (which would probably trash the file's contents).
-#define MagicNumber 	0x456789ab
-#define MagicSize 	sizeof(int)
-
-#define DiskSize 	(MagicSize + (NumSectors * SectorSize))
+// as a disk (which would probably trash the file's contents).  It is
+// followed by the geometry of the disk.  Disks made before the geometry
+// was recorded start with OldMagicNumber alone, and are 32 tracks of 32
+// sectors.
+#define MagicNumber 	0x456789ac
+#define OldMagicNumber 	0x456789ab
+
+class DiskLabel {
+  public:
+    int magic;
+    int sectorSize;
+    int sectorsPerTrack;
+    int numTracks;
+};
+
+#define DiskSize(labelSize) 	((labelSize) + (NumSectors * SectorSize))
 
 // dummy procedure because we can't take a pointer of a member function
 static void DiskDone(void* arg) { ((Disk *)arg)->HandleInterrupt(); }
@@ -31,8 +49,10 @@ static void DiskDone(void* arg) { ((Disk *)arg)->HandleInterrupt(); }
 //----------------------------------------------------------------------
 // Disk::Disk()
 // 	Initialize a simulated disk.  Open the UNIX file (creating it
-//	if it doesn't exist), and check the magic number to make sure it's 
-// 	ok to treat it as Nachos disk storage.
+//	if it doesn't exist, with the geometry in SectorsPerTrack and
+//	NumTracks), check the magic number to make sure it's ok to treat
+//	it as Nachos disk storage, and map it into memory.  The geometry
+//	of the disk is left in SectorsPerTrack, NumTracks and NumSectors.
 //
 //	"name" -- text name of the file simulating the Nachos disk
 //	"callWhenDone" -- interrupt handler to be called when disk read/write
@@ -42,7 +62,8 @@ static void DiskDone(void* arg) { ((Disk *)arg)->HandleInterrupt(); }
 
 Disk::Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg)
 {
-    int magicNum;
+    DiskLabel label;
+    int labelSize = sizeof(DiskLabel);
     int tmp = 0;
 
     DEBUG('d', "Initializing the disk, 0x%x 0x%x\n", callWhenDone, callArg);
@@ -53,28 +74,49 @@ Disk::Disk(const char* name, VoidFunctionPtr callWhenDone, void* callArg)
     
     fileno = OpenForReadWrite(name, false);
     if (fileno >= 0) {		 	// file exists, check magic number 
-	Read(fileno, (char *) &magicNum, MagicSize);
-	ASSERT(magicNum == MagicNumber);
+	Read(fileno, (char *) &label.magic, sizeof(int));
+	if (label.magic == OldMagicNumber) {
+	    labelSize = sizeof(int);
+	    SectorsPerTrack = NumTracks = 32;
+	} else {
+	    ASSERT(label.magic == MagicNumber);
+	    Read(fileno, (char *) &label.sectorSize, 
+					labelSize - sizeof(int));
+	    ASSERT(label.sectorSize == SectorSize);
+	    SectorsPerTrack = label.sectorsPerTrack;
+	    NumTracks = label.numTracks;
+	}
+	NumSectors = SectorsPerTrack * NumTracks;
     } else {				// file doesn't exist, create it
+	ASSERT(SectorsPerTrack > 0 && NumTracks > 0);
+	NumSectors = SectorsPerTrack * NumTracks;
         fileno = OpenForWrite(name);
-	magicNum = MagicNumber;  
-	WriteFile(fileno, (char *) &magicNum, MagicSize); // write magic number
-
-	// need to write at end of file, so that reads will not return EOF
-        Lseek(fileno, DiskSize - sizeof(int), 0);	
+	label.magic = MagicNumber;  
+	label.sectorSize = SectorSize;
+	label.sectorsPerTrack = SectorsPerTrack;
+	label.numTracks = NumTracks;
+	WriteFile(fileno, (char *) &label, labelSize);	// write the label
+
+	// need to write at end of file, so that it can all be mapped
+        Lseek(fileno, DiskSize(labelSize) - sizeof(int), 0);	
 	WriteFile(fileno, (char *)&tmp, sizeof(int));  
     }
+    numSectors = NumSectors;
+    imageSize = DiskSize(labelSize);
+    image = MapFile(fileno, imageSize);
+    sectors = image + labelSize;
     active = false;
 }
 
 //----------------------------------------------------------------------
 // Disk::~Disk()
-// 	Clean up disk simulation, by closing the UNIX file representing the
-//	disk.
+// 	Clean up disk simulation, by writing back and closing the UNIX
+//	file representing the disk.
 //----------------------------------------------------------------------
 
 Disk::~Disk()
 {
+    UnmapFile(image, imageSize);
     Close(fileno);
 }
 
@@ -100,7 +142,8 @@ PrintSector (bool writing, int sector, const char *data)
 //----------------------------------------------------------------------
 // Disk::ReadRequest/WriteRequest
 // 	Simulate a request to read/write a single disk sector
-//	   Do the read/write immediately to the UNIX file
+//	   Do the read/write immediately, copying to or from the
+//	      UNIX file, in memory
 //	   Set up an interrupt handler to be called later,
 //	      that will notify the caller when the simulator says
 //	      the operation has completed.
@@ -118,11 +161,10 @@ Disk::ReadRequest(int sectorNumber, char* data)
     int ticks = ComputeLatency(sectorNumber, false);
 
     ASSERT(!active);				// only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (sectorNumber < numSectors));
     
     DEBUG('d', "Reading from sector %d\n", sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    bcopy(sectors + SectorSize * sectorNumber, data, SectorSize);
     if (DebugIsEnabled('d'))
 	PrintSector(false, sectorNumber, data);
     
@@ -138,11 +180,10 @@ Disk::WriteRequest(int sectorNumber, const char* data)
     int ticks = ComputeLatency(sectorNumber, true);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (sectorNumber < numSectors));
     
     DEBUG('d', "Writing to sector %d\n", sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    bcopy(data, sectors + SectorSize * sectorNumber, SectorSize);
     if (DebugIsEnabled('d'))
 	PrintSector(true, sectorNumber, data);
     
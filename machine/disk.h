@@ -32,7 +32,14 @@
 // requests to read or write portions of the disk return immediately,
 // and an interrupt is invoked later to signal that the operation completed.
 //
-// The physical disk is in fact simulated via operations on a UNIX file.
+// The physical disk is in fact simulated via operations on a UNIX file,
+// mapped into memory, so that a transfer is just a copy.  The file
+// starts with a header giving the geometry of the disk, so that disks
+// of any number of tracks, of any number of sectors, can be used
+// without recompiling; the geometry of a new disk is taken from
+// SectorsPerTrack and NumTracks (see the -geom flag in system.cc).
+// The sector size is fixed, though: the file system lays out its data
+// structures to fit exactly in a sector.
 //
 // To make life a little more realistic, the simulated time for
 // each operation reflects a "track buffer" -- RAM to store the contents
@@ -47,10 +54,12 @@
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
 
 const int SectorSize = 128;	// number of bytes per disk sector
-const int SectorsPerTrack = 32;	// number of sectors per disk track 
-const int NumTracks = 32;	// number of tracks per disk
-const int NumSectors = SectorsPerTrack * NumTracks;
-					// total # of sectors per disk
+extern int SectorsPerTrack;	// number of sectors per disk track 
+extern int NumTracks;		// number of tracks per disk
+extern int NumSectors;		// total # of sectors per disk
+				// (set by the Disk constructor; a
+				// volume of several disks sets it to
+				// their total, cf. SynchDisk)
 
 class Disk {
   public:
@@ -77,6 +86,10 @@ class Disk {
 
   private:
     int fileno;				// UNIX file number for simulated disk 
+    char *image;			// ... mapped into memory
+    int imageSize;			// Bytes in the file
+    int numSectors;			// Sectors on this disk
+    char *sectors;			// Where sector 0 starts in "image"
     VoidFunctionPtr handler;		// Interrupt handler, to be invoked 
 					// when any disk request finishes
     void* handlerArg;			// Argument to interrupt handler 
@@ -173,7 +173,7 @@ Interrupt::OneTick()
 					// for a context switch, ok to do it now
 	yieldOnReturn = false;
  	status = SystemMode;		// yield is a kernel routine
-	currentThread->Yield();
+	currentThread->Yield(true);
 	status = old;
     }
 }
@@ -242,6 +242,7 @@ Interrupt::Halt()
 {
     printf("Machine halting!\n\n");
     stats->Print();
+    scheduler->PrintThreadStats();
     Cleanup();     // Never returns.
 }
 
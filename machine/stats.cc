@@ -22,6 +22,7 @@ Statistics::Statistics()
     numDiskReads = numDiskWrites = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
+    numTLBFlushes = 0;
 }
 
 //----------------------------------------------------------------------
@@ -39,6 +40,9 @@ Statistics::Print()
     printf("Console I/O: reads %d, writes %d\n", numConsoleCharsRead, 
 	numConsoleCharsWritten);
     printf("Paging: faults %d\n", numPageFaults);
+    if (numTLBFlushes > 0)	// a tick is roughly a microsecond
+	printf("TLB: flushes %d, %.1f per second\n", numTLBFlushes,
+	    numTLBFlushes * 1000000.0 / totalTicks);
     printf("Network I/O: packets received %d, sent %d\n", numPacketsRecvd, 
 	numPacketsSent);
 }
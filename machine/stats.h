@@ -35,6 +35,8 @@ class Statistics {
     int numPageFaults;		// number of virtual memory page faults
     int numPacketsSent;		// number of packets sent over the network
     int numPacketsRecvd;	// number of packets received over the network
+    int numTLBFlushes;		// number of times the TLB was invalidated
+				// on an address space switch
 
     Statistics(); 		// initialize everything to zero
 
@@ -32,8 +32,10 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/mman.h>
+#include <dirent.h>
 #ifdef HOST_i386
 #include <sys/time.h>
 #endif
@@ -221,6 +223,86 @@ Unlink(const char *name)
     return unlink(name);
 }
 
+//----------------------------------------------------------------------
+// MakeDirectory/RemoveDirectory
+// 	Create/delete a directory.  Return true if successful.
+//----------------------------------------------------------------------
+
+bool 
+MakeDirectory(const char *name)
+{
+    return mkdir(name, 0777) == 0;
+}
+
+bool 
+RemoveDirectory(const char *name)
+{
+    return rmdir(name) == 0;
+}
+
+//----------------------------------------------------------------------
+// IsDirectory
+// 	Return true if "name" is a directory.
+//----------------------------------------------------------------------
+
+bool
+IsDirectory(const char *name)
+{
+    struct stat status;
+
+    return stat(name, &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+//----------------------------------------------------------------------
+// OpenDirectory/ReadDirectory/CloseDirectory
+// 	List the names in a directory: open it (NULL if it cannot be),
+//	return its names one at a time ("." and ".." among them), and
+//	NULL when there are no more, and close it.
+//----------------------------------------------------------------------
+
+void *
+OpenDirectory(const char *name)
+{
+    return opendir(name);
+}
+
+const char *
+ReadDirectory(void *dir)
+{
+    struct dirent *entry = readdir((DIR *) dir);
+
+    return (entry != NULL) ? entry->d_name : NULL;
+}
+
+void
+CloseDirectory(void *dir)
+{
+    closedir((DIR *) dir);
+}
+
+//----------------------------------------------------------------------
+// MapFile/UnmapFile
+// 	Map the first "size" bytes of an open file into memory, shared,
+//	so that changes to the memory are changes to the file, and undo
+//	it, once they are written back.  Abort on error.
+//----------------------------------------------------------------------
+
+char *
+MapFile(int fd, int size)
+{
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ASSERT(addr != MAP_FAILED);
+    return (char *) addr;
+}
+
+void
+UnmapFile(char *addr, int size)
+{
+    msync(addr, size, MS_SYNC);
+    munmap(addr, size);
+}
+
 //----------------------------------------------------------------------
 // OpenSocket
 // 	Open an interprocess communication (IPC) connection.  For now, 
@@ -28,6 +28,19 @@ extern void Lseek(int fd, int offset, int whence);
 extern int Tell(int fd);
 extern void Close(int fd);
 extern bool Unlink(const char *name);
+extern bool MakeDirectory(const char *name);
+extern bool RemoveDirectory(const char *name);
+extern bool IsDirectory(const char *name);
+
+// Listing the names in a directory, one at a time.
+extern void *OpenDirectory(const char *name);
+extern const char *ReadDirectory(void *dir);
+extern void CloseDirectory(void *dir);
+
+// Map an open file into memory, and unmap it, writing it back.
+// For simulating the disk.
+extern char *MapFile(int fd, int size);
+extern void UnmapFile(char *addr, int size);
 
 // Interprocess communication operations, for simulating the network
 extern int OpenSocket();
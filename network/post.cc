@@ -18,6 +18,7 @@
 
 #include "copyright.h"
 #include "post.h"
+#include "task.h"
 
 //----------------------------------------------------------------------
 // Mail::Mail
@@ -50,6 +51,7 @@ Mail::Mail(PacketHeader pktH, MailHeader mailH, const char *msgData)
 MailBox::MailBox()
 { 
     messages = new SynchList<Mail*>; 
+    arrived = new Semaphore("mail arrived", 0);
 }
 
 //----------------------------------------------------------------------
@@ -63,6 +65,7 @@ MailBox::MailBox()
 MailBox::~MailBox()
 { 
     delete messages; 
+    delete arrived;
 }
 
 //----------------------------------------------------------------------
@@ -102,6 +105,7 @@ MailBox::Put(PacketHeader pktHdr, MailHeader mailHdr, const char *data)
     messages->Append(mail);		// put on the end of the list of 
 					// arrived messages, and wake up 
 					// any waiters
+    arrived->V();			// one more message to Take
 }
 
 //----------------------------------------------------------------------
@@ -120,8 +124,27 @@ void
 MailBox::Get(PacketHeader *pktHdr, MailHeader *mailHdr, char *data) 
 { 
     DEBUG('n', "Waiting for mail in mailbox\n");
+    arrived->P();			// wait until there is a message
+    Take(pktHdr, mailHdr, data);
+}
+
+//----------------------------------------------------------------------
+// MailBox::Take
+// 	Second half of Get: remove the message we were granted by
+//	Arrival() from the mailbox.  Kernel tasks, which cannot block in
+//	Get, wait with TASK_P(box->Arrival()) and then call Take.
+//
+//	"pktHdr" -- address to put: source, destination machine ID's
+//	"mailHdr" -- address to put: source, destination mailbox ID's
+//	"data" -- address to put: payload message data
+//----------------------------------------------------------------------
+
+void 
+MailBox::Take(PacketHeader *pktHdr, MailHeader *mailHdr, char *data) 
+{ 
     Mail *mail = messages->Remove();	// remove message from list;
-					// will wait if list is empty
+					// never waits, Arrival() told
+					// us there is one
 
     *pktHdr = mail->pktHdr;
     *mailHdr = mail->mailHdr;
@@ -137,16 +160,55 @@ MailBox::Get(PacketHeader *pktHdr, MailHeader *mailHdr, char *data)
 }
 
 //----------------------------------------------------------------------
-// PostalHelper, ReadAvail, WriteDone
+// PostalWorker
+// 	The "postal worker": a kernel task (cf. task.h) that waits for 
+//	messages to arrive from the network, and delivers them to the 
+//	correct mailbox.  Being a task rather than a thread, it costs no
+//	stack, and no context switch, while it waits.
+//----------------------------------------------------------------------
+
+class PostalWorker : public Task {
+  public:
+    PostalWorker(PostOffice *po);
+    ~PostalWorker();
+
+    TaskStatus Run();
+
+  private:
+    PostOffice *postOffice;		// Post office we deliver for
+    char *buffer;			// Holds each incoming packet
+};
+
+PostalWorker::PostalWorker(PostOffice *po) : Task("postal worker")
+{
+    postOffice = po;
+    buffer = new char[MaxPacketSize];
+}
+
+PostalWorker::~PostalWorker()
+{
+    delete [] buffer;
+}
+
+TaskStatus
+PostalWorker::Run()
+{
+    TASK_BEGIN();
+    for (;;) {
+        TASK_P(postOffice->PacketArrival());	// wait for a message
+	postOffice->DeliverPacket(buffer);
+    }
+    TASK_END();
+}
+
+//----------------------------------------------------------------------
+// ReadAvail, WriteDone
 // 	Dummy functions because C++ can't indirectly invoke member functions
-//	The first is forked as part of the "postal worker thread; the
-//	later two are called by the network interrupt handler.
+//	These are called by the network interrupt handler.
 //
 //	"arg" -- pointer to the Post Office managing the Network
 //----------------------------------------------------------------------
 
-static void PostalHelper(void* arg)
-{ PostOffice* po = (PostOffice *) arg; po->PostalDelivery(); }
 static void ReadAvail(void* arg)
 { PostOffice* po = (PostOffice *) arg; po->IncomingPacket(); }
 static void WriteDone(void* arg)
@@ -158,9 +220,9 @@ static void WriteDone(void* arg)
 //	Also initialize the network device, to allow post offices
 //	on different machines to deliver messages to one another.
 //
-//      We use a separate thread "the postal worker" to wait for messages 
-//	to arrive, and deliver them to the correct mailbox.  Note that
-//	delivering messages to the mailboxes can't be done directly
+//      We use a separate kernel task "the postal worker" to wait for 
+//	messages to arrive, and deliver them to the correct mailbox.  Note 
+//	that delivering messages to the mailboxes can't be done directly
 //	by the interrupt handlers, because it requires a Lock.
 //
 //	"addr" is this machine's network ID 
@@ -187,11 +249,11 @@ PostOffice::PostOffice(NetworkAddress addr, double reliability, int nBoxes)
     network = new Network(addr, reliability, ReadAvail, WriteDone, this);
 
 
-// Finally, create a thread whose sole job is to wait for incoming messages,
+// Finally, start a task whose sole job is to wait for incoming messages,
 //   and put them in the right mailbox. 
-    Thread *t = new Thread("postal worker");
+    PostalWorker *worker = new PostalWorker(this);
 
-    t->Fork(PostalHelper, this);
+    worker->Start();
 }
 
 //----------------------------------------------------------------------
@@ -209,38 +271,36 @@ PostOffice::~PostOffice()
 }
 
 //----------------------------------------------------------------------
-// PostOffice::PostalDelivery
-// 	Wait for incoming messages, and put them in the right mailbox.
+// PostOffice::DeliverPacket
+// 	Put one incoming message in the right mailbox.  Called by the 
+//	postal worker once PacketArrival() has told it a packet is there.
 //
 //      Incoming messages have had the PacketHeader stripped off,
 //	but the MailHeader is still tacked on the front of the data.
+//
+//	"buffer" -- space to hold the incoming packet
 //----------------------------------------------------------------------
 
 void
-PostOffice::PostalDelivery()
+PostOffice::DeliverPacket(char *buffer)
 {
     PacketHeader pktHdr;
     MailHeader mailHdr;
-    char *buffer = new char[MaxPacketSize];
 
-    for (;;) {
-        // first, wait for a message
-        messageAvailable->P();	
-        pktHdr = network->Receive(buffer);
-
-        mailHdr = *(MailHeader *)buffer;
-        if (DebugIsEnabled('n')) {
-	    printf("Putting mail into mailbox: ");
-	    PrintHeader(pktHdr, mailHdr);
-        }
-
-	// check that arriving message is legal!
-	ASSERT(0 <= mailHdr.to && mailHdr.to < numBoxes);
-	ASSERT(mailHdr.length <= MaxMailSize);
-
-	// put into mailbox
-        boxes[mailHdr.to].Put(pktHdr, mailHdr, buffer + sizeof(MailHeader));
+    pktHdr = network->Receive(buffer);
+
+    mailHdr = *(MailHeader *)buffer;
+    if (DebugIsEnabled('n')) {
+	printf("Putting mail into mailbox: ");
+	PrintHeader(pktHdr, mailHdr);
     }
+
+    // check that arriving message is legal!
+    ASSERT(0 <= mailHdr.to && mailHdr.to < numBoxes);
+    ASSERT(mailHdr.length <= MaxMailSize);
+
+    // put into mailbox
+    boxes[mailHdr.to].Put(pktHdr, mailHdr, buffer + sizeof(MailHeader));
 }
 
 //----------------------------------------------------------------------
@@ -313,6 +373,36 @@ PostOffice::Receive(int box, PacketHeader *pktHdr,
     ASSERT(mailHdr->length <= MaxMailSize);
 }
 
+//----------------------------------------------------------------------
+// PostOffice::MailArrival, PostOffice::Collect
+// 	Receive, split in two for kernel tasks, which must not block:
+//	TASK_P(postOffice->MailArrival(box)) waits for a message to be
+//	in "box", and Collect then retrieves it.
+//
+//	"box" -- mailbox ID in which to look for message
+//	"pktHdr" -- address to put: source, destination machine ID's
+//	"mailHdr" -- address to put: source, destination mailbox ID's
+//	"data" -- address to put: payload message data
+//----------------------------------------------------------------------
+
+Semaphore *
+PostOffice::MailArrival(int box)
+{
+    ASSERT((box >= 0) && (box < numBoxes));
+
+    return boxes[box].Arrival();
+}
+
+void
+PostOffice::Collect(int box, PacketHeader *pktHdr, 
+				MailHeader *mailHdr, char* data)
+{
+    ASSERT((box >= 0) && (box < numBoxes));
+
+    boxes[box].Take(pktHdr, mailHdr, data);
+    ASSERT(mailHdr->length <= MaxMailSize);
+}
+
 //----------------------------------------------------------------------
 // PostOffice::IncomingPacket
 // 	Interrupt handler, called when a packet arrives from the network.
@@ -86,8 +86,17 @@ class MailBox {
    				// Atomically get a message out of the 
 				// mailbox (and wait if there is no message 
 				// to get!)
+
+    Semaphore *Arrival() { return arrived; }
+				// Counts the messages waiting in the box;
+				// a kernel Task can TASK_P on it, and
+				// then Take the message it was granted
+    void Take(PacketHeader *pktHdr, MailHeader *mailHdr, char *data);
+				// Get, once Arrival() has been P'ed
+
   private:
     SynchList<Mail*> *messages;	// A mailbox is just a list of arrived messages
+    Semaphore *arrived;		// V'ed for every message Put in the box
 };
 
 // The following class defines a "Post Office", or a collection of 
@@ -117,8 +126,19 @@ class PostOffice {
     				// Retrieve a message from "box".  Wait if
 				// there is no message in the box.
 
-    void PostalDelivery();	// Wait for incoming messages, 
-				// and then put them in the correct mailbox
+    Semaphore *MailArrival(int box);
+    void Collect(int box, PacketHeader *pktHdr,
+		MailHeader *mailHdr, char *data);
+				// Receive, for kernel tasks that cannot
+				// block: TASK_P(MailArrival(box)), then
+				// Collect the message
+
+    Semaphore *PacketArrival() { return messageAvailable; }
+    void DeliverPacket(char *buffer);
+				// Take one incoming message off the 
+				// network, and put it in the correct 
+				// mailbox.  Run by the postal worker
+				// task each time PacketArrival() is P'ed
 
     void PacketSent();		// Interrupt handler, called when outgoing 
 				// packet has been put on network; next 
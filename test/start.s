@@ -130,6 +130,30 @@ Yield:
 	j	$31
 	.end Yield
 
+	.globl Mkdir
+	.ent	Mkdir
+Mkdir:
+	addiu $2,$0,SC_Mkdir
+	syscall
+	j	$31
+	.end Mkdir
+
+	.globl Rmdir
+	.ent	Rmdir
+Rmdir:
+	addiu $2,$0,SC_Rmdir
+	syscall
+	j	$31
+	.end Rmdir
+
+	.globl GetThreadStats
+	.ent	GetThreadStats
+GetThreadStats:
+	addiu $2,$0,SC_GetThreadStats
+	syscall
+	j	$31
+	.end GetThreadStats
+
 /* dummy function to keep gcc happy */
         .globl  __main
         .ent    __main
@@ -59,6 +59,11 @@ public:
 	void Prepend(Item item);					// Put item at the beginning of the list.
 	void Append(Item item);						// Put item at the end of the list.
 	Item Remove();								// Take item off the front of the list.
+	Item RemoveMatch(bool (*match)(Item, void*), void* arg);
+												// Take the first item for which
+												// "match" is true off the list.
+	Item Find(bool (*match)(Item, void*), void* arg);
+												// Same, but leave it on the list.
 
 	void Apply(void (*func)(Item));				// Apply "func" to all elements in list.
 
@@ -182,6 +187,58 @@ Item List<Item>::Remove()
 	return SortedRemove(NULL);  // Same as SortedRemove, but ignore the key.
 }
 
+//----------------------------------------------------------------------------------------
+// List::RemoveMatch
+// Remove the first "item" of the list for which "match(item, arg)" returns true.
+//
+// Returns: The removed item, Item() if no item on the list matches.
+//----------------------------------------------------------------------------------------
+
+template <class Item>
+Item List<Item>::RemoveMatch(bool (*match)(Item, void*), void* arg)
+{
+	ListNode *prev = NULL;
+
+	for (ListNode *ptr = first; ptr != NULL; prev = ptr, ptr = ptr->next) {
+
+		if (!match(ptr->item, arg))
+			continue;
+
+		// Unlink the element, fixing "first" and "last" if needed.
+
+		if (prev == NULL)
+			first = ptr->next;
+		else
+			prev->next = ptr->next;
+
+		if (last == ptr)
+			last = prev;
+
+		Item thing = ptr->item;
+		delete ptr;
+		return thing;
+	}
+
+	return Item();
+}
+
+//----------------------------------------------------------------------------------------
+// List::Find
+// Look for the first "item" of the list for which "match(item, arg)" returns true.
+//
+// Returns: The item, Item() if no item on the list matches.
+//----------------------------------------------------------------------------------------
+
+template <class Item>
+Item List<Item>::Find(bool (*match)(Item, void*), void* arg)
+{
+	for (ListNode *ptr = first; ptr != NULL; ptr = ptr->next)
+		if (match(ptr->item, arg))
+			return ptr->item;
+
+	return Item();
+}
+
 //----------------------------------------------------------------------------------------
 // List::Apply
 // Apply a function to each item on the list, by walking through the list, one element
@@ -7,10 +7,15 @@
 //
 // Most of this file is not needed until later assignments.
 //
-// USAGE: nachos -d <debugflags> -rs <random seed #>
-//               -s -x <nachos file> -c <consoleIn> <consoleOut>
-//               -f -cp <unix file> <nachos file>
-//               -p <nachos file> -r <nachos file> -l -D -t
+// USAGE: nachos -d <debugflags> -rs <random seed #> -prof
+//               -s -aff -gang -x <nachos file> -c <consoleIn> <consoleOut>
+//               -f -lfs -nc -geom <sectors per track> <tracks>
+//               -stripe <disks> <sectors>
+//               -cp <unix file> <nachos file>
+//               -imp <unix file> <nachos file>
+//               -exp <nachos file> <unix file>
+//               -p <nachos file> -r <nachos file> -md <nachos dir>
+//               -rd <nachos dir> -l -D -frag -defrag -t
 //               -n <network reliability> -m <machine id>
 //               -o <other machine id>
 //               -z
@@ -18,20 +23,34 @@
 // GENERAL OPTIONS:
 //    -d causes certain debugging messages to be printed (cf. utility.h).
 //    -rs causes Yield to occur at random (but repeatable) spots.
+//    -prof profiles Lock/Condition/Semaphore contention, reported at shutdown.
 //    -z prints the copyright message.
 //
 // USER_PROGRAM OPTIONS:
 //    -s causes user programs to be executed in single-step mode.
+//    -aff prefers ready threads sharing the loaded address space.
+//    -gang co-schedules the threads of each address space for a shared quantum.
 //    -x runs a user program.
 //    -c tests the console.
 //
 // FILESYS OPTIONS:
 //    -f causes the physical disk to be formatted.
+//    -lfs lays out the disk being formatted as a log.
+//    -nc disables the disk sector cache.
+//    -geom sets the geometry of a new disk (or of the disk, with -f).
+//    -stripe stripes the disk over DISK0..DISKn-1, <sectors> at a time;
+//       it must be given whenever the disk is used.
 //    -cp copies a file from UNIX to Nachos.
+//    -imp copies a file, or a whole directory, from UNIX to Nachos, in bulk.
+//    -exp copies a file from Nachos to UNIX, in bulk.
 //    -p prints a Nachos file to stdout.
 //    -r removes a Nachos file from the file system.
+//    -md creates a Nachos directory.
+//    -rd removes an empty Nachos directory.
 //    -l lists the contents of the Nachos directory.
 //    -D prints the contents of the entire file system.
+//    -frag prints how fragmented the files and the free space are.
+//    -defrag starts the defragmenter, in the background.
 //    -t tests the performance of the Nachos file system.
 //
 // NETWORK OPTIONS:
@@ -68,6 +87,8 @@
 //void ThreadTest();
 void Test(const char* testCase);
 void Copy(const char *unixFile, const char *nachosFile);
+void Import(const char *unixFile, const char *nachosFile);
+void Export(const char *nachosFile, const char *unixFile);
 void Print(const char *file);
 void PerformanceTest(void);
 void StartProcess(const char *file);
@@ -148,6 +169,18 @@ int main(int argc, char **argv)
 			Copy(*(argv + 1), *(argv + 2));
 			argCount = 3;
 		}
+		// Import from UNIX to Nachos, in bulk.
+		else if (!strcmp(*argv, "-imp")) {
+			ASSERT(argc > 2);
+			Import(*(argv + 1), *(argv + 2));
+			argCount = 3;
+		}
+		// Export from Nachos to UNIX, in bulk.
+		else if (!strcmp(*argv, "-exp")) {
+			ASSERT(argc > 2);
+			Export(*(argv + 1), *(argv + 2));
+			argCount = 3;
+		}
 		// Print a Nachos file.
 		else if (!strcmp(*argv, "-p")) {
 			ASSERT(argc > 1);
@@ -160,6 +193,18 @@ int main(int argc, char **argv)
 			fileSystem->Remove(*(argv + 1));
 			argCount = 2;
 		}
+		// Create Nachos directory.
+		else if (!strcmp(*argv, "-md")) {
+			ASSERT(argc > 1);
+			fileSystem->Mkdir(*(argv + 1));
+			argCount = 2;
+		}
+		// Remove Nachos directory.
+		else if (!strcmp(*argv, "-rd")) {
+			ASSERT(argc > 1);
+			fileSystem->Rmdir(*(argv + 1));
+			argCount = 2;
+		}
 		// List Nachos directory.
 		else if (!strcmp(*argv, "-l")) {
 			fileSystem->List();
@@ -168,6 +213,14 @@ int main(int argc, char **argv)
 		else if (!strcmp(*argv, "-D")) {
 			fileSystem->Print();
 		}
+		// Print fragmentation report.
+		else if (!strcmp(*argv, "-frag")) {
+			fileSystem->PrintFragmentation();
+		}
+		// Start the defragmenter.
+		else if (!strcmp(*argv, "-defrag")) {
+			fileSystem->Defragment();
+		}
 		// Performance test.
 		else if (!strcmp(*argv, "-t")) {
 			PerformanceTest();
@@ -37,6 +37,31 @@ Scheduler::Scheduler()
 
 	for (int p = 0; p <= _MAX_PRIORITY; p++)
 		readyList[p] = new List<Thread*>;
+
+	// Inicializamos la cola de tareas; el dispatcher se crea con la primer tarea.
+
+	readyTasks = new List<Task*>;
+	taskDispatcher = NULL;
+	dispatcherIdle = false;
+
+	threadStats = new List<ThreadStats*>;
+	finishedStats = 0;
+
+	// Sin afinidad por defecto; todavia no hay ningun espacio de direcciones cargado.
+
+	spaceAffinity = false;
+	affinityRun = 0;
+
+	// Gang scheduling desactivado por defecto.
+
+	gangScheduling = false;
+	gangStart = 0;
+
+#ifdef USER_PROGRAM
+	loadedSpace = NULL;
+	gangs = new List<Gang*>;
+	runningGang = NULL;
+#endif
 }
 
 //----------------------------------------------------------------------------------------
@@ -54,6 +79,20 @@ Scheduler::~Scheduler()
 		delete readyList[p];
 		readyList[p] = NULL;
 	}
+
+	delete readyTasks;
+
+	while (!threadStats->IsEmpty())
+		delete threadStats->Remove();
+
+	delete threadStats;
+
+#ifdef USER_PROGRAM
+	while (!gangs->IsEmpty())
+		delete gangs->Remove();
+
+	delete gangs;
+#endif
 }
 
 //----------------------------------------------------------------------------------------
@@ -78,11 +117,44 @@ void Scheduler::ReadyToRun(Thread *thread)
 	readyList[p]->Append(thread);
 }
 
+//----------------------------------------------------------------------------------------
+// SameSpace
+// Funcion auxiliar para List::RemoveMatch: indica si el thread corre en el espacio de
+// direcciones "space".
+//----------------------------------------------------------------------------------------
+
+#ifdef USER_PROGRAM
+static bool SameSpace(Thread* thread, void* space)
+{
+	return thread->space == (AddrSpace*) space;
+}
+
+static bool OtherGang(Thread* thread, void* space)
+{
+	return thread->space != NULL && thread->space != (AddrSpace*) space;
+}
+#endif
+
 //----------------------------------------------------------------------------------------
 // Scheduler::FindNextToRun
 // Return the next thread to be scheduled onto the CPU. If there are no ready threads,
 // return NULL.
 //
+// Un thread que cede la CPU (Yield, o el timer) no se la cede a uno de menor prioridad:
+// en ese caso retornamos NULL para que siga corriendo. Asi un thread de fondo (ver
+// _BACKGROUND_PRIORITY) solo corre cuando los demas estan bloqueados.
+//
+// Si la afinidad esta activada, dentro de la cola de mayor prioridad se prefiere el
+// primer thread del espacio de direcciones cargado, lo que evita salvar y recargar la
+// tabla de paginas (o vaciar la TLB). Para no postergar indefinidamente al resto, luego
+// de AFFINITY_MAX_RUN elecciones seguidas por afinidad se toma el primero de la cola.
+//
+// Con gang scheduling, mientras dure el quantum del gang actual se eligen sus threads,
+// y si no hay ninguno listo, los threads del kernel; si el que cede la CPU es del gang y
+// tampoco hay de estos, retornamos NULL para que siga corriendo. Vencido el quantum se
+// elige el primer thread de otro gang, y si no hay ninguno listo, el quantum del gang
+// actual se renueva.
+//
 // Side effect: Thread is removed from the ready list.
 //----------------------------------------------------------------------------------------
 
@@ -92,9 +164,65 @@ Thread* Scheduler::FindNextToRun()
 
 	// Buscamos el primer thread de la cola con mas prioridad.
 
-	for (int p = _MAX_PRIORITY; p >= 0; p--)
-		if (!(readyList[p]->IsEmpty()))
+	for (int p = _MAX_PRIORITY; p >= 0; p--) {
+
+		if (currentThread->getStatus() == RUNNING && currentThread->getPriority() > p)
+			return NULL;
+
+		if (readyList[p]->IsEmpty())
+			continue;
+
+#ifdef USER_PROGRAM
+		if (gangScheduling && runningGang != NULL) {
+
+			AddrSpace* space = runningGang->space;
+			Thread* thread;
+
+			if (stats->totalTicks - gangStart >= GANG_QUANTUM) {
+
+				thread = readyList[p]->RemoveMatch(OtherGang, space);
+
+				if (thread != NULL) {
+					if (readyList[p]->Find(SameSpace, space) != NULL
+						|| currentThread->space == space)
+						runningGang->preempted++;
+					return thread;
+				}
+
+				RenewGangQuantum();
+			}
+
+			thread = readyList[p]->RemoveMatch(SameSpace, space);
+
+			if (thread == NULL)
+				thread = readyList[p]->RemoveMatch(SameSpace, NULL);
+
+			if (thread != NULL)
+				return thread;
+
+			// Un thread del gang que cede la CPU (Yield) sigue corriendo.
+
+			if (currentThread->getStatus() == RUNNING && currentThread->space == space
+				&& currentThread->getPriority() >= p)
+				return NULL;
+
 			return readyList[p]->Remove();
+		}
+
+		if (spaceAffinity && loadedSpace != NULL && affinityRun < AFFINITY_MAX_RUN) {
+
+			Thread* thread = readyList[p]->RemoveMatch(SameSpace, loadedSpace);
+
+			if (thread != NULL) {
+				affinityRun++;
+				return thread;
+			}
+		}
+#endif
+
+		affinityRun = 0;
+		return readyList[p]->Remove();
+	}
 
 	// Si no hay threads listos, retornamos NULL.
 
@@ -112,23 +240,31 @@ Thread* Scheduler::FindNextToRun()
 // The global variable currentThread becomes nextThread.
 //
 // "nextThread" is the thread to be put into the CPU.
+// "preempted" indica si el thread actual pierde la CPU por el timer.
 //----------------------------------------------------------------------------------------
 
-void Scheduler::Run(Thread *nextThread)
+void Scheduler::Run(Thread *nextThread, bool preempted)
 {
 	Thread *oldThread = currentThread;
 
 #ifdef USER_PROGRAM		// Ignore until running user programs.
 
-	// If this thread is a user program, save the user's CPU registers.
+	// If this thread is a user program, save the user's CPU registers. El estado del
+	// espacio de direcciones se salva recien cuando se cargue otro (ver LoadSpace).
 
-	if (currentThread->space != NULL) {
+	if (currentThread->space != NULL)
 		currentThread->SaveUserState();
-		currentThread->space->SaveState();
-    }
 
 #endif
 
+	// Contabilizamos el cambio de contexto: involuntario si el timer le quito la CPU al
+	// thread, voluntario si se bloqueo, finaliza o cedio la CPU con Yield.
+
+	if (preempted)
+		oldThread->getStats()->involuntarySwitches++;
+	else
+		oldThread->getStats()->voluntarySwitches++;
+
 	// Check if the old thread had an undetected stack overflow.
 
 	oldThread->CheckOverflow();
@@ -141,6 +277,11 @@ void Scheduler::Run(Thread *nextThread)
     DEBUG('t', "Switching from thread \"%s\" to thread \"%s\"\n",
           oldThread->getName(), nextThread->getName());
 
+#ifdef USER_PROGRAM
+	if (gangScheduling)
+		SwitchGang(nextThread);
+#endif
+
 	// This is a machine-dependent assembly language routine defined in switch.s. You may
 	// have to think a bit to figure out what happens after this, both from the point
 	// of view of the thread and from the perspective of the "outside world".
@@ -160,17 +301,151 @@ void Scheduler::Run(Thread *nextThread)
 
 #ifdef USER_PROGRAM
 
-	// If there is an address space to restore, do it.
+	// If there is an address space to restore, do it. Los threads del kernel no usan la
+	// tabla de paginas, por lo que el espacio cargado se mantiene mientras corren.
 
 	if (currentThread->space != NULL) {
 		currentThread->RestoreUserState();
-		currentThread->space->RestoreState();
+		LoadSpace(currentThread->space);
     }
 
 #endif
 
 }
 
+#ifdef USER_PROGRAM
+
+//----------------------------------------------------------------------------------------
+// Gang::Gang
+// Inicializa un gang, con su contabilidad en cero.
+//
+// "gangSpace" es el espacio de direcciones compartido por los threads del gang.
+//----------------------------------------------------------------------------------------
+
+Gang::Gang(AddrSpace* gangSpace)
+{
+	space = gangSpace;
+	quanta = 0;
+	ticks = 0;
+	dispatches = 0;
+	preempted = 0;
+}
+
+//----------------------------------------------------------------------------------------
+// IsGangOf
+// Funcion auxiliar para buscar en la lista de gangs el gang de un espacio de direcciones.
+//----------------------------------------------------------------------------------------
+
+static bool IsGangOf(Gang* gang, void* space)
+{
+	return gang->space == (AddrSpace*) space;
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::LoadSpace
+// Carga un espacio de direcciones en la maquina. Si ya es el espacio cargado no hace
+// nada; si no, salva el estado del espacio anterior y restaura el del nuevo.
+//
+// "space" es el espacio de direcciones a cargar.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::LoadSpace(AddrSpace* space)
+{
+	if (space == loadedSpace)
+		return;
+
+	DEBUG('t', "Switching address space %p -> %p\n", loadedSpace, space);
+
+	if (loadedSpace != NULL)
+		loadedSpace->SaveState();
+
+	space->RestoreState();
+	loadedSpace = space;
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::ForgetSpace
+// Se invoca al destruir un espacio de direcciones. Si era el espacio cargado, el
+// proximo LoadSpace no debe salvar su estado.
+//
+// "space" es el espacio de direcciones que se destruye.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::ForgetSpace(AddrSpace* space)
+{
+	if (space == loadedSpace)
+		loadedSpace = NULL;
+
+	// El gang del espacio termina: cerramos su contabilidad y lo eliminamos.
+
+	if (runningGang != NULL && runningGang->space == space) {
+		runningGang->ticks += stats->totalTicks - gangStart;
+		runningGang = NULL;
+	}
+
+	Gang* gang = gangs->RemoveMatch(IsGangOf, space);
+
+	if (gang != NULL) {
+		DEBUG('t', "Gang %p finished: %d quanta, %d ticks, %d dispatches, %d preempted\n",
+			space, gang->quanta, gang->ticks, gang->dispatches, gang->preempted);
+		delete gang;
+	}
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::SwitchGang
+// Contabiliza el despacho de "thread". Si es un thread de usuario de otro gang, cierra el
+// quantum del gang actual y abre uno nuevo para el gang de "thread" (creandolo si es la
+// primera vez que se despacha). Los threads del kernel no cambian el gang actual.
+//
+// "thread" es el thread a despachar.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::SwitchGang(Thread* thread)
+{
+	if (thread->space == NULL)
+		return;
+
+	if (runningGang == NULL || runningGang->space != thread->space) {
+
+		if (runningGang != NULL)
+			runningGang->ticks += stats->totalTicks - gangStart;
+
+		runningGang = gangs->Find(IsGangOf, thread->space);
+
+		if (runningGang == NULL) {
+			runningGang = new Gang(thread->space);
+			gangs->Append(runningGang);
+		}
+
+		DEBUG('t', "Starting quantum of gang %p\n", thread->space);
+
+		runningGang->quanta++;
+		gangStart = stats->totalTicks;
+
+	} else if (stats->totalTicks - gangStart >= GANG_QUANTUM)
+		RenewGangQuantum();
+
+	runningGang->dispatches++;
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::RenewGangQuantum
+// Cierra el quantum vencido del gang actual y le abre uno nuevo, cuando no hay otro gang
+// al que cederle la CPU.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::RenewGangQuantum()
+{
+	DEBUG('t', "Renewing quantum of gang %p\n", runningGang->space);
+
+	runningGang->ticks += stats->totalTicks - gangStart;
+	runningGang->quanta++;
+	gangStart = stats->totalTicks;
+}
+
+#endif
+
 //----------------------------------------------------------------------------------------
 // Scheduler::RemoveFromList
 // Sacar el primer elemento de una de las colas de prioridades.
@@ -183,6 +458,164 @@ Thread* Scheduler::RemoveFromList(int prior)
 	return readyList[prior]->Remove();
 }
 
+//----------------------------------------------------------------------------------------
+// TaskDispatcher
+// Funcion auxiliar para hacer Fork() del thread dispatcher, ya que C++ no permite
+// punteros a metodos.
+//----------------------------------------------------------------------------------------
+
+static void TaskDispatcher(void* dummy)
+{
+	scheduler->DispatchTasks();
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::StartTask
+// Entrega una tarea nueva al dispatcher. La primera vez se crea el thread dispatcher,
+// por lo que este metodo debe llamarse desde un thread y no desde un manejador de
+// interrupciones.
+//
+// "task" es la tarea a ejecutar.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::StartTask(Task* task)
+{
+	if (taskDispatcher == NULL) {
+		DEBUG('k', "[TASK]: Creating task dispatcher.\n");
+		taskDispatcher = new Thread("task dispatcher");
+		taskDispatcher->Fork(TaskDispatcher, NULL);
+	}
+
+	IntStatus oldLevel = interrupt->SetLevel(IntOff);
+	ReadyTask(task);
+	interrupt->SetLevel(oldLevel);
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::ReadyTask
+// Coloca una tarea en la cola de tareas listas, despertando al dispatcher si estaba
+// dormido. Asume que las interrupciones estan deshabilitadas.
+//
+// "task" es la tarea a reanudar.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::ReadyTask(Task* task)
+{
+	ASSERT(taskDispatcher != NULL);
+	DEBUG('k', "[TASK]: Putting task %s on ready tasks.\n", task->getName());
+
+	readyTasks->Append(task);
+
+	if (dispatcherIdle) {
+		dispatcherIdle = false;
+		ReadyToRun(taskDispatcher);
+	}
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::DispatchTasks
+// Ciclo del thread dispatcher. Reanuda las tareas listas en orden FIFO; cada tarea corre
+// hasta su proximo punto de espera. Las tareas finalizadas se destruyen aqui.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::DispatchTasks()
+{
+	for (;;) {
+
+		IntStatus oldLevel = interrupt->SetLevel(IntOff);
+		Task* task = readyTasks->Remove();
+
+		while (task == NULL) {
+			dispatcherIdle = true;
+			currentThread->Sleep();
+			task = readyTasks->Remove();
+		}
+
+		interrupt->SetLevel(oldLevel);
+
+		DEBUG('k', "[TASK]: Resuming task %s.\n", task->getName());
+
+		if (task->Run() == TASK_DONE) {
+			DEBUG('k', "[TASK]: Task %s finished.\n", task->getName());
+			delete task;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::AddThreadStats
+// Conserva el registro de contabilidad de un thread. Los registros se liberan al destruir
+// el Scheduler, o antes si el thread finaliza (ver FinishThreadStats).
+//
+// "record" es el registro del thread nuevo.
+//----------------------------------------------------------------------------------------
+
+void Scheduler::AddThreadStats(ThreadStats* record)
+{
+	threadStats->Append(record);
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::FinishThreadStats
+// Marca como finalizado el registro de un thread destruido. Para que la lista no crezca
+// sin limite, se conservan solo los ultimos MAX_FINISHED_STATS registros finalizados; el
+// registro finalizado mas viejo se libera.
+//
+// "record" es el registro del thread destruido.
+//----------------------------------------------------------------------------------------
+
+static bool IsFinished(ThreadStats* record, void* dummy)
+{
+	return record->finished;
+}
+
+void Scheduler::FinishThreadStats(ThreadStats* record)
+{
+	record->finished = true;
+
+	if (++finishedStats > MAX_FINISHED_STATS) {
+		delete threadStats->RemoveMatch(IsFinished, NULL);
+		finishedStats--;
+	}
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::GetThreadStats
+// Retorna el registro de contabilidad numero "index", en orden de creacion de los
+// threads (vivos y ultimos finalizados), o NULL si no existe.
+//----------------------------------------------------------------------------------------
+
+static bool CountDown(ThreadStats* record, void* index)
+{
+	return (*(int*) index)-- == 0;
+}
+
+ThreadStats* Scheduler::GetThreadStats(int index)
+{
+	if (index < 0)
+		return NULL;
+
+	return threadStats->Find(CountDown, &index);
+}
+
+//----------------------------------------------------------------------------------------
+// Scheduler::PrintThreadStats
+// Imprime la contabilidad de los threads vivos y de los ultimos finalizados. Antes
+// cerramos el intervalo del thread actual, para que refleje el tiempo hasta este momento.
+//----------------------------------------------------------------------------------------
+
+static void ThreadStatsPrint(ThreadStats* record) {
+	record->Print();
+}
+
+void Scheduler::PrintThreadStats()
+{
+	currentThread->setStatus(currentThread->getStatus());
+
+	printf("Thread accounting:\n");
+	threadStats->Apply(ThreadStatsPrint);
+}
+
 //----------------------------------------------------------------------------------------
 // Scheduler::Print
 // Print the scheduler state -- in other words, the contents of the ready list. For
@@ -193,6 +626,13 @@ static void ThreadPrint(Thread* t) {
 	t->Print();
 }
 
+#ifdef USER_PROGRAM
+static void GangPrint(Gang* g) {
+	printf("Gang %p: %d quanta, %d ticks, %d dispatches, %d preempted\n",
+		g->space, g->quanta, g->ticks, g->dispatches, g->preempted);
+}
+#endif
+
 void Scheduler::Print()
 {
 	for (int p = 0; p <= _MAX_PRIORITY; p++)
@@ -203,4 +643,9 @@ void Scheduler::Print()
 		readyList[p]->Apply(ThreadPrint);
 		printf("\n");
 	}
+
+#ifdef USER_PROGRAM
+	if (gangScheduling)
+		gangs->Apply(GangPrint);
+#endif
 }
@@ -16,7 +16,45 @@
 #include "copyright.h"
 #include "list.h"
 #include "thread.h"
+#include "task.h"
 
+// Cantidad maxima de veces seguidas que FindNextToRun puede saltear al primer thread de
+// una cola para favorecer al espacio de direcciones cargado (evita la inanicion).
+
+#define AFFINITY_MAX_RUN	4
+
+// Quantum compartido por todos los threads de un gang (ver Scheduler::FindNextToRun).
+
+#define GANG_QUANTUM		(10 * TimerTicks)
+
+// Cantidad maxima de registros de contabilidad de threads finalizados que se conservan
+// (ver Scheduler::FinishThreadStats).
+
+#define MAX_FINISHED_STATS	64
+
+
+#ifdef USER_PROGRAM
+
+//----------------------------------------------------------------------------------------
+// La siguiente clase define un "gang": el conjunto de threads que comparten un espacio
+// de direcciones, y que con gang scheduling se planifican juntos durante un quantum.
+// Guarda ademas la contabilidad del gang.
+//----------------------------------------------------------------------------------------
+
+class Gang {
+
+public:
+
+	Gang(AddrSpace* gangSpace);
+
+	AddrSpace* space;				// Espacio de direcciones que identifica al gang.
+	int quanta;						// Cantidad de quantums que le fueron asignados.
+	int ticks;						// Ticks transcurridos durante sus quantums.
+	int dispatches;					// Threads del gang despachados.
+	int preempted;					// Quantums cortados con threads del gang listos.
+};
+
+#endif
 
 //----------------------------------------------------------------------------------------
 // The following class defines the scheduler/dispatcher abstraction -- the data
@@ -44,9 +82,10 @@ public:
 
 	Thread* FindNextToRun();
 
-	// Cause nextThread to start running.
+	// Cause nextThread to start running. "preempted" indica que el thread actual pierde
+	// la CPU por el timer.
 
-	void Run(Thread* nextThread);
+	void Run(Thread* nextThread, bool preempted = false);
 
 	// Print contents of ready list.
 
@@ -56,6 +95,64 @@ public:
 
 	Thread* RemoveFromList(int prior);
 
+	// Metodos asociados a las tareas livianas del kernel (ver task.h).
+
+	// Entrega una tarea nueva al dispatcher, creandolo si todavia no existe.
+
+	void StartTask(Task* task);
+
+	// Coloca una tarea en la cola de tareas listas (asume interrupciones deshabilitadas,
+	// puede invocarse desde un manejador de interrupciones).
+
+	void ReadyTask(Task* task);
+
+	// Ciclo principal del thread dispatcher: ejecuta las tareas listas, o duerme si no
+	// hay ninguna.
+
+	void DispatchTasks();
+
+	// Activa o desactiva la preferencia por threads del espacio de direcciones cargado
+	// (ver FindNextToRun).
+
+	void SetSpaceAffinity(bool enabled) { spaceAffinity = enabled; }
+
+	// Activa o desactiva gang scheduling: los threads de un mismo espacio de direcciones
+	// comparten un quantum de GANG_QUANTUM ticks (ver FindNextToRun).
+
+	void SetGangScheduling(bool enabled) { gangScheduling = enabled; }
+
+	// Metodos asociados a la contabilidad por thread (ver ThreadStats).
+
+	// Conserva el registro de contabilidad de un thread nuevo.
+
+	void AddThreadStats(ThreadStats* record);
+
+	// Marca como finalizado el registro de un thread destruido, descartando el mas viejo
+	// si hay mas de MAX_FINISHED_STATS.
+
+	void FinishThreadStats(ThreadStats* record);
+
+	// Retorna el registro numero "index" (en orden de creacion), NULL si no existe.
+
+	ThreadStats* GetThreadStats(int index);
+
+	// Imprime la contabilidad de los threads vivos y de los ultimos finalizados.
+
+	void PrintThreadStats();
+
+#ifdef USER_PROGRAM
+
+	// Carga "space" en la maquina (tabla de paginas o TLB), salvo que ya sea el espacio
+	// cargado. El espacio anterior recien se salva en este momento.
+
+	void LoadSpace(AddrSpace* space);
+
+	// Avisa que "space" va a ser destruido, para no volver a salvar su estado.
+
+	void ForgetSpace(AddrSpace* space);
+
+#endif
+
 private:
 
 	// Queue of threads that are ready, but not running (old).
@@ -66,6 +163,42 @@ private:
 
 	List<Thread*>* readyList[_MAX_PRIORITY + 1];
 
+	// Datos asociados a las tareas livianas del kernel.
+
+	List<Task*>* readyTasks;		// Cola de tareas listas para ser reanudadas.
+	Thread* taskDispatcher;			// Thread que ejecuta las tareas, NULL si no existe.
+	bool dispatcherIdle;			// Indica si el dispatcher duerme esperando tareas.
+
+	// Registros de contabilidad de los threads vivos y de los ultimos finalizados.
+
+	List<ThreadStats*>* threadStats;
+	int finishedStats;				// Registros de threads finalizados.
+
+	// Datos asociados a la afinidad por espacio de direcciones.
+
+	bool spaceAffinity;				// Preferir threads del espacio cargado.
+	int affinityRun;				// Elecciones seguidas hechas por afinidad.
+
+	// Datos asociados a gang scheduling.
+
+	bool gangScheduling;			// Planificar por gangs.
+	int gangStart;					// Tick en que comenzo el quantum del gang actual.
+
+#ifdef USER_PROGRAM
+	AddrSpace* loadedSpace;			// Espacio cargado en la maquina, NULL si ninguno.
+
+	List<Gang*>* gangs;				// Gangs conocidos, con su contabilidad.
+	Gang* runningGang;				// Gang que posee el quantum, NULL si ninguno.
+
+	// Actualiza el gang que posee el quantum al despachar "thread".
+
+	void SwitchGang(Thread* thread);
+
+	// Renueva el quantum del gang actual, vencido sin otro gang listo.
+
+	void RenewGangQuantum();
+#endif
+
 };
 
 #endif // SCHEDULER_H
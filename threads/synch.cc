@@ -26,6 +26,147 @@
 #include "system.h"
 
 
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+// CONTENTION PROFILER -------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+
+
+// Registros del perfilador, NULL mientras este desactivado.
+
+static List<SynchProfile*>* profiles = NULL;
+
+//----------------------------------------------------------------------------------------
+// SynchProfile::SynchProfile
+// Inicializa un registro del perfilador en cero.
+//
+// "profileKind" es el tipo de primitiva, y "profileName" su nombre (se guarda una copia,
+// ya que el registro sobrevive a la primitiva).
+//----------------------------------------------------------------------------------------
+
+SynchProfile::SynchProfile(const char* profileKind, const char* profileName)
+{
+	kind = profileKind;
+	strncpy(name, profileName, PROFILE_NAME_LEN - 1);
+	name[PROFILE_NAME_LEN - 1] = '\0';
+
+	acquisitions = contended = 0;
+	totalWait = maxWait = totalHold = 0;
+	donations = 0;
+}
+
+//----------------------------------------------------------------------------------------
+// SynchProfile::Acquired
+// Contabiliza una adquisicion.
+//
+// "wasContended" indica si la adquisicion tuvo que esperar.
+// "waited" es la cantidad de ticks que espero.
+//----------------------------------------------------------------------------------------
+
+void SynchProfile::Acquired(bool wasContended, int waited)
+{
+	acquisitions++;
+
+	if (wasContended)
+		contended++;
+
+	totalWait += waited;
+
+	if (waited > maxWait)
+		maxWait = waited;
+}
+
+//----------------------------------------------------------------------------------------
+// SynchProfileStart
+// Activa el perfilador.
+//----------------------------------------------------------------------------------------
+
+void SynchProfileStart()
+{
+	if (profiles == NULL)
+		profiles = new List<SynchProfile*>;
+}
+
+//----------------------------------------------------------------------------------------
+// SynchProfileFor
+// Busca el registro de la primitiva de tipo "kind" y nombre "name", creandolo si es la
+// primera primitiva con ese nombre. Retorna NULL si el perfilador no esta activo.
+//----------------------------------------------------------------------------------------
+
+struct ProfileKey {
+	const char* kind;
+	const char* name;
+};
+
+static bool SameProfile(SynchProfile* profile, void* arg)
+{
+	ProfileKey* key = (ProfileKey*) arg;
+
+	return strcmp(profile->kind, key->kind) == 0
+		&& strncmp(profile->name, key->name, PROFILE_NAME_LEN - 1) == 0;
+}
+
+SynchProfile* SynchProfileFor(const char* kind, const char* name)
+{
+	if (profiles == NULL)
+		return NULL;
+
+	ProfileKey key = { kind, name };
+	SynchProfile* profile = profiles->Find(SameProfile, &key);
+
+	if (profile == NULL) {
+		profile = new SynchProfile(kind, name);
+		profiles->Append(profile);
+	}
+
+	return profile;
+}
+
+//----------------------------------------------------------------------------------------
+// SynchProfileReport
+// Imprime los registros ordenados por tiempo total de espera, de mayor a menor. Los
+// registros que nunca fueron adquiridos se omiten.
+//
+// Los registros no se liberan: las primitivas que siguen vivas (por ejemplo, las del
+// sistema de archivos, que se destruye despues del reporte en Cleanup) los siguen usando.
+//----------------------------------------------------------------------------------------
+
+static void ProfilePrint(SynchProfile* p)
+{
+	printf("%-4s %-24s %8d %8d %10d %8d %10d %6d\n", p->kind, p->name, p->acquisitions,
+		p->contended, p->totalWait, p->maxWait, p->totalHold, p->donations);
+}
+
+void SynchProfileReport()
+{
+	if (profiles == NULL)
+		return;
+
+	List<SynchProfile*> sorted, unused;
+	SynchProfile* profile;
+
+	while ((profile = profiles->Remove()) != NULL)
+		if (profile->acquisitions > 0)
+			sorted.SortedInsert(profile, -profile->totalWait);
+		else
+			unused.Append(profile);
+
+	printf("\nSynchronization profile (sorted by total wait, in ticks):\n");
+	printf("%-4s %-24s %8s %8s %10s %8s %10s %6s\n", "kind", "name", "acquire",
+		"contend", "total wait", "max wait", "total hold", "donate");
+	sorted.Apply(ProfilePrint);
+
+	while ((profile = sorted.Remove()) != NULL)
+		profiles->Append(profile);
+
+	while ((profile = unused.Remove()) != NULL)
+		profiles->Append(profile);
+}
+
+
 //----------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------
@@ -41,13 +182,16 @@
 //
 // "debugName" is an arbitrary name, useful for debugging.
 // "initialValue" is the initial value of the semaphore.
+// "profiled" indica si el semaforo se registra en el perfilador de contencion.
 //----------------------------------------------------------------------------------------
 
-Semaphore::Semaphore(const char* debugName, int initialValue)
+Semaphore::Semaphore(const char* debugName, int initialValue, bool profiled)
 {
 	name = debugName;
 	value = initialValue;
 	queue = new List<Thread*>;
+	taskQueue = new List<Task*>;
+	profile = profiled ? SynchProfileFor("sem", name) : NULL;
 	DEBUG('s', "[SEM]: Sem %s created.\n", name);
 }
 
@@ -60,6 +204,7 @@ Semaphore::Semaphore(const char* debugName, int initialValue)
 Semaphore::~Semaphore()
 {
 	delete queue;
+	delete taskQueue;
 	DEBUG('s', "[SEM]: Sem %s destroyed.\n", name);
 }
 
@@ -75,6 +220,8 @@ void Semaphore::P()
 	// Disable interrupts.
 
 	IntStatus oldLevel = interrupt->SetLevel(IntOff);
+	int start = stats->totalTicks;
+	bool waited = (value == 0);
 
 	// When semaphore not available, go to sleep.
 
@@ -89,6 +236,10 @@ void Semaphore::P()
 	// When semaphore available, consume its value.
 
 	value--;
+
+	if (profile != NULL)
+		profile->Acquired(waited, stats->totalTicks - start);
+
 	DEBUG('s', "[SEM]: Thread %s consumed Sem %s.\n", currentThread->getName(), name);
 
 	// Re-enable interrupts.
@@ -106,6 +257,7 @@ void Semaphore::P()
 void Semaphore::V()
 {
 	Thread* thread;
+	Task* task;
 
 	// Disable interrupts.
 
@@ -118,9 +270,18 @@ void Semaphore::V()
 	if (thread != NULL) {
 		scheduler->ReadyToRun(thread);
 		DEBUG('s', "[SEM]: Thread %s awakened and READY TO RUN.\n", thread->getName());
+		value++;
 	}
+	else if ((task = taskQueue->Remove()) != NULL) {
 
-	value++;
+		// Si no hay threads esperando pero si tareas, le entregamos la unidad del
+		// semaforo directamente a la primera tarea (el valor no se incrementa).
+
+		scheduler->ReadyTask(task);
+		DEBUG('s', "[SEM]: Task %s awakened on Sem %s.\n", task->getName(), name);
+	}
+	else
+		value++;
 
 	// Re-enable interrupts.
 
@@ -128,6 +289,42 @@ void Semaphore::V()
 }
 
 
+//----------------------------------------------------------------------------------------
+// Semaphore::PTask
+// Version no bloqueante de P() para las tareas del kernel. Si el semaforo esta
+// disponible lo consume y retorna 'true'. Si no, encola la tarea y retorna 'false'; la
+// tarea sera reanudada por el Scheduler cuando un V() le entregue el semaforo.
+//
+// "task" es la tarea que espera por el semaforo.
+//----------------------------------------------------------------------------------------
+
+bool Semaphore::PTask(Task* task)
+{
+	bool acquired;
+
+	IntStatus oldLevel = interrupt->SetLevel(IntOff);
+
+	acquired = (value > 0);
+
+	// La espera de las tareas no se mide (no hay un punto en que la tarea retome el
+	// control dentro del semaforo), solo se cuenta.
+
+	if (profile != NULL)
+		profile->Acquired(!acquired, 0);
+
+	if (acquired) {
+		value--;
+		DEBUG('s', "[SEM]: Task %s consumed Sem %s.\n", task->getName(), name);
+	} else {
+		DEBUG('s', "[SEM]: Task %s waiting on Sem %s.\n", task->getName(), name);
+		taskQueue->Append(task);
+	}
+
+	interrupt->SetLevel(oldLevel);
+	return acquired;
+}
+
+
 //----------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------
@@ -154,7 +351,9 @@ Lock::Lock(const char* debugName)
 	strcpy(semName, name);
 	strcat(semName, ".sem");
 
-	lockSem = new Semaphore(semName, 1);
+	lockSem = new Semaphore(semName, 1, false);
+	profile = SynchProfileFor("lock", name);
+	acquiredAt = 0;
 	DEBUG('s', "[LOCK]: Lock %s created.\n", name);
 }
 
@@ -193,6 +392,9 @@ void Lock::Acquire()
 
 	ASSERT(not isHeldByCurrentThread());
 
+	int start = stats->totalTicks;
+	bool contended = (lockOwner != NULL);
+
 	// Se comprueba si es necesario resolver el problema de inversion de prioridades.
 
 	if (lockOwner !=NULL) {
@@ -203,6 +405,9 @@ void Lock::Acquire()
 
 			lockOwner->setPriority(currentThread->getPriority());
 
+			if (profile != NULL)
+				profile->donations++;
+
 			if (lockOwner->getStatus() == READY) {
 
 				Thread* auxTh = scheduler->RemoveFromList(ownerPr);
@@ -231,6 +436,11 @@ void Lock::Acquire()
 	// Seteamos el nuevo lockOwner.
 
 	lockOwner = currentThread;
+	acquiredAt = stats->totalTicks;
+
+	if (profile != NULL)
+		profile->Acquired(contended, acquiredAt - start);
+
 	DEBUG('s', "[LOCK]: Thread %s acquired Lock %s.\n", currentThread->getName(), name);
 	interrupt->SetLevel(oldLevel);
 }
@@ -251,6 +461,9 @@ void Lock::Release()
 
 	lockOwner = NULL;
 
+	if (profile != NULL)
+		profile->totalHold += stats->totalTicks - acquiredAt;
+
 	IntStatus oldLevel = interrupt->SetLevel(IntOff);
 	DEBUG('s', "[LOCK]: Thread %s released Lock %s.\n", currentThread->getName(), name);
 	lockSem->V();
@@ -281,6 +494,7 @@ Condition::Condition(const char* debugName, Lock* conditionLock)
 	name = debugName;
 	relatedLock = conditionLock;
 	waitingList = new List<Semaphore*>;
+	profile = SynchProfileFor("cv", name);
 	DEBUG('s', "[CV]: CondVar %s created.\n", name);
 }
 
@@ -314,8 +528,9 @@ void Condition::Wait()
 	strcat(semName, ".sem.");
 	strcat(semName, currentThread->getName());
 
-	Semaphore* threadSem = new Semaphore(semName, 0);
+	Semaphore* threadSem = new Semaphore(semName, 0, false);
 	waitingList->Append(threadSem);
+	int start = stats->totalTicks;
 
 	// Liberamos el Lock asociado a la variable de condicion y enviamos el thread
 	// llamante a dormir.
@@ -326,6 +541,12 @@ void Condition::Wait()
 	threadSem->P();
 	interrupt->SetLevel(oldLevel);
 
+	// Toda espera sobre una variable de condicion es contendida; medimos hasta el
+	// Signal, sin incluir la nueva adquisicion del lock (se mide en el lock).
+
+	if (profile != NULL)
+		profile->Acquired(true, stats->totalTicks - start);
+
 	// Cuando el thread despierte debe tomar nuevamente el lock.
 
 	relatedLock->Acquire();
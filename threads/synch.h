@@ -25,6 +25,58 @@
 #include "copyright.h"
 #include "thread.h"
 #include "list.h"
+#include "task.h"
+
+// Largo maximo del nombre guardado en cada registro del perfilador.
+
+#define PROFILE_NAME_LEN	32
+
+//----------------------------------------------------------------------------------------
+// Perfilador de contencion (opcional, se activa con la opcion -prof). Por cada nombre de
+// semaforo, cerrojo o variable de condicion se lleva un registro con:
+//
+//	- adquisiciones (P, Acquire o Wait) y cuantas de ellas tuvieron que esperar;
+//	- ticks totales y maximos de espera;
+//	- ticks totales durante los que se retuvo el cerrojo;
+//	- donaciones de prioridad realizadas al dueno del cerrojo.
+//
+// Cada primitiva busca su registro una sola vez, al construirse; si el perfilador esta
+// desactivado el registro es NULL y el unico costo es comprobarlo. Al finalizar Nachos
+// se imprime un reporte ordenado por tiempo total de espera (ver SynchProfileReport).
+//----------------------------------------------------------------------------------------
+
+class SynchProfile {
+
+public:
+
+	SynchProfile(const char* profileKind, const char* profileName);
+
+	// Registra una adquisicion que espero "waited" ticks (0 si no tuvo que esperar).
+
+	void Acquired(bool contended, int waited);
+
+	const char* kind;				// "sem", "lock" o "cv".
+	char name[PROFILE_NAME_LEN];	// Copia del nombre de la primitiva.
+	int acquisitions;				// Cantidad de adquisiciones.
+	int contended;					// Adquisiciones que tuvieron que esperar.
+	int totalWait;					// Ticks totales de espera.
+	int maxWait;					// Mayor espera observada.
+	int totalHold;					// Ticks totales con el cerrojo tomado.
+	int donations;					// Donaciones de prioridad realizadas.
+};
+
+// Activa el perfilador; solo se perfilan las primitivas creadas luego de activarlo.
+
+void SynchProfileStart();
+
+// Retorna el registro asociado a ("kind", "name"), creandolo si no existe, o NULL si el
+// perfilador no esta activo.
+
+SynchProfile* SynchProfileFor(const char* kind, const char* name);
+
+// Imprime el reporte del perfilador, ordenado por tiempo total de espera.
+
+void SynchProfileReport();
 
 //----------------------------------------------------------------------------------------
 // La siguiente clase define un "semaforo" cuyo valor es un entero positivo. El semaforo
@@ -43,9 +95,11 @@ class Semaphore {
 
 public:
 
-	// Constructor: otorga un valor inicial al semaforo.
+	// Constructor: otorga un valor inicial al semaforo. Los semaforos internos de Lock
+	// y Condition se crean con "profiled" en 'false', ya que su espera se contabiliza
+	// en el registro del cerrojo o de la variable de condicion.
 
-	Semaphore(const char* debugName, int initialValue);
+	Semaphore(const char* debugName, int initialValue, bool profiled = true);
 
 	// Destructor: libera memoria.
 
@@ -60,11 +114,19 @@ public:
 	void P();
 	void V();
 
+	// Version de P() para tareas del kernel (ver task.h). Si el semaforo esta
+	// disponible lo consume y retorna 'true'; si no, encola la tarea y retorna 'false'
+	// sin bloquear. El V() que la despierte le entrega la unidad directamente.
+
+	bool PTask(Task* task);
+
 private:
 
 	const char* name;        // Nombre del semaforo, util para depuracion.
 	int value;               // valor del semaforo, siempre es >= 0.
 	List<Thread*>* queue;    // Cola con los hilos que esperan por el semaforo.
+	List<Task*>* taskQueue;  // Cola con las tareas que esperan por el semaforo.
+	SynchProfile* profile;   // Registro del perfilador, NULL si no se perfila.
 };
 
 //----------------------------------------------------------------------------------------
@@ -113,6 +175,8 @@ private:
 	Thread* lockOwner;     // Referencia al thread que actualmente posee el Lock.
 	Semaphore* lockSem;    // Semaforo asociado al Lock.
 	char* semName;         // Nombre del semaforo asociado al Lock.
+	SynchProfile* profile; // Registro del perfilador, NULL si no se perfila.
+	int acquiredAt;        // Tick en que se adquirio el Lock (para el perfilador).
 };
 
 //----------------------------------------------------------------------------------------
@@ -176,6 +240,7 @@ private:
 	Lock* relatedLock;                // Lock asociado a la variable de condicion.
 	List<Semaphore*>* waitingList;    // Lista con los semaforos asociados a los hilos
                                       // que esperan sobre la variable de condicion.
+	SynchProfile* profile;            // Registro del perfilador, NULL si no se perfila.
 };
 
 /*****************************************************************************************
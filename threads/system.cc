@@ -12,6 +12,7 @@
 #include "copyright.h"
 #include "system.h"
 #include "preemptive.h"
+#include "synch.h"
 
 
 //----------------------------------------------------------------------------------------
@@ -36,6 +37,7 @@ FileSystem *fileSystem;
 
 #ifdef FILESYS
 SynchDisk *synchDisk;
+Journal *journal;
 #endif
 
 #ifdef USER_PROGRAM				// Requires either FILESYS or FILESYS_STUB.
@@ -77,6 +79,11 @@ static void TimerInterruptHandler(void* dummy)
 {
 	if (interrupt->getStatus() != IdleMode)
 		interrupt->YieldOnReturn();
+
+#ifdef FILESYS
+	if (synchDisk != NULL)
+		synchDisk->CheckFlush();	// Periodic write back of the disk cache.
+#endif
 }
 
 //----------------------------------------------------------------------------------------
@@ -96,6 +103,7 @@ void Initialize(int argc, char **argv)
 	int argCount;
 	const char* debugArgs = "";
 	bool randomYield = false;
+	bool synchProfiling = false;	// Profile Lock/Condition/Semaphore contention.
 
 	// 2007, Jose Miguel Santos Espino.
 	bool preemptiveScheduling = false;
@@ -103,12 +111,22 @@ void Initialize(int argc, char **argv)
 
 #ifdef USER_PROGRAM
 	bool debugUserProg = false;		// Single step user program.
+	bool spaceAffinity = false;		// Prefer threads of the loaded address space.
+	bool gangScheduling = false;	// Co-schedule threads of the same address space.
 #endif
 
 #ifdef FILESYS_NEEDED
 	bool format = false;			// Format disk.
 #endif
 
+#ifdef FILESYS
+	bool diskCache = true;			// Cache disk sectors.
+	bool logStructured = false;		// Format disk as a log.
+	bool newGeometry = false;		// Geometry given for the disk.
+	int numDisks = 1;				// Disks to stripe the volume over.
+	int stripeUnit = 1;				// Sectors in a row on each disk.
+#endif
+
 #ifdef NETWORK
 	double rely = 1;				// Network reliability.
 	int netname = 0;				// UNIX socket name.
@@ -136,6 +154,10 @@ void Initialize(int argc, char **argv)
 			randomYield = true;
 			argCount = 2;
 
+		} else if (!strcmp(*argv, "-prof")) {
+
+			synchProfiling = true;
+
 		} else if (!strcmp(*argv, "-p")) {	// 2007, Jose Miguel Santos Espino.
 
 			preemptiveScheduling = true;
@@ -152,6 +174,10 @@ void Initialize(int argc, char **argv)
 #ifdef USER_PROGRAM
 		if (!strcmp(*argv, "-s"))
 			debugUserProg = true;
+		else if (!strcmp(*argv, "-aff"))
+			spaceAffinity = true;
+		else if (!strcmp(*argv, "-gang"))
+			gangScheduling = true;
 #endif
 
 #ifdef FILESYS_NEEDED
@@ -159,6 +185,27 @@ void Initialize(int argc, char **argv)
 			format = true;
 #endif
 
+#ifdef FILESYS
+		if (!strcmp(*argv, "-nc"))
+			diskCache = false;
+		else if (!strcmp(*argv, "-lfs"))
+			logStructured = true;
+		else if (!strcmp(*argv, "-geom")) {
+			ASSERT(argc > 2);
+			SectorsPerTrack = atoi(*(argv + 1));
+			NumTracks = atoi(*(argv + 2));
+			ASSERT(SectorsPerTrack > 0 && NumTracks > 0);
+			newGeometry = true;
+			argCount = 3;
+		} else if (!strcmp(*argv, "-stripe")) {
+			ASSERT(argc > 2);
+			numDisks = atoi(*(argv + 1));
+			stripeUnit = atoi(*(argv + 2));
+			ASSERT(numDisks > 0 && numDisks <= MaxDisks && stripeUnit > 0);
+			argCount = 3;
+		}
+#endif
+
 #ifdef NETWORK
 		if (!strcmp(*argv, "-l")) {
 			ASSERT(argc > 1);
@@ -176,6 +223,10 @@ void Initialize(int argc, char **argv)
 	// End options loop. Start Initialization of global variables.
 
 	DebugInit(debugArgs);				// Initialize DEBUG messages.
+
+	if (synchProfiling)
+		SynchProfileStart();			// Before any synchronization object exists.
+
 	stats = new Statistics();			// Collect statistics.
 	interrupt = new Interrupt;			// Start up interrupt handling.
 	scheduler = new Scheduler();		// Initialize the ready queue.
@@ -210,6 +261,8 @@ void Initialize(int argc, char **argv)
 
 #ifdef USER_PROGRAM
 	machine = new Machine(debugUserProg);			// This must come first.
+	scheduler->SetSpaceAffinity(spaceAffinity);		// Address space affinity.
+	scheduler->SetGangScheduling(gangScheduling);	// Gang scheduling.
 	synchConsole = new SynchConsole(NULL, NULL);	// Initialize a SynchConsole.
 	fileDescTable = new FDTable();					// Initialize a File Descriptor Table.
 	processTable = new ProcessTable();				// Initialize a Process Table.
@@ -217,10 +270,20 @@ void Initialize(int argc, char **argv)
 #endif
 
 #ifdef FILESYS
-	synchDisk = new SynchDisk("DISK");
+	if (format && newGeometry) {		// Made again, with the new geometry.
+		for (int i = 0; i < numDisks; i++) {
+			char* name = SynchDisk::UnitName("DISK", i, numDisks);
+			Unlink(name);
+			delete [] name;
+		}
+	}
+	synchDisk = new SynchDisk("DISK", diskCache, numDisks, stripeUnit);
+	journal = new Journal(format);		// Replays the log, if not formatting.
 #endif
 
-#ifdef FILESYS_NEEDED
+#ifdef FILESYS
+	fileSystem = new FileSystem(format, logStructured);
+#elif defined(FILESYS_NEEDED)
 	fileSystem = new FileSystem(format);
 #endif
 
@@ -241,6 +304,8 @@ void Initialize(int argc, char **argv)
 
 void Cleanup()
 {
+	SynchProfileReport();				// Only if -prof was given.
+
 	printf("\nCleaning up...\n");
 
 	// 2007, Jose Miguel Santos Espino.
@@ -264,6 +329,7 @@ void Cleanup()
 #endif
 
 #ifdef FILESYS
+	delete journal;
 	delete synchDisk;
 #endif
 
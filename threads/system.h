@@ -64,7 +64,9 @@ extern FileSystem  *fileSystem;
 
 #ifdef FILESYS
 #include "synchdisk.h"
+#include "journal.h"
 extern SynchDisk   *synchDisk;
+extern Journal     *journal;			// Write-ahead log of the metadata.
 #endif
 
 #ifdef NETWORK
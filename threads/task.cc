@@ -0,0 +1,58 @@
+//----------------------------------------------------------------------------------------
+// task.cc
+// Rutinas para manejar tareas livianas del kernel. La planificacion de las tareas listas
+// la realiza el Scheduler (ver Scheduler::ReadyTask y Scheduler::DispatchTasks).
+//----------------------------------------------------------------------------------------
+// Edited by: Leonardo Forti, Sebastian Galiano, Diego Smania
+//----------------------------------------------------------------------------------------
+
+
+#include "copyright.h"
+#include "task.h"
+#include "system.h"
+
+
+//----------------------------------------------------------------------------------------
+// Task::Task
+// Inicializa una tarea. La tarea no corre hasta que se invoque Start().
+//
+// "debugName" es el nombre de la tarea, util para depuracion.
+//----------------------------------------------------------------------------------------
+
+Task::Task(const char* debugName)
+{
+	name = debugName;
+	resumePoint = 0;
+	DEBUG('k', "[TASK]: Task %s created.\n", name);
+}
+
+//----------------------------------------------------------------------------------------
+// Task::~Task
+//----------------------------------------------------------------------------------------
+
+Task::~Task()
+{
+	DEBUG('k', "[TASK]: Task %s destroyed.\n", name);
+}
+
+//----------------------------------------------------------------------------------------
+// Task::Start
+// Entrega la tarea al Scheduler para que el dispatcher la ejecute.
+//----------------------------------------------------------------------------------------
+
+void Task::Start()
+{
+	scheduler->StartTask(this);
+}
+
+//----------------------------------------------------------------------------------------
+// Task::Reschedule
+// Vuelve a colocar la tarea al final de la cola de tareas listas.
+//----------------------------------------------------------------------------------------
+
+void Task::Reschedule()
+{
+	IntStatus oldLevel = interrupt->SetLevel(IntOff);
+	scheduler->ReadyTask(this);
+	interrupt->SetLevel(oldLevel);
+}
@@ -0,0 +1,130 @@
+//----------------------------------------------------------------------------------------
+// task.h
+// Tareas livianas del kernel ("kernel tasks"). Una tarea es una rutina reanudable que no
+// tiene stack propio: cuando necesita esperar por un evento (un semaforo, la finalizacion
+// de un pedido al disco, la llegada de un mensaje a un mailbox) guarda en que punto se
+// quedo y retorna. Cuando el evento ocurre, el Scheduler la coloca en la cola de tareas
+// listas y un unico thread del kernel ("task dispatcher") la reanuda desde ese punto.
+//
+// De esta manera miles de esperas concurrentes sobre dispositivos cuestan solo lo que
+// ocupa cada objeto Task, y no un stack de StackSize palabras ni un SWITCH completo por
+// cada espera.
+//
+// Las tareas se escriben como una subclase de Task que implementa Run() utilizando las
+// macros TASK_BEGIN, TASK_P, TASK_YIELD y TASK_END (al estilo de los "protothreads"):
+//
+//	TaskStatus EchoTask::Run()
+//	{
+//		TASK_BEGIN();
+//		for (;;) {
+//			TASK_P(requestSem);
+//			...
+//		}
+//		TASK_END();
+//	}
+//
+// IMPORTANTE: las variables locales de Run() NO se conservan entre esperas, ya que no
+// hay un stack que las preserve. Todo estado que deba sobrevivir a un TASK_P() tiene
+// que ser un miembro de la subclase. Por la misma razon no se puede esperar desde una
+// funcion llamada por Run(), solo desde el cuerpo de Run().
+//
+// Una tarea corre en el contexto del thread dispatcher, por lo que si invoca una
+// operacion bloqueante comun (por ejemplo Lock::Acquire) bloquea a todas las tareas
+// hasta que dicha operacion retorne.
+//
+// NOTA: Utilizaremos la bandera 'k' para los mensajes de debug asociados a tareas.
+//----------------------------------------------------------------------------------------
+// Edited by: Leonardo Forti, Sebastian Galiano, Diego Smania
+//----------------------------------------------------------------------------------------
+
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "copyright.h"
+#include "utility.h"
+
+
+// Resultado de cada ejecucion de Task::Run().
+
+enum TaskStatus { TASK_WAITING, TASK_DONE };
+
+//----------------------------------------------------------------------------------------
+// Macros para escribir el cuerpo de una tarea. Cada punto de espera registra en
+// "resumePoint" el numero de linea desde el cual debe continuar la tarea, y el switch
+// abierto por TASK_BEGIN salta directamente a ese punto cuando la tarea se reanuda.
+//----------------------------------------------------------------------------------------
+
+// Inicio del cuerpo de la tarea.
+
+#define TASK_BEGIN()	switch (resumePoint) { case 0:
+
+// Espera sobre un semaforo (equivalente a sem->P()). Si el semaforo no esta disponible
+// la tarea queda encolada en el y retorna; el V() que la despierte le entrega la unidad
+// del semaforo directamente.
+
+#define TASK_P(sem)                                                                      \
+	do {                                                                                 \
+		resumePoint = __LINE__;                                                          \
+		if (!(sem)->PTask(this))                                                         \
+			return TASK_WAITING;                                                         \
+		case __LINE__:;                                                                  \
+	} while (0)
+
+// Cede el dispatcher al resto de las tareas listas.
+
+#define TASK_YIELD()                                                                     \
+	do {                                                                                 \
+		resumePoint = __LINE__;                                                          \
+		Reschedule();                                                                    \
+		return TASK_WAITING;                                                             \
+		case __LINE__:;                                                                  \
+	} while (0)
+
+// Fin del cuerpo de la tarea. El dispatcher destruye las tareas finalizadas.
+
+#define TASK_END()	} resumePoint = 0; return TASK_DONE
+
+
+//----------------------------------------------------------------------------------------
+// La siguiente clase define una tarea del kernel.
+//----------------------------------------------------------------------------------------
+
+class Task {
+
+public:
+
+	// Constructor y destructor.
+
+	Task(const char* debugName);
+	virtual ~Task();
+
+	// Metodo util para depuracion.
+
+	const char* getName() { return name; }
+
+	// Coloca la tarea en la cola de tareas listas del Scheduler. La tarea pasa a ser
+	// propiedad del dispatcher, que la destruye cuando Run() retorna TASK_DONE.
+
+	void Start();
+
+	// Cuerpo de la tarea. Se ejecuta desde el comienzo la primera vez, y desde el
+	// ultimo punto de espera en las siguientes.
+
+	virtual TaskStatus Run() = 0;
+
+protected:
+
+	// Vuelve a encolar la tarea como lista (usado por TASK_YIELD).
+
+	void Reschedule();
+
+	int resumePoint;		// Punto desde el cual reanudar Run(), 0 para el comienzo.
+
+private:
+
+	const char* name;		// Nombre de la tarea, util para depuracion.
+};
+
+
+#endif // TASK_H
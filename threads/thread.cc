@@ -44,6 +44,11 @@ Thread::Thread(const char* threadName, bool joinable, int p)
 	stack = NULL;
 	status = JUST_CREATED;
 
+	// El registro de contabilidad queda a cargo del Scheduler.
+
+	accounting = new ThreadStats(threadName);
+	scheduler->AddThreadStats(accounting);
+
 #ifdef USER_PROGRAM
 	space = NULL;
 #endif
@@ -77,7 +82,7 @@ Thread::Thread(const char* threadName, bool joinable, int p)
 		//joinPort = new Port(auxName);
 	}
 
-	// Inicializamos la prioridad del thread (0 por defecto, la menor).
+	// Inicializamos la prioridad del thread (_NORMAL_PRIORITY por defecto).
 
 	init_priority = setPriority(p);
 }
@@ -99,9 +104,18 @@ Thread::~Thread()
 
 	ASSERT(this != currentThread);
 
+	scheduler->FinishThreadStats(accounting);
+
 #ifdef USER_PROGRAM
+
+	// Solo los threads de usuario (creados por Exec) tienen el nombre en memoria
+	// dinamica; los threads del kernel suelen usar una constante.
+
 	DEBUG('x', "Deleting name and space of thread \"%s\"\n", name);
-	delete name;
+
+	if (space != NULL)
+		delete name;
+
 	delete space;
 #endif
 
@@ -109,6 +123,38 @@ Thread::~Thread()
 		DeallocBoundedArray((char *) stack, StackSize * sizeof(HostMemoryAddress));
 }
 
+//----------------------------------------------------------------------------------------
+// Thread::setStatus
+// Cambia el estado del thread, acumulando en su contabilidad el tiempo transcurrido en el
+// estado anterior. El paso de READY a RUNNING es la latencia de despacho del thread.
+//
+// "st" es el nuevo estado.
+//----------------------------------------------------------------------------------------
+
+void Thread::setStatus(ThreadStatus st)
+{
+	int elapsed = stats->totalTicks - accounting->since;
+
+	switch (status) {
+		case RUNNING:
+			accounting->runTicks += elapsed;
+			break;
+		case READY:
+			accounting->readyTicks += elapsed;
+			if (st == RUNNING)
+				accounting->RecordLatency(elapsed);
+			break;
+		case BLOCKED:
+			accounting->blockedTicks += elapsed;
+			break;
+		default:
+			break;
+	}
+
+	accounting->since = stats->totalTicks;
+	status = st;
+}
+
 //----------------------------------------------------------------------------------------
 // Thread::Fork
 // Invoke (*func)(arg), allowing caller and callee to execute concurrently.
@@ -224,9 +270,11 @@ void Thread::Finish()
 // level to its original state, in case we are called with interrupts disabled.
 //
 // Similar to Thread::Sleep(), but a little different.
+//
+// "preempted" indica si el cambio de contexto lo pidio el timer (ver Interrupt::OneTick).
 //----------------------------------------------------------------------------------------
 
-void Thread::Yield ()
+void Thread::Yield (bool preempted)
 {
 	Thread *nextThread;
 	IntStatus oldLevel = interrupt->SetLevel(IntOff);
@@ -239,7 +287,7 @@ void Thread::Yield ()
 
 	if (nextThread != NULL) {
 		scheduler->ReadyToRun(this);
-		scheduler->Run(nextThread);
+		scheduler->Run(nextThread, preempted);
 	}
 
 	interrupt->SetLevel(oldLevel);
@@ -380,6 +428,67 @@ int Thread::setPriority(int p)
 }
 
 
+//----------------------------------------------------------------------------------------
+// ThreadStats::ThreadStats
+// Inicializa la contabilidad de un thread en cero.
+//
+// "threadName" es el nombre del thread; se guarda una copia, ya que el registro puede
+// sobrevivir al thread.
+//----------------------------------------------------------------------------------------
+
+ThreadStats::ThreadStats(const char* threadName)
+{
+	strncpy(name, threadName, THREAD_NAME_LEN - 1);
+	name[THREAD_NAME_LEN - 1] = '\0';
+
+	finished = false;
+	since = stats->totalTicks;
+	runTicks = readyTicks = blockedTicks = 0;
+	voluntarySwitches = involuntarySwitches = 0;
+	maxLatency = 0;
+
+	for (int i = 0; i < LATENCY_BUCKETS; i++)
+		latency[i] = 0;
+}
+
+//----------------------------------------------------------------------------------------
+// ThreadStats::RecordLatency
+// Suma una latencia al histograma. El intervalo i cuenta las latencias menores a 10^(i+1)
+// ticks; el ultimo intervalo cuenta todas las restantes.
+//
+// "ticks" es la latencia a registrar.
+//----------------------------------------------------------------------------------------
+
+void ThreadStats::RecordLatency(int ticks)
+{
+	int bucket = 0;
+
+	for (int limit = 10; bucket < LATENCY_BUCKETS - 1 && ticks >= limit; limit *= 10)
+		bucket++;
+
+	latency[bucket]++;
+
+	if (ticks > maxLatency)
+		maxLatency = ticks;
+}
+
+//----------------------------------------------------------------------------------------
+// ThreadStats::Print
+// Imprime la contabilidad del thread.
+//----------------------------------------------------------------------------------------
+
+void ThreadStats::Print()
+{
+	printf("%s%s: run %d, ready %d, blocked %d ticks; switches %d voluntary, %d involuntary\n",
+		name, finished ? " (finished)" : "", runTicks, readyTicks, blockedTicks,
+		voluntarySwitches, involuntarySwitches);
+
+	printf("    latency: <10 %d, <100 %d, <1K %d, <10K %d, <100K %d, more %d (max %d)\n",
+		latency[0], latency[1], latency[2], latency[3], latency[4], latency[5],
+		maxLatency);
+}
+
+
 #ifdef USER_PROGRAM
 #include "machine.h"
 
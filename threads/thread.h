@@ -60,9 +60,59 @@ const int StackSize = 4 * 1024; // In words.
 
 enum ThreadStatus { JUST_CREATED, RUNNING, READY, BLOCKED };
 
-// Definimos el numero maximo de prioridades para los threads.
+// Definimos el numero maximo de prioridades para los threads. Se crean con la prioridad
+// normal; la prioridad de fondo, por debajo de ella, es para threads que solo deben
+// correr cuando ningun otro esta listo (por ejemplo, el desfragmentador).
 
 #define _MAX_PRIORITY 5
+#define _NORMAL_PRIORITY 1
+#define _BACKGROUND_PRIORITY 0
+
+// Cantidad de intervalos del histograma de latencias (ver ThreadStats), y largo maximo
+// del nombre guardado en cada registro. Deben coincidir con los valores que ve el
+// usuario en syscall.h (ver Syscall_GetThreadStats).
+
+#define LATENCY_BUCKETS		6
+#define THREAD_NAME_LEN		32
+
+
+//----------------------------------------------------------------------------------------
+// La siguiente clase define la contabilidad de un thread: ticks corriendo, esperando en
+// la cola de listos y bloqueado, cambios de contexto voluntarios (el thread se bloqueo)
+// e involuntarios (el timer le quito la CPU estando listo), y un
+// histograma de latencias entre que el thread queda listo y comienza a correr.
+//
+// Los registros los conserva el Scheduler aun despues de destruido el thread, para
+// mostrarlos al finalizar Nachos (ver Scheduler::PrintThreadStats).
+//----------------------------------------------------------------------------------------
+
+class ThreadStats {
+
+public:
+
+	ThreadStats(const char* threadName);
+
+	// Registra una latencia de "ticks" en el histograma.
+
+	void RecordLatency(int ticks);
+
+	// Imprime la contabilidad del thread.
+
+	void Print();
+
+	char name[THREAD_NAME_LEN];		// Copia del nombre del thread.
+	bool finished;					// Indica si el thread ya fue destruido.
+	int since;						// Tick del ultimo cambio de estado.
+
+	int runTicks;					// Ticks en estado RUNNING.
+	int readyTicks;					// Ticks en la cola de listos.
+	int blockedTicks;				// Ticks bloqueado.
+	int voluntarySwitches;			// Cambios de contexto por bloqueo.
+	int involuntarySwitches;		// Cambios de contexto estando listo.
+
+	int latency[LATENCY_BUCKETS];	// Histograma de latencias: <10, <100, ... ticks.
+	int maxLatency;					// Mayor latencia observada.
+};
 
 
 //----------------------------------------------------------------------------------------
@@ -102,7 +152,7 @@ public:
 
 	// Initialize a Thread.
 
-	Thread(const char* debugName, bool joinable = false, int p = 0);
+	Thread(const char* debugName, bool joinable = false, int p = _NORMAL_PRIORITY);
 
 	// Deallocate a Thread.
 	// NOTE: thread being deleted must not be running when delete is called.
@@ -113,9 +163,10 @@ public:
 
 	void Fork(VoidFunctionPtr func, void* arg);
 
-	// Relinquish the CPU if any other thread is runnable.
+	// Relinquish the CPU if any other thread is runnable. "preempted" indica que la CPU
+	// se la quita el timer (cambio de contexto involuntario).
 
-	void Yield();
+	void Yield(bool preempted = false);
 
 	// Put the thread to sleep and relinquish the processor.
 
@@ -131,8 +182,9 @@ public:
 
 	// Other operations.
 
-	void setStatus(ThreadStatus st) { status = st; }
+	void setStatus(ThreadStatus st);
 	ThreadStatus getStatus() { return status; }
+	ThreadStats* getStats() { return accounting; }
 	const char* getName() { return (name); }
 	void Print() { printf("%s, ", name); }
 
@@ -154,6 +206,7 @@ private:
 								// (If NULL, don't deallocate stack).
 	ThreadStatus status;		// Status: ready, running or blocked.
 	const char* name;			// Name of the thread.
+	ThreadStats* accounting;	// Contabilidad del thread (propiedad del Scheduler).
 
 	// Datos privados asociados al uso de JOIN.
 
@@ -21,6 +21,7 @@
 #include "stdlib.h"
 #include "time.h"
 #include "thread.h"
+#include "task.h"
 
 
 //----------------------------------------------------------------------------------------
@@ -403,6 +404,91 @@ void PriorityTest()
 }
 
 
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+// TASK TEST -----------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------
+
+
+// Cantidad de tareas y de rondas del test.
+
+#define TASK_TEST_TASKS		1000
+#define TASK_TEST_ROUNDS	3
+
+//----------------------------------------------------------------------------------------
+// EchoTask.
+// Tarea que espera un pedido en <requests>, lo cuenta y responde en <replies>, durante
+// TASK_TEST_ROUNDS rondas. El estado que sobrevive a las esperas es un miembro.
+//----------------------------------------------------------------------------------------
+
+class EchoTask : public Task {
+
+public:
+
+	EchoTask(Semaphore* req, Semaphore* rep, int* count) : Task("echo task")
+	{
+		requests = req;
+		replies = rep;
+		served = count;
+		round = 0;
+	}
+
+	TaskStatus Run()
+	{
+		TASK_BEGIN();
+
+		for (round = 0; round < TASK_TEST_ROUNDS; round++) {
+			TASK_P(requests);
+			(*served)++;
+			replies->V();
+		}
+
+		TASK_END();
+	}
+
+private:
+
+	Semaphore* requests;	// Semaforo sobre el que se esperan los pedidos.
+	Semaphore* replies;		// Semaforo sobre el que se responde.
+	int* served;			// Contador compartido de pedidos atendidos.
+	int round;				// Ronda actual (debe ser miembro, no variable local).
+};
+
+//----------------------------------------------------------------------------------------
+// TaskTest.
+// Lanza TASK_TEST_TASKS tareas que quedan esperando sobre un mismo semaforo, y las
+// despierta TASK_TEST_ROUNDS veces. Todas corren sobre el unico thread dispatcher.
+//----------------------------------------------------------------------------------------
+
+void TaskTest()
+{
+	printf(">>> Entering Task Test...\n");
+
+	Semaphore* requests = new Semaphore("taskRequests", 0);
+	Semaphore* replies = new Semaphore("taskReplies", 0);
+	int served = 0;
+
+	for (int k = 0; k < TASK_TEST_TASKS; k++)
+		(new EchoTask(requests, replies, &served))->Start();
+
+	int start = stats->totalTicks;
+
+	for (int r = 0; r < TASK_TEST_ROUNDS * TASK_TEST_TASKS; r++) {
+		requests->V();
+		replies->P();
+	}
+
+	printf(">>> %d tasks served %d requests in %d ticks (%d bytes per waiting task).\n",
+	       TASK_TEST_TASKS, served, stats->totalTicks - start, (int) sizeof(EchoTask));
+
+	delete requests;
+	delete replies;
+}
+
+
 //----------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------
 //----------------------------------------------------------------------------------------
@@ -424,4 +510,6 @@ void Test(const char* testCase)
 		JoinTest();
 	else if (!strcmp(testCase, "prior"))
 		PriorityTest();
+	else if (!strcmp(testCase, "task"))
+		TaskTest();
 }
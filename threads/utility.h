@@ -20,6 +20,7 @@
 //      'j' -- thread join method
 //      'p' -- port (synchronic mechanism)
 //      'y' -- syscalls implementations
+//      'k' -- kernel tasks (lightweight, stackless)
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation of liability
@@ -270,6 +270,10 @@ AddrSpace::AddrSpace(OpenFile *executable)
 
 AddrSpace::~AddrSpace()
 {
+	// Si es el espacio cargado en la maquina, el Scheduler no debe volver a salvarlo.
+
+	scheduler->ForgetSpace(this);
+
 	for (int i = 0; i < argc_real; i++) {
 		DEBUG('x', "Deleting arg %d: %s!\n", i, argv_real[i]);
 		delete argv_real[i];
@@ -362,6 +366,8 @@ void AddrSpace::RestoreState()
 	for (int i = 0; i < TLBSize; i++)
 		machine->tlb[i].valid = false;
 
+	stats->numTLBFlushes++;
+
 #else
 
 	machine->pageTable = pageTable;
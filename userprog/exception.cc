@@ -63,7 +63,7 @@ void IncreasePC()
 
 void RunProcess(void* dummy)
 {
-	currentThread->space->RestoreState();	// Load page table register.
+	scheduler->LoadSpace(currentThread->space);	// Load page table register.
 	currentThread->space->InitRegisters();	// Set the initial register values.
 
 	machine->Run();							// Jump to the user progam.
@@ -607,6 +607,113 @@ void Syscall_ExecWithArgs()
 	return;
 }
 
+//----------------------------------------------------------------------------------------
+// Syscall_Mkdir().
+//----------------------------------------------------------------------------------------
+
+void Syscall_Mkdir()
+{
+	DEBUG('y', "[SYSCALL]: Mkdir, initiated by user program.\n");
+
+	// Obtenemos el nombre del directorio desde el espacio de usuario.
+
+	int usrDirNameAddr = machine->ReadRegister(4);
+	int strLen = getStrLenFromUsr(usrDirNameAddr);
+	char *dirName = new char[strLen + 1];
+	readStrFromUsr(usrDirNameAddr, dirName);
+
+	// Creamos el directorio y almacenamos el resultado (0 OK, -1 BAD).
+
+	if (fileSystem->Mkdir(dirName))
+	{
+		DEBUG('y', "[SYSCALL]: Directory %s created succesfully.\n", dirName);
+		machine->WriteRegister(2, 0);
+	}
+	else
+	{
+		DEBUG('y', "[SYSCALL]: Failed to create directory %s.\n", dirName);
+		machine->WriteRegister(2, -1);
+	}
+
+	delete [] dirName;
+}
+
+//----------------------------------------------------------------------------------------
+// Syscall_Rmdir().
+//----------------------------------------------------------------------------------------
+
+void Syscall_Rmdir()
+{
+	DEBUG('y', "[SYSCALL]: Rmdir, initiated by user program.\n");
+
+	// Obtenemos el nombre del directorio desde el espacio de usuario.
+
+	int usrDirNameAddr = machine->ReadRegister(4);
+	int strLen = getStrLenFromUsr(usrDirNameAddr);
+	char *dirName = new char[strLen + 1];
+	readStrFromUsr(usrDirNameAddr, dirName);
+
+	// Borramos el directorio, que debe estar vacio, y almacenamos el resultado.
+
+	if (fileSystem->Rmdir(dirName))
+	{
+		DEBUG('y', "[SYSCALL]: Directory %s removed succesfully.\n", dirName);
+		machine->WriteRegister(2, 0);
+	}
+	else
+	{
+		DEBUG('y', "[SYSCALL]: Failed to remove directory %s.\n", dirName);
+		machine->WriteRegister(2, -1);
+	}
+
+	delete [] dirName;
+}
+
+//----------------------------------------------------------------------------------------
+// Syscall_GetThreadStats().
+//----------------------------------------------------------------------------------------
+
+void Syscall_GetThreadStats()
+{
+	DEBUG('y', "[SYSCALL]: GetThreadStats, initiated by user program.\n");
+
+	// Obtenemos los argumentos almacenados en los registros.
+
+	int index = machine->ReadRegister(4);
+	int usrInfoAddr = machine->ReadRegister(5);
+
+	// Controlamos que el registro pedido exista.
+
+	ThreadStats* record = scheduler->GetThreadStats(index);
+
+	if (record == NULL)
+	{
+		DEBUG('y', "[SYSCALL]: No thread stats with index %d.\n", index);
+		machine->WriteRegister(2, -1);
+		return;
+	}
+
+	// Armamos la estructura de usuario, con los enteros en el formato de la maquina.
+
+	ThreadStatsInfo info;
+
+	ASSERT(STATS_LATENCY_BUCKETS == LATENCY_BUCKETS && STATS_NAME_LEN == THREAD_NAME_LEN);
+	memcpy(info.name, record->name, STATS_NAME_LEN);
+	info.finished = WordToMachine(record->finished ? 1 : 0);
+	info.runTicks = WordToMachine(record->runTicks);
+	info.readyTicks = WordToMachine(record->readyTicks);
+	info.blockedTicks = WordToMachine(record->blockedTicks);
+	info.voluntarySwitches = WordToMachine(record->voluntarySwitches);
+	info.involuntarySwitches = WordToMachine(record->involuntarySwitches);
+	info.maxLatency = WordToMachine(record->maxLatency);
+
+	for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+		info.latency[i] = WordToMachine(record->latency[i]);
+
+	writeBuffToUsr((char*) &info, usrInfoAddr, sizeof(ThreadStatsInfo));
+	machine->WriteRegister(2, 0);
+}
+
 //----------------------------------------------------------------------------------------
 // ExceptionHandler
 // Entry point into the Nachos kernel. Called when a user program is executing, and
@@ -681,6 +788,21 @@ void ExceptionHandler(ExceptionType which)
 				IncreasePC();
 				break;
 
+			case SC_GetThreadStats:
+				Syscall_GetThreadStats();
+				IncreasePC();
+				break;
+
+			case SC_Mkdir:
+				Syscall_Mkdir();
+				IncreasePC();
+				break;
+
+			case SC_Rmdir:
+				Syscall_Rmdir();
+				IncreasePC();
+				break;
+
 			default:
 				printf("[SYSCALL]: Unexpected user mode exception %d %d\n", which, type);
 				ASSERT(false);
@@ -36,7 +36,7 @@ StartProcess(const char *filename)
     delete executable;			// close file
 
     space->InitRegisters();		// set the initial register values
-    space->RestoreState();		// load page table register
+    scheduler->LoadSpace(space);	// load page table register
 
     machine->Run();			// jump to the user progam
     ASSERT(false);			// machine->Run never returns;
@@ -31,6 +31,9 @@
 #define SC_Close	8
 #define SC_Fork		9
 #define SC_Yield	10
+#define SC_GetThreadStats	11
+#define SC_Mkdir	12
+#define SC_Rmdir	13
 
 #ifndef IN_ASM
 
@@ -72,7 +75,7 @@ int Join(SpaceId id);
 
 
 //----------------------------------------------------------------------------------------
-// File system operations: Create, Open, Read, Write, Close.
+// File system operations: Create, Open, Read, Write, Close, Mkdir, Rmdir.
 // These functions are patterned after UNIX -- files represent both files *and* hardware
 // I/O devices.
 //
@@ -116,6 +119,15 @@ int Read(char *buffer, int size, OpenFileId id);
 
 void Close(OpenFileId id);
 
+// Create a directory, with "name". Return 0, or -1 if it could not be created.
+
+int Mkdir(char *name);
+
+// Remove the directory "name", which must be empty. Return 0, or -1 if it could not be
+// removed.
+
+int Rmdir(char *name);
+
 
 //----------------------------------------------------------------------------------------
 // User-level thread operations: Fork and Yield. To allow multiple threads to run within
@@ -132,5 +144,35 @@ void Fork(void (*func)());
 void Yield();
 
 
+//----------------------------------------------------------------------------------------
+// Scheduler accounting: GetThreadStats.
+//----------------------------------------------------------------------------------------
+
+#define STATS_LATENCY_BUCKETS	6
+#define STATS_NAME_LEN			32
+
+// Accounting of one kernel or user thread, as kept by the Nachos scheduler. "latency"
+// counts the delays between becoming ready and running: < 10, < 100, < 1000, < 10000,
+// < 100000 ticks, and the rest.
+
+typedef struct {
+	char name[STATS_NAME_LEN];
+	int finished;
+	int runTicks;
+	int readyTicks;
+	int blockedTicks;
+	int voluntarySwitches;
+	int involuntarySwitches;
+	int latency[STATS_LATENCY_BUCKETS];
+	int maxLatency;
+} ThreadStatsInfo;
+
+// Copy into "info" the accounting of the thread number "index" (in creation order,
+// including the most recently finished threads). Return 0, or -1 if there is no such
+// thread.
+
+int GetThreadStats(int index, ThreadStatsInfo *info);
+
+
 #endif /* IN_ASM */
 #endif /* SYSCALL_H */